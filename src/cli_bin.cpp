@@ -244,6 +244,9 @@ main(int argc, char **argv)
     bye("nothing to %s\n", OP_str);
   }
 
+  // short-lived process => never free individual config nodes
+  cnode::CfgNodeArena::useProcessArena(true);
+
   Cstore *cstore = Cstore::createCstore(OP_use_edit_level);
   Cpath path_comps(const_cast<const char **>(argv + 1), argc - 1);
 
@@ -26,8 +26,8 @@
 #include <cstore/util.hpp>
 #include <cnode/cnode.hpp>
 #include <cnode/cnode-algorithm.hpp>
+#include <cnode/cnode-image.hpp>
 #include <commit/commit-algorithm.hpp>
-#include <cparse/cparse.hpp>
 
 using namespace cstore;
 
@@ -545,6 +545,37 @@ showConfig(Cstore& cstore, const Cpath& args)
   exit_code = res;
 }
 
+/* output the config under the specified path in JSON format (see
+ * cnode::show_cfg_json()). this is the working config if in a config
+ * session, the active config otherwise. available options:
+ *   --show-active-only
+ *   --show-show-defaults
+ *   --show-hide-secrets
+ */
+static void
+showConfigJson(Cstore& cstore, const Cpath& args)
+{
+  Cpath nargs(args);
+  bool active = (!cstore.inSession() || op_show_active_only);
+  cnode::CfgNode root(cstore, nargs, active, true);
+  exit_code = cnode::show_cfg_json(root, op_show_show_defaults,
+                                   op_show_hide_secrets);
+}
+
+/* write the binary image of the active config to the specified file (see
+ * cnode::CfgImage). the image can be used instead of a config file, e.g.,
+ * for loadFile and the "cf" functions below.
+ */
+static void
+saveConfigImage(Cstore& cstore, const Cpath& args)
+{
+  Cpath path;
+  cnode::CfgNode root(cstore, path, true, true);
+  if (!cnode::CfgImage::save(root, args[0])) {
+    exit(1);
+  }
+}
+
 static void
 loadFile(Cstore& cstore, const Cpath& args)
 {
@@ -560,7 +591,18 @@ _cf_process_args(Cstore& cstore, const Cpath& args, Cpath& path)
   for (size_t i = 1; i < args.size(); i++) {
     path.push(args[i]);
   }
-  cnode::CfgNode *root = cparse::parse_file(args[0], cstore);
+  cnode::CfgNode *root;
+  if (args[0] == cnode::ACTIVE_CFG || args[0] == cnode::WORKING_CFG) {
+    // read lazily so that only the nodes along the path are read
+    bool active = (args[0] == cnode::ACTIVE_CFG);
+    if (!active && !cstore.inSession()) {
+      exit(1);
+    }
+    root = cnode::CfgNode::createLazy(cstore, Cpath(), active);
+  } else {
+    // only the subtree at the path is needed
+    root = cnode::CfgImage::loadConfig(args[0], cstore, path);
+  }
   if (!root) {
     // failed to parse config file
     exit(1);
@@ -597,6 +639,8 @@ getPostCommitHookDir(Cstore& cstore, const Cpath& args)
  *
  * the above command will exit with 0 (success) if the "allow-root" node
  * is present in the specified config file (or exit with 1 if it's not).
+ * "@ACTIVE" or "@WORKING" can be specified instead of the config file to
+ * query the active or working config in the same way.
  */
 static void
 cfExists(Cstore& cstore, const Cpath& args)
@@ -680,6 +724,8 @@ static OpT ops[] = {
 
   OP(showCfg, -1, NULL, -1, NULL, true),
   OP(showConfig, -1, NULL, -1, NULL, true),
+  OP(showConfigJson, -1, NULL, -1, NULL, NULL),
+  OP(saveConfigImage, 1, "Must specify image file", -1, NULL, NULL),
   OP(loadFile, 1, "Must specify config file", -1, NULL, NULL),
 
   OP(getPreCommitHookDir, 0, "No argument expected", -1, NULL, NULL),
@@ -764,6 +810,9 @@ main(int argc, char **argv)
 
   Cpath args(const_cast<const char **>(nargv), nargs);
 
+  // short-lived process => never free individual config nodes
+  cnode::CfgNodeArena::useProcessArena(true);
+
   // call the op function
   Cstore *cstore = Cstore::createCstore(OP_use_edit);
   OP_func(*cstore, args);
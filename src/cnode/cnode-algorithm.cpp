@@ -18,10 +18,12 @@
 #include <cstdlib>
 #include <cstring>
 #include <tr1/memory>
+#include <unistd.h>
 
 #include <cstore/cstore.hpp>
 #include <cnode/cnode.hpp>
-#include <cparse/cparse.hpp>
+#include <cnode/cnode-image.hpp>
+#include <cnode/cnode-pool.hpp>
 #include <cnode/cnode-algorithm.hpp>
 
 #include <vyos-errors.h>
@@ -61,14 +63,13 @@ diff_to_pfx(DiffState s)
 }
 
 static void
-_show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-           Cpath& cur_path, Cpath& last_ctx, bool show_def,
+_show_diff(OutputSink& out, const CfgNode *cfg1, const CfgNode *cfg2,
+           int level, Cpath& cur_path, Cpath& last_ctx, bool show_def,
            bool hide_secret, bool context_diff);
 
 static void
 _get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
-               Cpath& cur_path, vector<Cpath>& del_list,
-               vector<Cpath>& set_list, vector<Cpath>& com_list);
+               Cpath& cur_path, CmdVisitor& visitor);
 
 /* compare the values of a "multi" node in the two configs. the values and
  * the "diff" of each value are returned in "values" and "pfxs",
@@ -115,45 +116,82 @@ cnode::cmp_multi_values(const CfgNode *cfg1, const CfgNode *cfg2,
   return changed;
 }
 
-void
-cnode::cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
-                          vector<CfgNode *>& rcnodes1,
-                          vector<CfgNode *>& rcnodes2, bool& not_tag_node,
-                          bool& is_value, bool& is_leaf_typeless,
-                          string& name, string& value)
+// key for matching child nodes (tag value for tag node, name otherwise)
+static inline const string&
+_child_key(const CfgNode *cn, bool is_tag_node)
 {
-  const CfgNode *cfg = (cfg1 ? cfg1 : cfg2);
-  is_value = cfg->isValue();
-  not_tag_node = (!cfg->isTag() || is_value);
-  is_leaf_typeless = cfg->isLeafTypeless();
-  bool is_tag_node = !not_tag_node;
-  name = cfg->getName();
-  if (is_value) {
-    value = cfg->getValue();
-  }
+  return (is_tag_node ? cn->getValue() : cn->getName());
+}
 
-  // handle child nodes
-  vector<CfgNode *> cnodes1, cnodes2;
-  if (cfg1) {
-    cnodes1 = cfg1->getChildNodes();
-  }
-  if (cfg2) {
-    cnodes2 = cfg2->getChildNodes();
+/* match the child nodes by merging the two (sorted) lists. return false
+ * if the lists turn out not to be in strictly increasing order (e.g.,
+ * duplicates in a parsed config), in which case the output is not valid.
+ */
+static bool
+_merge_child_nodes(const CfgNode::nodes_vec_type *cnodes1,
+                   const CfgNode::nodes_vec_type *cnodes2, bool is_tag_node,
+                   vector<CfgNode *>& rcnodes1, vector<CfgNode *>& rcnodes2)
+{
+  size_t n1 = (cnodes1 ? cnodes1->size() : 0);
+  size_t n2 = (cnodes2 ? cnodes2->size() : 0);
+  rcnodes1.reserve(n1 + n2);
+  rcnodes2.reserve(n1 + n2);
+  const string *last = NULL;
+  size_t i = 0, j = 0;
+  while (i < n1 || j < n2) {
+    CfgNode *c1 = (i < n1 ? (*cnodes1)[i] : NULL);
+    CfgNode *c2 = (j < n2 ? (*cnodes2)[j] : NULL);
+    const string *key;
+    if (c1 && c2) {
+      const string& k1 = _child_key(c1, is_tag_node);
+      const string& k2 = _child_key(c2, is_tag_node);
+      int cmp = Cstore::cmpNodeNames(k1, k2);
+      if (cmp == 0 && k1 != k2) {
+        // different names in the same position. no total order.
+        return false;
+      }
+      if (cmp < 0) {
+        c2 = NULL;
+      } else if (cmp > 0) {
+        c1 = NULL;
+      }
+      key = (c1 ? &k1 : &k2);
+    } else {
+      key = &_child_key((c1 ? c1 : c2), is_tag_node);
+    }
+    if (last && Cstore::cmpNodeNames(*last, *key) >= 0) {
+      return false;
+    }
+    last = key;
+    rcnodes1.push_back(c1);
+    rcnodes2.push_back(c2);
+    if (c1) {
+      ++i;
+    }
+    if (c2) {
+      ++j;
+    }
   }
+  return true;
+}
 
+// match the child nodes by name when they are not in order
+static void
+_map_child_nodes(const CfgNode::nodes_vec_type *cnodes1,
+                 const CfgNode::nodes_vec_type *cnodes2, bool is_tag_node,
+                 vector<CfgNode *>& rcnodes1, vector<CfgNode *>& rcnodes2)
+{
   MapT<string, bool> map;
   MapT<string, CfgNode *> nmap1, nmap2;
-  for (size_t i = 0; i < cnodes1.size(); i++) {
-    string key = (is_tag_node
-                  ? cnodes1[i]->getValue() : cnodes1[i]->getName());
+  for (size_t i = 0; cnodes1 && i < cnodes1->size(); i++) {
+    string key = _child_key((*cnodes1)[i], is_tag_node);
     map[key] = true;
-    nmap1[key] = cnodes1[i];
+    nmap1[key] = (*cnodes1)[i];
   }
-  for (size_t i = 0; i < cnodes2.size(); i++) {
-    string key = (is_tag_node
-                  ? cnodes2[i]->getValue() : cnodes2[i]->getName());
+  for (size_t i = 0; cnodes2 && i < cnodes2->size(); i++) {
+    string key = _child_key((*cnodes2)[i], is_tag_node);
     map[key] = true;
-    nmap2[key] = cnodes2[i];
+    nmap2[key] = (*cnodes2)[i];
   }
 
   vector<string> cnodes;
@@ -175,9 +213,43 @@ cnode::cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
   }
 }
 
+/* child nodes are normally in the canonical order (config from cstore
+ * is sorted, and the parser sorts the config it reads), so they can be
+ * matched by a linear merge without allocating anything.
+ */
+void
+cnode::cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
+                          vector<CfgNode *>& rcnodes1,
+                          vector<CfgNode *>& rcnodes2, bool& not_tag_node,
+                          bool& is_value, bool& is_leaf_typeless,
+                          string& name, string& value)
+{
+  const CfgNode *cfg = (cfg1 ? cfg1 : cfg2);
+  is_value = cfg->isValue();
+  not_tag_node = (!cfg->isTag() || is_value);
+  is_leaf_typeless = cfg->isLeafTypeless();
+  bool is_tag_node = !not_tag_node;
+  name = cfg->getName();
+  if (is_value) {
+    value = cfg->getValue();
+  }
+
+  // handle child nodes
+  const CfgNode::nodes_vec_type *cnodes1
+    = (cfg1 ? &(cfg1->getChildNodes()) : NULL);
+  const CfgNode::nodes_vec_type *cnodes2
+    = (cfg2 ? &(cfg2->getChildNodes()) : NULL);
+  if (!_merge_child_nodes(cnodes1, cnodes2, is_tag_node, rcnodes1,
+                          rcnodes2)) {
+    rcnodes1.clear();
+    rcnodes2.clear();
+    _map_child_nodes(cnodes1, cnodes2, is_tag_node, rcnodes1, rcnodes2);
+  }
+}
+
 static void
-_add_path_to_list(vector<Cpath>& list, Cpath& path, const string *nptr,
-                  const string *vptr)
+_visit_cmd(CmdVisitor& visitor, CmdVisitor::Op op, Cpath& path,
+           const string *nptr, const string *vptr)
 {
   if (nptr) {
     path.push(*nptr);
@@ -185,7 +257,7 @@ _add_path_to_list(vector<Cpath>& list, Cpath& path, const string *nptr,
   if (vptr) {
     path.push(*vptr);
   }
-  list.push_back(path);
+  visitor.visit(op, path);
   if (vptr) {
     path.pop();
   }
@@ -194,26 +266,35 @@ _add_path_to_list(vector<Cpath>& list, Cpath& path, const string *nptr,
   }
 }
 
+// whether the values of the node with the specified name are secret
+static bool
+_is_secret_name(const string& name)
+{
+  static const char *sname[] = { "passphrase", "password",
+                                 "pre-shared-secret", "key", NULL };
+  static size_t slen[] = { 10, 8, 17, 3, 0 };
+  size_t nlen = name.length();
+  for (size_t i = 0; sname[i]; i++) {
+    if (nlen < slen[i]) {
+      // can't match
+      continue;
+    }
+    if (name.find(sname[i], nlen - slen[i]) != name.npos) {
+      // found secret
+      return true;
+    }
+  }
+  return false;
+}
+
 static void
-_print_value_str(const string& name, const char *vstr, bool hide_secret)
+_print_value_str(OutputSink& out, const string& name, const char *vstr,
+                 bool hide_secret)
 {
   // handle secret hiding first
-  if (hide_secret) {
-    static const char *sname[] = { "passphrase", "password",
-                                   "pre-shared-secret", "key", NULL };
-    static size_t slen[] = { 10, 8, 17, 3, 0 };
-    size_t nlen = name.length();
-    for (size_t i = 0; sname[i]; i++) {
-      if (nlen < slen[i]) {
-        // can't match
-        continue;
-      }
-      if (name.find(sname[i], nlen - slen[i]) != name.npos) {
-        // found secret
-        printf("****************");
-        return;
-      }
-    }
+  if (hide_secret && _is_secret_name(name)) {
+    out.write("****************");
+    return;
   }
 
   const char *quote = "";
@@ -221,20 +302,22 @@ _print_value_str(const string& name, const char *vstr, bool hide_secret)
   if (*vstr == 0 || strcspn(vstr, "*}{;\011\012\013\014\015 ") < vlen) {
     quote = "\"";
   }
-  printf("%s%s%s", quote, vstr, quote);
+  out.write(quote);
+  out.write(vstr, vlen);
+  out.write(quote);
 }
 
 static void
-_diff_print_indent(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-                   const char *pfx_diff)
+_diff_print_indent(OutputSink& out, const CfgNode *cfg1,
+                   const CfgNode *cfg2, int level, const char *pfx_diff)
 {
   /* note: activate/deactivate state output was handled here. pending
    *       redesign, the output notation will be changed to "per-subtree"
    *       marking, so the output will be handled with the rest of the node.
    */
-  printf("%s", pfx_diff);
+  out.write(pfx_diff);
   for (int i = 0; i < level; i++) {
-    printf("    ");
+    out.write("    ", 4);
   }
 }
 
@@ -242,18 +325,19 @@ _diff_print_indent(const CfgNode *cfg1, const CfgNode *cfg2, int level,
  * like in JUNOS "show | compare".
  */
 static void
-_diff_print_context(Cpath& cur_path, Cpath& last_ctx)
+_diff_print_context(OutputSink& out, Cpath& cur_path, Cpath& last_ctx)
 {
   if (last_ctx == cur_path) {
     // don't repeat the context if it's still the same as the last one
     return;
   }
   last_ctx = cur_path;
-  printf("[edit");
+  out.write("[edit");
   for (size_t i = 0; i < cur_path.size(); i++) {
-    printf(" %s", cur_path[i]);
+    out.put(' ');
+    out.write(cur_path[i]);
   }
-  printf("]\n");
+  out.write("]\n");
 }
 
 /* print the comment (if any) at the specified node, including "change
@@ -269,8 +353,9 @@ _diff_print_context(Cpath& cur_path, Cpath& last_ctx)
  * (caller does different things according to return value).
  */
 static bool
-_diff_print_comment(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-                    Cpath& cur_path, Cpath& last_ctx, bool context_diff)
+_diff_print_comment(OutputSink& out, const CfgNode *cfg1,
+                    const CfgNode *cfg2, int level, Cpath& cur_path,
+                    Cpath& last_ctx, bool context_diff)
 {
   const char *pfx_diff = PFX_DIFF_NONE.c_str();
   string comment = "";
@@ -315,10 +400,12 @@ _diff_print_comment(const CfgNode *cfg1, const CfgNode *cfg2, int level,
                         && pfx_diff != PFX_DIFF_NULL.c_str())) {
     if (context_diff) {
       // print context first
-      _diff_print_context(cur_path, last_ctx);
+      _diff_print_context(out, cur_path, last_ctx);
     }
-    _diff_print_indent(cfg1, cfg2, level, pfx_diff);
-    printf("/* %s */\n", comment.c_str());
+    _diff_print_indent(out, cfg1, cfg2, level, pfx_diff);
+    out.write("/* ");
+    out.write(comment);
+    out.write(" */\n");
     return true;
   } else {
     return false;
@@ -326,9 +413,10 @@ _diff_print_comment(const CfgNode *cfg1, const CfgNode *cfg2, int level,
 }
 
 static bool
-_diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-                          Cpath& cur_path, Cpath& last_ctx, bool show_def,
-                          bool hide_secret, bool context_diff)
+_diff_check_and_show_leaf(OutputSink& out, const CfgNode *cfg1,
+                          const CfgNode *cfg2, int level, Cpath& cur_path,
+                          Cpath& last_ctx, bool show_def, bool hide_secret,
+                          bool context_diff)
 {
   if ((cfg1 && !cfg1->isLeaf()) || (cfg2 && !cfg2->isLeaf())) {
     // not a leaf node
@@ -350,7 +438,7 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
     }
   }
 
-  bool cprint = _diff_print_comment(cfg1, cfg2, level, cur_path, last_ctx,
+  bool cprint = _diff_print_comment(out, cfg1, cfg2, level, cur_path, last_ctx,
                                     context_diff);
   if (cprint) {
     /* when doing context diff, normally we only show the node if there is a
@@ -368,16 +456,17 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
         /* if nothing was printed for comment and we're doing context diff,
          * then context hasn't been displayed yet. so print it first.
          */
-        _diff_print_context(cur_path, last_ctx);
+        _diff_print_context(out, cur_path, last_ctx);
       }
       if (!context_diff || force_pfx_diff != PFX_DIFF_NULL.c_str()) {
         // not context diff OR there is a difference => print the node
         const vector<string>& vvec = cfg->getValues();
         for (size_t i = 0; i < vvec.size(); i++) {
-          _diff_print_indent(cfg1, cfg2, level, force_pfx_diff);
-          printf("%s ", cfg->getName().c_str());
-          _print_value_str(cfg->getName(), vvec[i].c_str(), hide_secret);
-          printf("\n");
+          _diff_print_indent(out, cfg1, cfg2, level, force_pfx_diff);
+          out.write(cfg->getName());
+          out.put(' ');
+          _print_value_str(out, cfg->getName(), vvec[i].c_str(), hide_secret);
+          out.put('\n');
         }
       }
     } else {
@@ -399,13 +488,14 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
              * set cprint to true so that later iterations won't print it
              * again.
              */
-            _diff_print_context(cur_path, last_ctx);
+            _diff_print_context(out, cur_path, last_ctx);
             cprint = true;
           }
-          _diff_print_indent(cfg1, cfg2, level, diff_to_pfx(pfxs[i]));
-          printf("%s ", cfg->getName().c_str());
-          _print_value_str(cfg->getName(), values[i].c_str(), hide_secret);
-          printf("\n");
+          _diff_print_indent(out, cfg1, cfg2, level, diff_to_pfx(pfxs[i]));
+          out.write(cfg->getName());
+          out.put(' ');
+          _print_value_str(out, cfg->getName(), values[i].c_str(), hide_secret);
+          out.put('\n');
         }
       }
     }
@@ -430,12 +520,13 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
           /* if nothing was printed for comment and we're doing context diff,
            * then context hasn't been displayed yet. so print it first.
            */
-          _diff_print_context(cur_path, last_ctx);
+          _diff_print_context(out, cur_path, last_ctx);
         }
-        _diff_print_indent(cfg1, cfg2, level, force_pfx_diff);
-        printf("%s ", cfg->getName().c_str());
-        _print_value_str(cfg->getName(), val.c_str(), hide_secret);
-        printf("\n");
+        _diff_print_indent(out, cfg1, cfg2, level, force_pfx_diff);
+        out.write(cfg->getName());
+        out.put(' ');
+        _print_value_str(out, cfg->getName(), val.c_str(), hide_secret);
+        out.put('\n');
       }
     }
   }
@@ -444,8 +535,8 @@ _diff_check_and_show_leaf(const CfgNode *cfg1, const CfgNode *cfg2, int level,
 }
 
 static void 
-_diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-                 Cpath& cur_path, Cpath& last_ctx, bool show_def,
+_diff_show_other(OutputSink& out, const CfgNode *cfg1, const CfgNode *cfg2,
+                 int level, Cpath& cur_path, Cpath& last_ctx, bool show_def,
                  bool hide_secret, bool context_diff)
 {
   bool orig_cdiff = context_diff;
@@ -474,8 +565,8 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
   bool print_this = (not_tag_node && level >= 0 && name.size() > 0);
   int next_level = level + 1;
   if (print_this) {
-    bool cprint = _diff_print_comment(cfg1, cfg2, level, cur_path, last_ctx,
-                                      orig_cdiff);
+    bool cprint = _diff_print_comment(out, cfg1, cfg2, level, cur_path,
+                                      last_ctx, orig_cdiff);
     if (orig_cdiff && pfx_diff != PFX_DIFF_NONE.c_str()) {
       /* note:
        *   orig_cdiff is the original value of context_diff.
@@ -510,9 +601,9 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
         /* if nothing was printed for comment and we're doing context diff,
          * then context hasn't been displayed yet. so print it first.
          */
-        _diff_print_context(cur_path, last_ctx);
+        _diff_print_context(out, cur_path, last_ctx);
       }
-      _diff_print_indent(cfg1, cfg2, level, pfx_diff);
+      _diff_print_indent(out, cfg1, cfg2, level, pfx_diff);
       if (is_value) {
         // at tag value
         const char *quote = "";
@@ -520,10 +611,14 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
         if (strcspn(value.c_str(), "*}{;\011\012\013\014\015 ") < vlen) {
           quote = "\"";
         }
-        printf("%s %s%s%s", name.c_str(), quote, value.c_str(), quote);
+        out.write(name);
+        out.put(' ');
+        out.write(quote);
+        out.write(value);
+        out.write(quote);
       } else {
         // at intermediate node
-        printf("%s", name.c_str());
+        out.write(name);
       }
       if (cprint && orig_cdiff && pfx_diff == PFX_DIFF_NONE.c_str()) {
         /* the condition means:
@@ -541,10 +636,10 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
          * in this case also set is_leaf_typeless to true to prevent a
          * dangling "}\n" from being printed at the end of this function.
          */
-        printf(" { ... }\n");
+        out.write(" { ... }\n");
         is_leaf_typeless = true;
       } else {
-        printf("%s\n", (is_leaf_typeless ? "" : " {"));
+        out.write(is_leaf_typeless ? "\n" : " {\n");
       }
     }
 
@@ -557,7 +652,7 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
   }
 
   for (size_t i = 0; i < rcnodes1.size(); i++) {
-    _show_diff(rcnodes1[i], rcnodes2[i], next_level, cur_path, last_ctx,
+    _show_diff(out, rcnodes1[i], rcnodes2[i], next_level, cur_path, last_ctx,
                show_def, hide_secret, context_diff);
   }
 
@@ -573,16 +668,16 @@ _diff_show_other(const CfgNode *cfg1, const CfgNode *cfg2, int level,
        * is set to true to prevent this.
        */
       if (!is_leaf_typeless) {
-        _diff_print_indent(cfg1, cfg2, level, pfx_diff);
-        printf("}\n");
+        _diff_print_indent(out, cfg1, cfg2, level, pfx_diff);
+        out.write("}\n");
       }
     }
   }
 }
 
 static void
-_show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
-           Cpath& cur_path, Cpath& last_ctx, bool show_def,
+_show_diff(OutputSink& out, const CfgNode *cfg1, const CfgNode *cfg2,
+           int level, Cpath& cur_path, Cpath& last_ctx, bool show_def,
            bool hide_secret, bool context_diff)
 {
   // if doesn't exist, treat as NULL
@@ -619,27 +714,31 @@ _show_diff(const CfgNode *cfg1, const CfgNode *cfg2, int level,
        */
       return;
     }
+    if (cfg1 && cfg2 && cfg1->sameSubtree(*cfg2)) {
+      // identical subtrees => nothing to show
+      return;
+    }
     /* when doing context diff, the display indentation level always starts
      * at 0.
      */
     level = 0;
   }
 
-  if (_diff_check_and_show_leaf(cfg1, cfg2, (level >= 0 ? level : 0),
+  if (_diff_check_and_show_leaf(out, cfg1, cfg2, (level >= 0 ? level : 0),
                                 cur_path, last_ctx, show_def, hide_secret,
                                 context_diff)) {
     // leaf node has been shown. done.
     return;
   } else {
     // intermediate node, tag node, or tag value
-    _diff_show_other(cfg1, cfg2, level, cur_path, last_ctx, show_def,
+    _diff_show_other(out, cfg1, cfg2, level, cur_path, last_ctx, show_def,
                      hide_secret, context_diff);
   }
 }
 
 static void
 _get_comment_diff_cmd(const CfgNode *cfg1, const CfgNode *cfg2,
-                      Cpath& cur_path, vector<Cpath>& com_list,
+                      Cpath& cur_path, CmdVisitor& visitor,
                       const string *val)
 {
   const string *comment = NULL;
@@ -681,7 +780,7 @@ _get_comment_diff_cmd(const CfgNode *cfg1, const CfgNode *cfg2,
       cur_path.push(*name);
       name = val;
     }
-    _add_path_to_list(com_list, cur_path, name, comment);
+    _visit_cmd(visitor, CmdVisitor::OP_COMMENT, cur_path, name, comment);
     if (val) {
       cur_path.pop();
     }
@@ -690,8 +789,7 @@ _get_comment_diff_cmd(const CfgNode *cfg1, const CfgNode *cfg2,
 
 static bool
 _get_cmds_diff_leaf(const CfgNode *cfg1, const CfgNode *cfg2,
-                    Cpath& cur_path, vector<Cpath>& del_list,
-                    vector<Cpath>& set_list, vector<Cpath>& com_list)
+                    Cpath& cur_path, CmdVisitor& visitor)
 {
   if ((cfg1 && !cfg1->isLeaf()) || (cfg2 && !cfg2->isLeaf())) {
     // not a leaf node
@@ -699,30 +797,32 @@ _get_cmds_diff_leaf(const CfgNode *cfg1, const CfgNode *cfg2,
   }
 
   const CfgNode *cfg = NULL;
-  vector<Cpath> *list = NULL;
+  bool set = false;
   if (cfg1) {
     cfg = cfg1;
     if (!cfg2) {
       // exists in cfg1 but not in cfg2 => delete and stop recursion
-      _add_path_to_list(del_list, cur_path, &(cfg1->getName()), NULL);
+      _visit_cmd(visitor, CmdVisitor::OP_DELETE, cur_path,
+                 &(cfg1->getName()), NULL);
       return true;
     } else if (cfg1 == cfg2) {
       // same config => just translating config to set commands
-      list = &set_list;
+      set = true;
     }
   } else {
     // !cfg1 => cfg2 must not be NULL
     cfg = cfg2;
-    list = &set_list;
+    set = true;
   }
 
-  _get_comment_diff_cmd(cfg1, cfg2, cur_path, com_list, NULL);
+  _get_comment_diff_cmd(cfg1, cfg2, cur_path, visitor, NULL);
   if (cfg->isMulti()) {
     // multi-value node
-    if (list) {
+    if (set) {
       const vector<string>& vvec = cfg->getValues();
       for (size_t i = 0; i < vvec.size(); i++) {
-        _add_path_to_list(*list, cur_path, &(cfg->getName()), &(vvec[i]));
+        _visit_cmd(visitor, CmdVisitor::OP_SET, cur_path, &(cfg->getName()),
+                   &(vvec[i]));
       }
     } else {
       // need to actually do a diff.
@@ -733,25 +833,28 @@ _get_cmds_diff_leaf(const CfgNode *cfg1, const CfgNode *cfg2,
          * values, need to delete the node and then set the new values.
          */
         const vector<string>& nvec = cfg2->getValues();
-        _add_path_to_list(del_list, cur_path, &(cfg->getName()), NULL);
+        _visit_cmd(visitor, CmdVisitor::OP_DELETE, cur_path,
+                   &(cfg->getName()), NULL);
         for (size_t i = 0; i < nvec.size(); i++) {
-          _add_path_to_list(set_list, cur_path, &(cfg->getName()), &(nvec[i]));
+          _visit_cmd(visitor, CmdVisitor::OP_SET, cur_path, &(cfg->getName()),
+                     &(nvec[i]));
         }
       }
     }
   } else {
     // single-value node
     string val = cfg->getValue();
-    if (!list) {
+    if (!set) {
       const string& val1 = cfg1->getValue();
       val = cfg2->getValue();
       if (val != val1) {
         // changed => need to set it
-        list = &set_list;
+        set = true;
       }
     }
-    if (list) {
-      _add_path_to_list(*list, cur_path, &(cfg->getName()), &val);
+    if (set) {
+      _visit_cmd(visitor, CmdVisitor::OP_SET, cur_path, &(cfg->getName()),
+                 &val);
     }
   }
 
@@ -760,23 +863,22 @@ _get_cmds_diff_leaf(const CfgNode *cfg1, const CfgNode *cfg2,
 
 static void
 _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
-                     Cpath& cur_path, vector<Cpath>& del_list,
-                     vector<Cpath>& set_list, vector<Cpath>& com_list)
+                     Cpath& cur_path, CmdVisitor& visitor)
 {
-  vector<Cpath> *list = NULL;
+  bool set = false;
   if (cfg1) {
     if (!cfg2) {
       // exists in cfg1 but not in cfg2 => delete and stop recursion
-      _add_path_to_list(del_list, cur_path, &(cfg1->getName()),
-                        (cfg1->isValue() ? &(cfg1->getValue()) : NULL));
+      _visit_cmd(visitor, CmdVisitor::OP_DELETE, cur_path, &(cfg1->getName()),
+                 (cfg1->isValue() ? &(cfg1->getValue()) : NULL));
       return;
     } else if (cfg1 == cfg2) {
       // same config => just translating config to set commands
-      list = &set_list;
+      set = true;
     }
   } else {
     // !cfg1 => cfg2 must not be NULL
-    list = &set_list;
+    set = true;
   }
 
   string name, value;
@@ -784,16 +886,17 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
   vector<CfgNode *> rcnodes1, rcnodes2;
   cmp_non_leaf_nodes(cfg1, cfg2, rcnodes1, rcnodes2, not_tag_node, is_value,
                       is_leaf_typeless, name, value);
-  if (rcnodes1.size() < 1 && list) {
+  if (rcnodes1.size() < 1 && set) {
     // subtree is empty
-    _add_path_to_list(*list, cur_path, &name, (is_value ? &value : NULL));
+    _visit_cmd(visitor, CmdVisitor::OP_SET, cur_path, &name,
+               (is_value ? &value : NULL));
     return;
   }
 
   bool add_this = (not_tag_node && name.size() > 0);
   if (add_this) {
     const string *val = (is_value ? &value : NULL);
-    _get_comment_diff_cmd(cfg1, cfg2, cur_path, com_list, val);
+    _get_comment_diff_cmd(cfg1, cfg2, cur_path, visitor, val);
 
     cur_path.push(name);
     if (is_value) {
@@ -801,8 +904,7 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
     }
   }
   for (size_t i = 0; i < rcnodes1.size(); i++) {
-    _get_cmds_diff(rcnodes1[i], rcnodes2[i], cur_path, del_list, set_list,
-                   com_list);
+    _get_cmds_diff(rcnodes1[i], rcnodes2[i], cur_path, visitor);
   }
   if (add_this) {
     if (is_value) {
@@ -814,8 +916,7 @@ _get_cmds_diff_other(const CfgNode *cfg1, const CfgNode *cfg2,
 
 static void
 _get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
-               Cpath& cur_path, vector<Cpath>& del_list,
-               vector<Cpath>& set_list, vector<Cpath>& com_list)
+               Cpath& cur_path, CmdVisitor& visitor)
 {
   // if doesn't exist, treat as NULL
   if (cfg1 && !cfg1->exists()) {
@@ -829,71 +930,353 @@ _get_cmds_diff(const CfgNode *cfg1, const CfgNode *cfg2,
     fprintf(stderr, "_get_cmds_diff error (both config NULL)\n");
     exit(1);
   }
+  if (cfg1 && cfg2 && cfg1 != cfg2 && cfg1->sameSubtree(*cfg2)) {
+    // identical subtrees => no commands
+    return;
+  }
 
-  if (_get_cmds_diff_leaf(cfg1, cfg2, cur_path, del_list, set_list,
-                          com_list)) {
+  if (_get_cmds_diff_leaf(cfg1, cfg2, cur_path, visitor)) {
     // leaf node has been shown. done.
     return;
   } else {
     // intermediate node, tag node, or tag value
-    _get_cmds_diff_other(cfg1, cfg2, cur_path, del_list, set_list, com_list);
+    _get_cmds_diff_other(cfg1, cfg2, cur_path, visitor);
+  }
+}
+
+static void
+_print_cmd(OutputSink& out, const char *op, const Cpath& path)
+{
+  out.write(op);
+  for (size_t i = 0; i < path.size(); i++) {
+    out.write(" '");
+    out.write(path[i]);
+    out.put('\'');
+  }
+  out.put('\n');
+}
+
+/* prints the delete or the set commands as they are generated. the
+ * comment commands are collected when printing the set commands so that
+ * they can be printed last (see printComments()).
+ */
+class CmdPrinter : public CmdVisitor {
+public:
+  CmdPrinter(OutputSink& out, Op op) : _out(out), _op(op) {}
+
+  void visit(Op op, const Cpath& path) {
+    if (op == _op) {
+      _print_cmd(_out, (op == OP_DELETE ? "delete" : "set"), path);
+    } else if (op == OP_COMMENT && _op == OP_SET) {
+      _comments.push_back(path);
+    }
+  }
+  void printComments() {
+    for (size_t i = 0; i < _comments.size(); i++) {
+      _print_cmd(_out, "comment", _comments[i]);
+    }
+  }
+
+private:
+  OutputSink& _out;
+  Op _op;
+  vector<Cpath> _comments;
+};
+
+// collects the commands into lists (see get_cmds_diff())
+class CmdCollector : public CmdVisitor {
+public:
+  CmdCollector(vector<Cpath>& del_list, vector<Cpath>& set_list,
+               vector<Cpath>& com_list)
+    : _del_list(del_list), _set_list(set_list), _com_list(com_list) {}
+
+  void visit(Op op, const Cpath& path) {
+    switch (op) {
+    case OP_DELETE:
+      _del_list.push_back(path);
+      break;
+    case OP_SET:
+      _set_list.push_back(path);
+      break;
+    case OP_COMMENT:
+      _com_list.push_back(path);
+      break;
+    }
+  }
+
+private:
+  vector<Cpath>& _del_list;
+  vector<Cpath>& _set_list;
+  vector<Cpath>& _com_list;
+};
+
+// JSON string (including quotes)
+static void
+_json_print_str(OutputSink& out, const string& s)
+{
+  out.put('"');
+  size_t start = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out.write(s.data() + start, i - start);
+    start = i + 1;
+    if (c == '"' || c == '\\') {
+      out.put('\\');
+      out.put(c);
+    } else if (c == '\n') {
+      out.write("\\n", 2);
+    } else if (c == '\t') {
+      out.write("\\t", 2);
+    } else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out.write(buf, 6);
+    }
+  }
+  out.write(s.data() + start, s.size() - start);
+  out.put('"');
+}
+
+static void
+_json_print_key(OutputSink& out, const string& key, bool& first)
+{
+  if (!first) {
+    out.put(',');
+  }
+  first = false;
+  _json_print_str(out, key);
+  out.put(':');
+}
+
+static void
+_json_print_value(OutputSink& out, const CfgNode& cfg, const string& val,
+                  bool hide_secret)
+{
+  static const string secret = "****************";
+  _json_print_str(out, ((hide_secret && _is_secret_name(cfg.getName()))
+                        ? secret : val));
+}
+
+static void
+_json_print_leaf_value(OutputSink& out, const CfgNode& cfg,
+                       bool hide_secret)
+{
+  if (!cfg.isMulti()) {
+    _json_print_value(out, cfg, cfg.getValue(), hide_secret);
+    return;
+  }
+  const vector<string>& values = cfg.getValues();
+  out.put('[');
+  for (size_t i = 0; i < values.size(); i++) {
+    if (i > 0) {
+      out.put(',');
+    }
+    _json_print_value(out, cfg, values[i], hide_secret);
   }
+  out.put(']');
 }
 
+/* JSON value of a node: string for single-value node, array for
+ * multi-value node, and object keyed by child node name (or tag value)
+ * otherwise. comment and deactivated state are added as "#comment" and
+ * "#deactivated" members, in which case the value of a leaf node becomes
+ * the "#value" member of an object.
+ */
 static void
-_print_cmds_list(const char *op, vector<Cpath>& list)
+_json_print_node(OutputSink& out, const CfgNode& cfg, bool show_def,
+                 bool hide_secret)
 {
-  for (size_t i = 0; i < list.size(); i++) {
-    printf("%s", op);
-    for (size_t j = 0; j < list[i].size(); j++) {
-      printf(" '%s'", list[i][j]);
+  const string& comment = cfg.getComment();
+  bool meta = (comment.size() > 0 || cfg.isDeactivated());
+  if (cfg.isLeaf() && !meta) {
+    _json_print_leaf_value(out, cfg, hide_secret);
+    return;
+  }
+
+  static const string cstr = "#comment";
+  static const string dstr = "#deactivated";
+  static const string vstr = "#value";
+  bool first = true;
+  out.put('{');
+  if (comment.size() > 0) {
+    _json_print_key(out, cstr, first);
+    _json_print_str(out, comment);
+  }
+  if (cfg.isDeactivated()) {
+    _json_print_key(out, dstr, first);
+    out.write("true", 4);
+  }
+  if (cfg.isLeaf()) {
+    _json_print_key(out, vstr, first);
+    _json_print_leaf_value(out, cfg, hide_secret);
+  } else {
+    const CfgNode::nodes_vec_type& cnodes = cfg.getChildNodes();
+    for (CfgNode::nodes_vec_type::const_iterator it = cnodes.begin();
+         it != cnodes.end(); ++it) {
+      const CfgNode *cn = *it;
+      if (!cn->exists()) {
+        continue;
+      }
+      if (!show_def && cn->isLeaf() && !cn->isMulti() && cn->isDefault()) {
+        // same as show
+        continue;
+      }
+      _json_print_key(out, (cn->isValue() ? cn->getValue() : cn->getName()),
+                      first);
+      _json_print_node(out, *cn, show_def, hide_secret);
     }
-    printf("\n");
   }
+  out.put('}');
+}
+
+/* load two config files concurrently (e.g., for compare). this needs a
+ * read view of the cstore for each (for the template lookups). otherwise
+ * they are loaded one after the other.
+ */
+static void
+_load_configs(const string& file1, const string& file2, Cstore& cstore,
+              tr1::shared_ptr<CfgNode>& root1,
+              tr1::shared_ptr<CfgNode>& root2)
+{
+  Cstore *views[2] = { cstore.createReadView(), cstore.createReadView() };
+  if (!views[0] || !views[1]) {
+    delete views[0];
+    delete views[1];
+    root1.reset(CfgImage::loadConfig(file1, cstore));
+    root2.reset(CfgImage::loadConfig(file2, cstore));
+    return;
+  }
+
+  // arenas are not thread-safe. the current arena takes them over.
+  CfgNodeArena *arena = CfgNodeArena::current();
+  CfgNodeArena *arenas[2] = { NULL, NULL };
+  const string *files[2] = { &file1, &file2 };
+  CfgNode *roots[2] = { NULL, NULL };
+  WorkPool pool(2);
+  for (size_t i = 0; i < 2; i++) {
+    if (arena) {
+      arenas[i] = new CfgNodeArena(arena->isMonotonic());
+    }
+    pool.submit([&, i](size_t worker) {
+      if (arenas[i]) {
+        CfgNodeArena::Scope scope(*arenas[i]);
+        roots[i] = CfgImage::loadConfig(*files[i], *views[i]);
+      } else {
+        roots[i] = CfgImage::loadConfig(*files[i], *views[i]);
+      }
+    });
+  }
+  pool.run();
+
+  for (size_t i = 0; i < 2; i++) {
+    delete views[i];
+    if (arenas[i]) {
+      arena->adopt(arenas[i]);
+    }
+  }
+  root1.reset(roots[0]);
+  root2.reset(roots[1]);
 }
 
 ////// algorithms
 int
-cnode::show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
-                     Cpath& cur_path, bool show_def, bool hide_secret,
-                     bool context_diff)
+cnode::show_cfg_diff(OutputSink& out, const CfgNode& cfg1,
+                     const CfgNode& cfg2, Cpath& cur_path, bool show_def,
+                     bool hide_secret, bool context_diff)
 {
   if (cfg1.isInvalid() || cfg2.isInvalid()) {
-    printf("Specified configuration path is not valid\n");
+    out.write("Specified configuration path is not valid\n");
     return VYOS_INVALID_PATH;
   }
   if ((cfg1.isEmpty() && cfg2.isEmpty())
       || (!cfg1.exists() && !cfg2.exists())) {
-    printf("Configuration under specified path is empty\n");
+    out.write("Configuration under specified path is empty\n");
     return VYOS_EMPTY_CONFIG;
   }
   // use an invalid value for initial last_ctx
   Cpath last_ctx;
-  _show_diff(&cfg1, &cfg2, -1, cur_path, last_ctx, show_def, hide_secret,
+  _show_diff(out, &cfg1, &cfg2, -1, cur_path, last_ctx, show_def, hide_secret,
              context_diff);
   return VYOS_SUCCESS;
 }
 
 int
-cnode::show_cfg(const CfgNode& cfg, bool show_def, bool hide_secret)
+cnode::show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
+                     Cpath& cur_path, bool show_def, bool hide_secret,
+                     bool context_diff)
+{
+  OutputSink out(STDOUT_FILENO);
+  return show_cfg_diff(out, cfg1, cfg2, cur_path, show_def, hide_secret,
+                       context_diff);
+}
+
+int
+cnode::show_cfg(OutputSink& out, const CfgNode& cfg, bool show_def,
+                bool hide_secret)
 {
   Cpath cur_path;
-  int res = show_cfg_diff(cfg, cfg, cur_path, show_def, hide_secret);
+  int res = show_cfg_diff(out, cfg, cfg, cur_path, show_def, hide_secret);
   return res;
 }
 
+int
+cnode::show_cfg(const CfgNode& cfg, bool show_def, bool hide_secret)
+{
+  OutputSink out(STDOUT_FILENO);
+  return show_cfg(out, cfg, show_def, hide_secret);
+}
+
+int
+cnode::show_cfg_json(OutputSink& out, const CfgNode& cfg, bool show_def,
+                     bool hide_secret)
+{
+  if (cfg.isInvalid()) {
+    // same as show_cfg_diff()
+    out.write("Specified configuration path is not valid\n");
+    return VYOS_INVALID_PATH;
+  }
+  if (!cfg.exists() || cfg.isEmpty()) {
+    // still valid JSON
+    out.write("{}\n");
+    return VYOS_EMPTY_CONFIG;
+  }
+  _json_print_node(out, cfg, show_def, hide_secret);
+  out.put('\n');
+  return VYOS_SUCCESS;
+}
+
+int
+cnode::show_cfg_json(const CfgNode& cfg, bool show_def, bool hide_secret)
+{
+  OutputSink out(STDOUT_FILENO);
+  return show_cfg_json(out, cfg, show_def, hide_secret);
+}
+
 void
-cnode::show_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2)
+cnode::show_cmds_diff(OutputSink& out, const CfgNode& cfg1,
+                      const CfgNode& cfg2)
 {
-  Cpath cur_path;
-  vector<Cpath> del_list;
-  vector<Cpath> set_list;
-  vector<Cpath> com_list;
-  _get_cmds_diff(&cfg1, &cfg2, cur_path, del_list, set_list, com_list);
+  /* all delete commands come first, so the set commands are printed in a
+   * second pass (instead of collecting them). there are no delete commands
+   * for a single config.
+   */
+  if (&cfg1 != &cfg2) {
+    CmdPrinter dprinter(out, CmdVisitor::OP_DELETE);
+    visit_cmds_diff(cfg1, cfg2, dprinter);
+  }
+  CmdPrinter sprinter(out, CmdVisitor::OP_SET);
+  visit_cmds_diff(cfg1, cfg2, sprinter);
+  sprinter.printComments();
+}
 
-  _print_cmds_list("delete", del_list);
-  _print_cmds_list("set", set_list);
-  _print_cmds_list("comment", com_list);
+void
+cnode::show_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2)
+{
+  OutputSink out(STDOUT_FILENO);
+  show_cmds_diff(out, cfg1, cfg2);
 }
 
 void
@@ -902,22 +1285,36 @@ cnode::show_cmds(const CfgNode& cfg)
   show_cmds_diff(cfg, cfg);
 }
 
+void
+cnode::visit_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
+                       CmdVisitor& visitor)
+{
+  Cpath cur_path;
+  _get_cmds_diff(&cfg1, &cfg2, cur_path, visitor);
+}
+
+void
+cnode::visit_cmds(const CfgNode& cfg, CmdVisitor& visitor)
+{
+  visit_cmds_diff(cfg, cfg, visitor);
+}
+
 void
 cnode::get_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                      vector<Cpath>& del_list, vector<Cpath>& set_list,
                      vector<Cpath>& com_list)
 {
-  Cpath cur_path;
-  _get_cmds_diff(&cfg1, &cfg2, cur_path, del_list, set_list, com_list);
+  CmdCollector collector(del_list, set_list, com_list);
+  visit_cmds_diff(cfg1, cfg2, collector);
 }
 
 void
 cnode::get_cmds(const CfgNode& cfg, vector<Cpath>& set_list,
                 vector<Cpath>& com_list)
 {
-  Cpath cur_path;
   vector<Cpath> del_list;
-  _get_cmds_diff(&cfg, &cfg, cur_path, del_list, set_list, com_list);
+  CmdCollector collector(del_list, set_list, com_list);
+  visit_cmds(cfg, collector);
 }
 
 int
@@ -925,6 +1322,9 @@ cnode::showConfig(const string& cfg1, const string& cfg2,
                   const Cpath& path, bool show_def, bool hide_secret,
                   bool context_diff, bool show_cmds, bool ignore_edit)
 {
+  // all trees are released together (must outlive them)
+  CfgNodeArena arena;
+  CfgNodeArena::Scope ascope(arena);
   tr1::shared_ptr<CfgNode> aroot, wroot, croot1, croot2;
   tr1::shared_ptr<Cstore> cstore;
   Cpath rpath(path);
@@ -940,27 +1340,38 @@ cnode::showConfig(const string& cfg1, const string& cfg2,
     cstore.reset(Cstore::createCstore(false));
     rpath.clear();
   }
+  /* a context diff of a config with itself shows nothing (see
+   * _show_diff()), so only read the root node in that case.
+   */
+  bool lazy = (context_diff && !show_cmds && cfg1 == cfg2);
   if (cfg1 == ACTIVE_CFG || cfg2 == ACTIVE_CFG) {
-    aroot.reset(new CfgNode(*cstore, rpath, true, true));
+    aroot.reset(lazy ? CfgNode::createLazy(*cstore, rpath, true)
+                : new CfgNode(*cstore, rpath, true, true));
   }
   if (cfg1 == WORKING_CFG || cfg2 == WORKING_CFG) {
     // note: if there is no config session, this will abort
-    wroot.reset(new CfgNode(*cstore, rpath, false, true));
+    wroot.reset(lazy ? CfgNode::createLazy(*cstore, rpath, false)
+                : new CfgNode(*cstore, rpath, false, true));
   }
 
-  if (cfg1 == ACTIVE_CFG) {
-    croot1 = aroot;
-  } else if (cfg1 == WORKING_CFG) {
-    croot1 = wroot;
+  if (!aroot.get() && !wroot.get()) {
+    // two config files
+    _load_configs(cfg1, cfg2, *cstore, croot1, croot2);
   } else {
-    croot1.reset(cparse::parse_file(cfg1.c_str(), *cstore));
-  }
-  if (cfg2 == ACTIVE_CFG) {
-    croot2 = aroot;
-  } else if (cfg2 == WORKING_CFG) {
-    croot2 = wroot;
-  } else {
-    croot2.reset(cparse::parse_file(cfg2.c_str(), *cstore));
+    if (cfg1 == ACTIVE_CFG) {
+      croot1 = aroot;
+    } else if (cfg1 == WORKING_CFG) {
+      croot1 = wroot;
+    } else {
+      croot1.reset(CfgImage::loadConfig(cfg1, *cstore));
+    }
+    if (cfg2 == ACTIVE_CFG) {
+      croot2 = aroot;
+    } else if (cfg2 == WORKING_CFG) {
+      croot2 = wroot;
+    } else {
+      croot2.reset(CfgImage::loadConfig(cfg2, *cstore));
+    }
   }
   if (!croot1.get() || !croot2.get()) {
     printf("Cannot parse specified config file(s)\n");
@@ -1004,12 +1415,9 @@ cnode::findCfgNode(CfgNode *root, const Cpath& path, bool& is_value)
       // look for value
       if (node->isMulti()) {
         // multi-value
-        const vector<string>& vals = node->getValues();
-        for (size_t j = 0; j < vals.size(); j++) {
-          if (vals[j] == path[i]) {
-            is_value = true;
-            return node;
-          }
+        if (node->hasValue(path[i])) {
+          is_value = true;
+          return node;
         }
         return NULL;
       } else {
@@ -1022,22 +1430,9 @@ cnode::findCfgNode(CfgNode *root, const Cpath& path, bool& is_value)
       }
     }
 
-    const vector<CfgNode *>& cnodes = node->getChildNodes();
-    bool found = false;
-    for (size_t j = 0; j < cnodes.size(); j++) {
-      if (cnodes[j]->isValue()) {
-        // tag value
-        found = (cnodes[j]->getValue() == path[i]);
-      } else {
-        // others
-        found = (cnodes[j]->getName() == path[i]);
-      }
-      if (found) {
-        node = cnodes[j];
-        break;
-      }
-    }
-    if (!found) {
+    // tag value or other child node
+    node = node->findChildNode(path[i]);
+    if (!node) {
       return NULL;
     }
   }
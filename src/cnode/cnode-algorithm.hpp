@@ -22,6 +22,7 @@
 
 #include <cstore/cpath.hpp>
 #include <cnode/cnode.hpp>
+#include <cnode/cnode-output.hpp>
 
 namespace cnode {
 
@@ -43,15 +44,61 @@ void cmp_non_leaf_nodes(const CfgNode *cfg1, const CfgNode *cfg2,
                         bool& is_leaf_typeless, std::string& name,
                         std::string& value);
 
+/* the show functions write to stdout unless an output sink is specified
+ * (see cnode-output.hpp).
+ */
 int show_cfg_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                    cstore::Cpath& cur_path, bool show_def = false,
                    bool hide_secret = false, bool context_diff = false);
+int show_cfg_diff(OutputSink& out, const CfgNode& cfg1, const CfgNode& cfg2,
+                  cstore::Cpath& cur_path, bool show_def = false,
+                  bool hide_secret = false, bool context_diff = false);
 int show_cfg(const CfgNode& cfg, bool show_def = false,
               bool hide_secret = false);
+int show_cfg(OutputSink& out, const CfgNode& cfg, bool show_def = false,
+             bool hide_secret = false);
+
+/* config in JSON format. tag values are keys of the tag node object,
+ * multi-value nodes are arrays, and comment/deactivated state are
+ * represented by "#comment"/"#deactivated" members.
+ */
+int show_cfg_json(const CfgNode& cfg, bool show_def = false,
+                  bool hide_secret = false);
+int show_cfg_json(OutputSink& out, const CfgNode& cfg, bool show_def = false,
+                  bool hide_secret = false);
 
 void show_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2);
+void show_cmds_diff(OutputSink& out, const CfgNode& cfg1,
+                    const CfgNode& cfg2);
 void show_cmds(const CfgNode& cfg);
 
+/* visitor for the commands that turn one config into another (see
+ * visit_cmds_diff()).
+ */
+class CmdVisitor {
+public:
+  enum Op {
+    OP_DELETE,
+    OP_SET,
+    OP_COMMENT
+  };
+
+  virtual ~CmdVisitor() {}
+  // the path is only valid during the call
+  virtual void visit(Op op, const cstore::Cpath& path) = 0;
+};
+
+/* generate the commands as the diff walk produces them, i.e., without
+ * collecting them. the commands are visited in config order, so delete,
+ * set, and comment commands are interleaved (a comment command is visited
+ * before the set command that creates the node). visit_cmds() visits the
+ * set and comment commands of a single config.
+ */
+void visit_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
+                     CmdVisitor& visitor);
+void visit_cmds(const CfgNode& cfg, CmdVisitor& visitor);
+
+// the commands collected in lists (in the order they are to be applied)
 void get_cmds_diff(const CfgNode& cfg1, const CfgNode& cfg2,
                    std::vector<cstore::Cpath>& del_list,
                    std::vector<cstore::Cpath>& set_list,
@@ -70,7 +117,9 @@ int showConfig(const std::string& cfg1, const std::string& cfg2,
 /* these functions provide the functionality necessary for the "config
  * file" shell API. basically the API uses the "cparse" interface to
  * parse a config file into a CfgNode tree structure, and then these
- * functions can be used to access the nodes in the tree.
+ * functions can be used to access the nodes in the tree. they only visit
+ * the nodes along the path, so on a lazy tree (see CfgNode::createLazy())
+ * nothing else is read.
  */
 CfgNode *findCfgNode(CfgNode *root, const cstore::Cpath& path,
                      bool& is_value);
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <new>
+
+#include <cnode/cnode-arena.hpp>
+
+using namespace cnode;
+
+/* header in front of each allocation. padded so that the node itself is
+ * suitably aligned.
+ */
+struct CfgNodeArena::Header {
+  CfgNodeArena *arena;
+  size_t size;
+};
+
+const size_t CfgNodeArena::C_HDR_SIZE
+  = ((sizeof(CfgNodeArena::Header) + 15) & ~((size_t) 15));
+
+__thread CfgNodeArena *CfgNodeArena::_current = 0;
+CfgNodeArena *CfgNodeArena::_process_arena = 0;
+
+////// constructors/destructors
+CfgNodeArena::CfgNodeArena(bool monotonic)
+  : _monotonic(monotonic), _blocks(), _cur(0), _left(0), _live(0),
+    _free_size(0), _free(0), _strings(0), _adopted()
+{
+}
+
+CfgNodeArena::~CfgNodeArena()
+{
+  // bulk release
+  for (size_t i = 0; i < _blocks.size(); i++) {
+    free(_blocks[i]);
+  }
+  delete _strings;
+  for (size_t i = 0; i < _adopted.size(); i++) {
+    delete _adopted[i];
+  }
+}
+
+CfgNodeArena::Scope::Scope(CfgNodeArena& arena)
+  : _saved(_current)
+{
+  _current = &arena;
+}
+
+CfgNodeArena::Scope::~Scope()
+{
+  _current = _saved;
+}
+
+////// public functions
+void *
+CfgNodeArena::allocate(size_t size)
+{
+  CfgNodeArena *a = current();
+  if (a) {
+    return a->alloc(size);
+  }
+  char *p = static_cast<char *>(malloc(C_HDR_SIZE + size));
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  Header *h = reinterpret_cast<Header *>(p);
+  h->arena = 0;
+  h->size = size;
+  return (p + C_HDR_SIZE);
+}
+
+// free memory from allocate()
+void
+CfgNodeArena::deallocate(void *p)
+{
+  if (!p) {
+    return;
+  }
+  char *b = static_cast<char *>(p) - C_HDR_SIZE;
+  Header *h = reinterpret_cast<Header *>(b);
+  if (!h->arena) {
+    free(b);
+    return;
+  }
+  h->arena->release(b, h->size);
+}
+
+CfgNodeArena *
+CfgNodeArena::current()
+{
+  return (_current ? _current : _process_arena);
+}
+
+const std::string *
+CfgNodeArena::internString(const std::string& s)
+{
+  CfgNodeArena *a = current();
+  if (!a) {
+    return 0;
+  }
+  if (!a->_strings) {
+    a->_strings = new std::tr1::unordered_set<std::string>();
+  }
+  // set elements are never moved, so the pointer remains valid
+  return &(*(a->_strings->insert(s).first));
+}
+
+void
+CfgNodeArena::useProcessArena(bool monotonic)
+{
+  if (!_process_arena) {
+    _process_arena = new CfgNodeArena(monotonic);
+  }
+}
+
+////// private functions
+void *
+CfgNodeArena::alloc(size_t size)
+{
+  size_t asize = ((C_HDR_SIZE + size + 15) & ~((size_t) 15));
+  char *p = 0;
+  if (_free && size == _free_size) {
+    p = reinterpret_cast<char *>(_free);
+    _free = _free->next;
+  } else {
+    if (asize > _left) {
+      size_t bsize = (asize > C_BLOCK_SIZE ? asize : C_BLOCK_SIZE);
+      char *b = static_cast<char *>(malloc(bsize));
+      if (!b) {
+        throw std::bad_alloc();
+      }
+      _blocks.push_back(b);
+      _cur = b;
+      _left = bsize;
+    }
+    p = _cur;
+    _cur += asize;
+    _left -= asize;
+  }
+  Header *h = reinterpret_cast<Header *>(p);
+  h->arena = this;
+  h->size = size;
+  ++_live;
+  return (p + C_HDR_SIZE);
+}
+
+void
+CfgNodeArena::release(void *p, size_t size)
+{
+  --_live;
+  if (_monotonic) {
+    // never reused. released with the arena.
+    return;
+  }
+  if (!_free) {
+    _free_size = size;
+  }
+  if (size == _free_size) {
+    FreeNode *f = static_cast<FreeNode *>(p);
+    f->next = _free;
+    _free = f;
+  }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CNODE_ARENA_HPP_
+#define _CNODE_ARENA_HPP_
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <tr1/unordered_set>
+
+namespace cnode {
+
+/* arena for CfgNode trees.
+ *
+ * while an arena is "current" (see Scope), CfgNode allocations are carved
+ * out of large blocks owned by the arena instead of one malloc per node.
+ * each allocation remembers its arena, so nodes can be deleted as usual
+ * from anywhere. freed nodes go to a free list in the arena (or are simply
+ * dropped in monotonic mode), and all blocks are released at once when the
+ * arena is destroyed. therefore an arena must outlive the nodes allocated
+ * from it.
+ *
+ * the arena also interns strings (see internString()) so that nodes can
+ * refer to shared copies of their names and values. the strings live as
+ * long as the arena.
+ *
+ * monotonic mode never reuses memory, i.e., delete is a no-op. this is
+ * intended for short-lived processes (see useProcessArena()).
+ *
+ * an arena is not thread-safe. the current arena is per-thread.
+ */
+class CfgNodeArena {
+public:
+  CfgNodeArena(bool monotonic = false);
+  ~CfgNodeArena();
+
+  // make an arena current for the lifetime of the scope (on this thread)
+  class Scope {
+  public:
+    Scope(CfgNodeArena& arena);
+    ~Scope();
+  private:
+    CfgNodeArena *_saved;
+  };
+
+  // allocate from the current arena (or the heap if none)
+  static void *allocate(size_t size);
+  static void deallocate(void *p);
+
+  /* arena used by new nodes on this thread: the innermost Scope if any,
+   * otherwise the process arena (may be NULL, i.e., heap).
+   */
+  static CfgNodeArena *current();
+  // install a process-wide arena that is never destroyed
+  static void useProcessArena(bool monotonic = true);
+
+  /* return a shared copy of the string interned in the current arena, or
+   * NULL if there is no current arena (in which case the caller needs its
+   * own copy).
+   */
+  static const std::string *internString(const std::string& s);
+
+  // take ownership of another arena, i.e., release it with this one
+  void adopt(CfgNodeArena *arena) { _adopted.push_back(arena); }
+  bool isMonotonic() const { return _monotonic; }
+
+  size_t numLiveNodes() const { return _live; }
+  size_t numBlocks() const { return _blocks.size(); }
+
+private:
+  struct Header;
+  struct FreeNode {
+    FreeNode *next;
+  };
+
+  static const size_t C_BLOCK_SIZE = 262144;
+  static const size_t C_HDR_SIZE;
+
+  bool _monotonic;
+  std::vector<char *> _blocks;
+  char *_cur;
+  size_t _left;
+  size_t _live;
+  // free list for the (single) node size seen by this arena
+  size_t _free_size;
+  FreeNode *_free;
+  std::tr1::unordered_set<std::string> *_strings;
+  std::vector<CfgNodeArena *> _adopted;
+
+  static __thread CfgNodeArena *_current;
+  static CfgNodeArena *_process_arena;
+
+  void *alloc(size_t size);
+  void release(void *p, size_t size);
+
+  // not copyable
+  CfgNodeArena(const CfgNodeArena&);
+  CfgNodeArena& operator=(const CfgNodeArena&);
+};
+
+} // namespace cnode
+
+#endif /* _CNODE_ARENA_HPP_ */
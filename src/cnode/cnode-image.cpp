@@ -0,0 +1,538 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <tr1/unordered_map>
+
+#include <cli_cstore.h>
+#include <cnode/cnode.hpp>
+#include <cnode/cnode-image.hpp>
+#include <cnode/cnode-arena.hpp>
+#include <cnode/cnode-output.hpp>
+#include <cparse/cparse.hpp>
+
+using namespace cnode;
+using namespace cstore;
+using namespace std;
+
+////// constants
+const char CfgImage::C_MAGIC[] = "VYCFGIMG";
+const char *CfgImage::C_TAG_COMP = "node.tag";
+
+////// class Writer
+class CfgImage::Writer {
+public:
+  Writer() : _num_nodes(0) {
+    // string ID 0 is the empty string (not in the table)
+    _str_ids[""] = 0;
+  }
+
+  void addTree(const CfgNode& root) {
+    Cpath path, tkey;
+    add_node(root, path, tkey);
+  }
+  void output(string& img) const;
+
+private:
+  typedef tr1::unordered_map<string, uint32_t> StrIdMapT;
+  typedef MapT<Cpath, uint32_t, CpathHash> TmplIdMapT;
+
+  StrIdMapT _str_ids;
+  vector<const string *> _strs;
+  TmplIdMapT _tmpl_ids;
+  vector<vector<uint32_t> > _tmpls;
+  // description of the templates in the table (see add_tmpl_desc())
+  string _tmpl_desc;
+  string _nodes;
+  uint32_t _num_nodes;
+
+  static void put_num(string& buf, uint64_t n) {
+    while (n >= 0x80) {
+      buf.push_back(static_cast<char>((n & 0x7f) | 0x80));
+      n >>= 7;
+    }
+    buf.push_back(static_cast<char>(n));
+  }
+  static void put_str(string& buf, const string& s) {
+    put_num(buf, s.size());
+    buf.append(s);
+  }
+  uint32_t str_id(const string& s);
+  uint32_t tmpl_id(const CfgNode& node, const Cpath& path,
+                   const Cpath& tkey);
+  void add_node(const CfgNode& node, Cpath& path, Cpath& tkey);
+};
+
+uint32_t
+CfgImage::Writer::str_id(const string& s)
+{
+  StrIdMapT::iterator it = _str_ids.find(s);
+  if (it != _str_ids.end()) {
+    return it->second;
+  }
+  uint32_t id = _strs.size() + 1;
+  it = _str_ids.insert(make_pair(s, id)).first;
+  _strs.push_back(&(it->first));
+  return id;
+}
+
+/* return the ID of the template of the node (0 if none). nodes with the
+ * same tag-collapsed path (tkey) share the template, so the table only
+ * records the path of the first such node.
+ */
+uint32_t
+CfgImage::Writer::tmpl_id(const CfgNode& node, const Cpath& path,
+                          const Cpath& tkey)
+{
+  if (path.size() == 0 || !node.getTmpl().get()) {
+    // root or invalid node
+    return 0;
+  }
+  TmplIdMapT::iterator it = _tmpl_ids.find(tkey);
+  if (it != _tmpl_ids.end()) {
+    return it->second;
+  }
+  vector<uint32_t> comps;
+  for (size_t i = 0; i < path.size(); i++) {
+    comps.push_back(str_id(path[i]));
+  }
+  _tmpls.push_back(comps);
+  add_tmpl_desc(_tmpl_desc, *node.getTmpl());
+  uint32_t id = _tmpls.size();
+  _tmpl_ids[tkey] = id;
+  return id;
+}
+
+void
+CfgImage::Writer::add_node(const CfgNode& node, Cpath& path, Cpath& tkey)
+{
+  const CfgNode& n = CfgNode::loaded(node);
+  ++_num_nodes;
+  put_num(_nodes, (n._flags & CfgNode::C_CONTENT_FLAGS));
+  put_num(_nodes, str_id(n.getName()));
+  put_num(_nodes, str_id(n.getValue()));
+  put_num(_nodes, str_id(n.getComment()));
+  put_num(_nodes, tmpl_id(n, path, tkey));
+  if (n.isMulti()) {
+    const vector<string>& values = n.getValues();
+    put_num(_nodes, values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      put_num(_nodes, str_id(values[i]));
+    }
+  }
+
+  const CfgNode::nodes_vec_type& cnodes = n.getChildNodes();
+  put_num(_nodes, cnodes.size());
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    const CfgNode& cn = CfgNode::loaded(*cnodes[i]);
+    // same path as the cstore uses to look up the template of the node
+    if (cn.isValue()) {
+      path.push(cn.getValue());
+      tkey.push(C_TAG_COMP);
+    } else {
+      path.push(cn.getName());
+      tkey.push(cn.getName());
+    }
+    add_node(cn, path, tkey);
+    path.pop();
+    tkey.pop();
+  }
+}
+
+void
+CfgImage::Writer::output(string& img) const
+{
+  img.assign(C_MAGIC, C_MAGIC_LEN);
+  put_num(img, C_VERSION);
+  put_num(img, checksum(_tmpl_desc.data(), _tmpl_desc.size()));
+  put_num(img, _strs.size());
+  for (size_t i = 0; i < _strs.size(); i++) {
+    put_str(img, *_strs[i]);
+  }
+  put_num(img, _tmpls.size());
+  for (size_t i = 0; i < _tmpls.size(); i++) {
+    put_num(img, _tmpls[i].size());
+    for (size_t j = 0; j < _tmpls[i].size(); j++) {
+      put_num(img, _tmpls[i][j]);
+    }
+  }
+  put_num(img, _num_nodes);
+  img.append(_nodes);
+
+  uint64_t sum = checksum(img.data(), img.size());
+  for (size_t i = 0; i < C_CHECKSUM_LEN; i++) {
+    img.push_back(static_cast<char>((sum >> (i * 8)) & 0xff));
+  }
+}
+
+////// class Reader
+class CfgImage::Reader {
+public:
+  Reader(const char *data, size_t len) : _ptr(data), _end(data + len) {}
+
+  CfgNode *readTree(Cstore *cstore);
+
+private:
+  // deeper than any config (i.e., the image is invalid)
+  static const size_t C_MAX_DEPTH = 256;
+
+  const char *_ptr;
+  const char *_end;
+  vector<string> _strs;
+  // strings interned in the current arena (if any)
+  vector<const string *> _istrs;
+  vector<tr1::shared_ptr<Ctemplate> > _tmpls;
+  uint32_t _num_nodes;
+
+  bool get_num(uint64_t& n);
+  bool get_num(uint32_t& n, uint32_t max);
+  bool get_str(string& s);
+  bool read_tables(Cstore *cstore);
+  CfgNode *read_node(size_t depth);
+  void set_str(CfgNode& n, const string *& str, uint16_t own_flag,
+               uint32_t id);
+};
+
+bool
+CfgImage::Reader::get_num(uint64_t& n)
+{
+  n = 0;
+  for (unsigned int shift = 0; _ptr < _end && shift < 64; shift += 7) {
+    unsigned char c = static_cast<unsigned char>(*(_ptr++));
+    n |= (static_cast<uint64_t>(c & 0x7f) << shift);
+    if (!(c & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// number must be less than max
+bool
+CfgImage::Reader::get_num(uint32_t& n, uint32_t max)
+{
+  uint64_t v;
+  if (!get_num(v) || v >= max) {
+    return false;
+  }
+  n = static_cast<uint32_t>(v);
+  return true;
+}
+
+bool
+CfgImage::Reader::get_str(string& s)
+{
+  uint64_t len;
+  if (!get_num(len) || len > static_cast<uint64_t>(_end - _ptr)) {
+    return false;
+  }
+  s.assign(_ptr, len);
+  _ptr += len;
+  return true;
+}
+
+bool
+CfgImage::Reader::read_tables(Cstore *cstore)
+{
+  uint64_t version;
+  if (!get_num(version) || version != C_VERSION) {
+    fprintf(stderr, "unsupported config image version\n");
+    return false;
+  }
+  uint64_t fingerprint;
+  if (!get_num(fingerprint)) {
+    return false;
+  }
+
+  uint32_t num;
+  if (!get_num(num, static_cast<uint32_t>(_end - _ptr))) {
+    return false;
+  }
+  _strs.resize(num + 1);
+  for (size_t i = 1; i <= num; i++) {
+    if (!get_str(_strs[i])) {
+      return false;
+    }
+  }
+  _istrs.resize(_strs.size(), 0);
+  if (CfgNodeArena::current()) {
+    for (size_t i = 1; i < _strs.size(); i++) {
+      _istrs[i] = CfgNodeArena::internString(_strs[i]);
+    }
+  }
+
+  if (!get_num(num, static_cast<uint32_t>(_end - _ptr))) {
+    return false;
+  }
+  // template ID 0 means no template
+  _tmpls.resize(num + 1);
+  string desc;
+  for (size_t i = 1; i <= num; i++) {
+    uint32_t ncomps, id;
+    if (!get_num(ncomps, static_cast<uint32_t>(_end - _ptr))) {
+      return false;
+    }
+    Cpath path;
+    for (size_t j = 0; j < ncomps; j++) {
+      if (!get_num(id, _strs.size())) {
+        return false;
+      }
+      path.push(_strs[id]);
+    }
+    if (cstore) {
+      _tmpls[i] = cstore->parseTmpl(path, false);
+      if (!_tmpls[i].get()) {
+        // templates have changed since the image was written
+        fprintf(stderr, "template not found for [%s]\n",
+                path.to_string().c_str());
+        return false;
+      }
+      add_tmpl_desc(desc, *_tmpls[i]);
+    }
+  }
+  if (cstore && fingerprint != checksum(desc.data(), desc.size())) {
+    fprintf(stderr, "templates have changed since the image was written\n");
+    return false;
+  }
+  return get_num(_num_nodes, static_cast<uint32_t>(_end - _ptr));
+}
+
+void
+CfgImage::Reader::set_str(CfgNode& n, const string *& str, uint16_t own_flag,
+                          uint32_t id)
+{
+  if (_istrs[id]) {
+    str = _istrs[id];
+  } else {
+    n.set_str(str, own_flag, _strs[id]);
+  }
+}
+
+CfgNode *
+CfgImage::Reader::read_node(size_t depth)
+{
+  uint32_t flags, name, value, comment, tmpl, num;
+  if (_num_nodes == 0 || depth > C_MAX_DEPTH
+      || !get_num(flags, CfgNode::C_CONTENT_FLAGS + 1)
+      || !get_num(name, _strs.size()) || !get_num(value, _strs.size())
+      || !get_num(comment, _strs.size()) || !get_num(tmpl, _tmpls.size())) {
+    return NULL;
+  }
+  --_num_nodes;
+
+  CfgNode *n = new CfgNode(static_cast<uint16_t>(flags));
+  set_str(*n, n->_name, CfgNode::F_OWN_NAME, name);
+  set_str(*n, n->_value, CfgNode::F_OWN_VALUE, value);
+  set_str(*n, n->_comment, CfgNode::F_OWN_COMMENT, comment);
+  if (_tmpls[tmpl].get()) {
+    n->setTmpl(_tmpls[tmpl]);
+  }
+  bool ok = true;
+  if (n->isMulti()) {
+    ok = get_num(num, static_cast<uint32_t>(_end - _ptr));
+    if (ok && num > 0) {
+      n->_values = new vector<string>(num);
+      for (size_t i = 0; ok && i < num; i++) {
+        uint32_t id;
+        ok = get_num(id, _strs.size());
+        if (ok) {
+          (*n->_values)[i] = _strs[id];
+        }
+      }
+    }
+  }
+  // each child node takes at least one byte
+  ok = (ok && get_num(num, static_cast<uint32_t>(_end - _ptr)));
+  for (size_t i = 0; ok && i < num; i++) {
+    CfgNode *cn = read_node(depth + 1);
+    if (cn) {
+      n->addChildNode(cn);
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    delete n;
+    return NULL;
+  }
+  return n;
+}
+
+CfgNode *
+CfgImage::Reader::readTree(Cstore *cstore)
+{
+  if (!read_tables(cstore)) {
+    return NULL;
+  }
+  CfgNode *root = read_node(0);
+  if (root && (_num_nodes != 0 || _ptr != _end)) {
+    // trailing garbage
+    delete root;
+    root = NULL;
+  }
+  if (root) {
+    root->compute_hash();
+  }
+  return root;
+}
+
+////// public functions
+bool
+CfgImage::save(const CfgNode& root, const string& file)
+{
+  string img;
+  {
+    Writer w;
+    w.addTree(root);
+    w.output(img);
+  }
+
+  // write a temp file and rename it so that readers never see a partial one
+  string tmp = file + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0660);
+  if (fd < 0) {
+    fprintf(stderr, "failed to open [%s]: %s\n", tmp.c_str(),
+            strerror(errno));
+    return false;
+  }
+  bool ok;
+  {
+    OutputSink out(fd);
+    out.write(img);
+    ok = out.flush();
+  }
+  ok = (ok && fsync(fd) == 0);
+  ok = (close(fd) == 0 && ok);
+  if (!ok || rename(tmp.c_str(), file.c_str()) != 0) {
+    fprintf(stderr, "failed to write [%s]: %s\n", file.c_str(),
+            strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+CfgNode *
+CfgImage::load(const string& file, Cstore *cstore)
+{
+  string img;
+  {
+    FILE *fin = fopen(file.c_str(), "r");
+    if (!fin) {
+      return NULL;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fin)) > 0) {
+      img.append(buf, n);
+    }
+    bool err = ferror(fin);
+    fclose(fin);
+    if (err) {
+      return NULL;
+    }
+  }
+
+  if (img.size() < (C_MAGIC_LEN + C_CHECKSUM_LEN)
+      || img.compare(0, C_MAGIC_LEN, C_MAGIC) != 0) {
+    return NULL;
+  }
+  size_t len = img.size() - C_CHECKSUM_LEN;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < C_CHECKSUM_LEN; i++) {
+    sum |= (static_cast<uint64_t>(static_cast<unsigned char>(img[len + i]))
+            << (i * 8));
+  }
+  if (sum != checksum(img.data(), len)) {
+    fprintf(stderr, "checksum mismatch in [%s]\n", file.c_str());
+    return NULL;
+  }
+  Reader r(img.data() + C_MAGIC_LEN, len - C_MAGIC_LEN);
+  return r.readTree(cstore);
+}
+
+bool
+CfgImage::isImage(const string& file)
+{
+  char magic[C_MAGIC_LEN];
+  FILE *fin = fopen(file.c_str(), "r");
+  if (!fin) {
+    return false;
+  }
+  bool ret = (fread(magic, 1, C_MAGIC_LEN, fin) == C_MAGIC_LEN
+              && memcmp(magic, C_MAGIC, C_MAGIC_LEN) == 0);
+  fclose(fin);
+  return ret;
+}
+
+CfgNode *
+CfgImage::loadConfig(const string& file, Cstore& cstore)
+{
+  Cpath path;
+  return loadConfig(file, cstore, path);
+}
+
+CfgNode *
+CfgImage::loadConfig(const string& file, Cstore& cstore, const Cpath& path)
+{
+  if (isImage(file)) {
+    // the whole image is loaded (one template lookup per template anyway)
+    return load(file, &cstore);
+  }
+  return cparse::parse_file(file.c_str(), cstore, path);
+}
+
+////// private functions
+uint64_t
+CfgImage::checksum(const char *data, size_t len)
+{
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/* append the description of the template, i.e., the attributes that
+ * determine how a config is stored under it, to the one of the templates
+ * before it. the fingerprint of the templates of an image is the checksum
+ * of the description of all templates in its table.
+ */
+void
+CfgImage::add_tmpl_desc(string& desc, const Ctemplate& tmpl)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%d %d %u %u", tmpl.isTag(), tmpl.isMulti(),
+           tmpl.getTagLimit(), tmpl.getMultiLimit());
+  desc += buf;
+  for (size_t i = 1; i <= tmpl.getNumTypes(); i++) {
+    snprintf(buf, sizeof(buf), " %d", static_cast<int>(tmpl.getType(i)));
+    desc += buf;
+  }
+  desc += "\n";
+  if (tmpl.getDefault()) {
+    desc += tmpl.getDefault();
+  }
+  desc.push_back('\0');
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CNODE_IMAGE_HPP_
+#define _CNODE_IMAGE_HPP_
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <cstore/cstore.hpp>
+#include <cnode/cnode.hpp>
+
+namespace cnode {
+
+/* binary image of a CfgNode tree, i.e., a config that can be loaded
+ * without going through the config file parser and the template lookup
+ * for each node (unlike cstore::ActiveImage, which answers queries on the
+ * active config in place).
+ *
+ * the image consists of a header (magic, format version, and fingerprint
+ * of the templates), a table of the distinct strings in the config, a
+ * table of the distinct templates
+ * (one path per tag-collapsed template path, e.g., one for all values of
+ * "interfaces ethernet"), the nodes in preorder (attributes, string IDs,
+ * template ID, number of child nodes), and a checksum of all the above.
+ * numbers are encoded as LEB128 varints.
+ *
+ * loading an image does not need templates. if a cstore is specified, the
+ * templates are attached to the nodes (one lookup per template in the
+ * table), and the image is rejected if the fingerprint of the current
+ * templates differs, i.e., the templates have changed since it was written.
+ */
+class CfgImage {
+public:
+  /* write the image of the tree to the file (replaced atomically). the
+   * tree must be rooted at the config root, i.e., the template paths are
+   * relative to the root.
+   */
+  static bool save(const CfgNode& root, const std::string& file);
+  /* return the tree in the image file or NULL if the image cannot be read
+   * or is invalid (wrong version, checksum mismatch, template fingerprint
+   * mismatch, etc.). nodes are
+   * allocated from the current arena (see cnode-arena.hpp).
+   */
+  static CfgNode *load(const std::string& file,
+                       cstore::Cstore *cstore = NULL);
+  // whether the file is (supposed to be) an image, i.e., has the magic
+  static bool isImage(const std::string& file);
+
+  /* return the tree in the config file, which can be either an image or
+   * a text config (see cparse::parse_file()). if a path is specified, the
+   * tree may only contain the subtree at the path.
+   */
+  static CfgNode *loadConfig(const std::string& file, cstore::Cstore& cstore);
+  static CfgNode *loadConfig(const std::string& file, cstore::Cstore& cstore,
+                             const cstore::Cpath& path);
+
+private:
+  static const char C_MAGIC[];
+  static const size_t C_MAGIC_LEN = 8;
+  static const uint32_t C_VERSION = 2;
+  static const size_t C_CHECKSUM_LEN = 8;
+  // path component standing for any tag value in a template key
+  static const char *C_TAG_COMP;
+
+  class Writer;
+  class Reader;
+
+  static uint64_t checksum(const char *data, size_t len);
+  static void add_tmpl_desc(std::string& desc, const cstore::Ctemplate& tmpl);
+};
+
+} // namespace cnode
+
+#endif /* _CNODE_IMAGE_HPP_ */
+
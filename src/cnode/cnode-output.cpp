@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <cnode/cnode-output.hpp>
+
+using namespace cnode;
+using namespace std;
+
+////// static
+const string OutputSink::_empty;
+
+// write all of the buffers. return false if failed.
+static bool
+_writev_all(int fd, struct iovec *iov, int cnt)
+{
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    // skip what has been written
+    size_t done = n;
+    while (cnt > 0 && done >= iov->iov_len) {
+      done -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+      iov->iov_len -= done;
+    }
+  }
+  return true;
+}
+
+////// constructors/destructors
+OutputSink::OutputSink()
+  : _fd(-1), _buf(0), _len(0), _mem(new string()), _err(false)
+{
+}
+
+OutputSink::OutputSink(int fd)
+  : _fd(fd), _buf(new char[C_BUF_SIZE]), _len(0), _mem(0), _err(false)
+{
+  if (fd == STDOUT_FILENO) {
+    fflush(stdout);
+  } else if (fd == STDERR_FILENO) {
+    fflush(stderr);
+  }
+}
+
+OutputSink::~OutputSink()
+{
+  flush();
+  delete [] _buf;
+  delete _mem;
+}
+
+////// public functions
+bool
+OutputSink::flush()
+{
+  if (_mem || _len == 0) {
+    return !_err;
+  }
+  write_fd(NULL, 0);
+  return !_err;
+}
+
+////// private functions
+/* write the buffer and the specified string. a short string is copied
+ * into the (emptied) buffer instead.
+ */
+void
+OutputSink::write_fd(const char *s, size_t len)
+{
+  if (len > 0 && len < C_DIRECT_MIN && _len == 0) {
+    memcpy(_buf, s, len);
+    _len = len;
+    return;
+  }
+  struct iovec iov[2];
+  int cnt = 0;
+  if (_len > 0) {
+    iov[cnt].iov_base = _buf;
+    iov[cnt].iov_len = _len;
+    ++cnt;
+  }
+  if (len >= C_DIRECT_MIN) {
+    iov[cnt].iov_base = const_cast<char *>(s);
+    iov[cnt].iov_len = len;
+    ++cnt;
+  }
+  if (!_err && !_writev_all(_fd, iov, cnt)) {
+    _err = true;
+  }
+  _len = 0;
+  if (len > 0 && len < C_DIRECT_MIN) {
+    memcpy(_buf, s, len);
+    _len = len;
+  }
+}
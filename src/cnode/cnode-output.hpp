@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CNODE_OUTPUT_HPP_
+#define _CNODE_OUTPUT_HPP_
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace cnode {
+
+/* buffered output sink for config output (see show_cfg_diff()).
+ *
+ * output is collected in a large buffer and written to the file
+ * descriptor when the buffer is full (or at flush()), i.e., without going
+ * through stdio. large strings are not copied into the buffer but written
+ * together with it (writev()).
+ *
+ * in memory mode (default constructor), the output is collected in a
+ * string instead (see str()).
+ *
+ * after a write error, further output is discarded (see error()).
+ */
+class OutputSink {
+public:
+  // memory mode
+  OutputSink();
+  // stdio output on the same fd is flushed first to keep the order
+  OutputSink(int fd);
+  ~OutputSink();
+
+  void write(const char *s, size_t len) {
+    if (_mem) {
+      _mem->append(s, len);
+    } else if (len <= (C_BUF_SIZE - _len)) {
+      memcpy(_buf + _len, s, len);
+      _len += len;
+    } else {
+      write_fd(s, len);
+    }
+  }
+  void write(const char *s) { write(s, strlen(s)); }
+  void write(const std::string& s) { write(s.data(), s.size()); }
+  void put(char c) { write(&c, 1); }
+
+  bool flush();
+  bool error() const { return _err; }
+  // output collected in memory mode
+  const std::string& str() const { return (_mem ? *_mem : _empty); }
+
+private:
+  static const size_t C_BUF_SIZE = 65536;
+  // strings at least this long are written without copying
+  static const size_t C_DIRECT_MIN = 4096;
+  static const std::string _empty;
+
+  int _fd;
+  char *_buf;
+  size_t _len;
+  std::string *_mem;
+  bool _err;
+
+  void write_fd(const char *s, size_t len);
+
+  // not copyable
+  OutputSink(const OutputSink&);
+  OutputSink& operator=(const OutputSink&);
+};
+
+} // namespace cnode
+
+#endif /* _CNODE_OUTPUT_HPP_ */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <thread>
+#include <chrono>
+
+#include <cnode/cnode-pool.hpp>
+
+using namespace cnode;
+
+__thread WorkPool *WorkPool::_cur_pool = 0;
+__thread size_t WorkPool::_cur_worker = 0;
+
+////// constructors/destructors
+WorkPool::WorkPool(size_t num_workers)
+  : _next_queue(0), _pending(0)
+{
+  for (size_t i = 0; i < (num_workers > 0 ? num_workers : 1); i++) {
+    _queues.push_back(new Queue());
+  }
+}
+
+WorkPool::~WorkPool()
+{
+  for (size_t i = 0; i < _queues.size(); i++) {
+    delete _queues[i];
+  }
+}
+
+////// public functions
+void
+WorkPool::submit(const TaskT& task)
+{
+  size_t idx;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    ++_pending;
+    if (_cur_pool == this) {
+      // from a worker => own queue
+      idx = _cur_worker;
+    } else {
+      idx = _next_queue;
+      _next_queue = (_next_queue + 1) % _queues.size();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(_queues[idx]->lock);
+    _queues[idx]->tasks.push_back(task);
+  }
+  _cond.notify_one();
+}
+
+void
+WorkPool::run()
+{
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < _queues.size(); i++) {
+    threads.push_back(std::thread(&WorkPool::work, this, i));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+////// private functions
+void
+WorkPool::work(size_t idx)
+{
+  _cur_pool = this;
+  _cur_worker = idx;
+  while (1) {
+    TaskT task;
+    if (get_task(idx, task)) {
+      task(idx);
+      task_done();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(_lock);
+    if (_pending == 0) {
+      // all done
+      break;
+    }
+    /* tasks are pending but none is queued (i.e., they are running and may
+     * submit more). wait for a submit or for everything to finish. the
+     * timeout covers a submit between get_task() and here.
+     */
+    _cond.wait_for(lock, std::chrono::milliseconds(1));
+  }
+  _cur_pool = 0;
+}
+
+bool
+WorkPool::get_task(size_t idx, TaskT& task)
+{
+  // own queue first (newest), then steal from the others (oldest)
+  for (size_t i = 0; i < _queues.size(); i++) {
+    Queue *q = _queues[(idx + i) % _queues.size()];
+    std::lock_guard<std::mutex> lock(q->lock);
+    if (q->tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = q->tasks.back();
+      q->tasks.pop_back();
+    } else {
+      task = q->tasks.front();
+      q->tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void
+WorkPool::task_done()
+{
+  bool done;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    done = (--_pending == 0);
+  }
+  if (done) {
+    _cond.notify_all();
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CNODE_POOL_HPP_
+#define _CNODE_POOL_HPP_
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+namespace cnode {
+
+/* work-stealing thread pool.
+ *
+ * each worker has its own task queue. a worker runs the most recently
+ * added task of its own queue first and steals the oldest task from the
+ * other queues when its own queue is empty. tasks can submit more tasks
+ * (which go to the queue of the submitting worker).
+ *
+ * run() starts the workers and returns when all tasks (including those
+ * submitted while running) are done.
+ */
+class WorkPool {
+public:
+  // argument is the index of the worker running the task
+  typedef std::function<void (size_t)> TaskT;
+
+  WorkPool(size_t num_workers);
+  ~WorkPool();
+
+  void submit(const TaskT& task);
+  void run();
+  size_t numWorkers() const { return _queues.size(); }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<TaskT> tasks;
+  };
+
+  std::vector<Queue *> _queues;
+  size_t _next_queue;
+  size_t _pending;
+  std::mutex _lock;
+  std::condition_variable _cond;
+
+  // worker index of the current thread (if it is a worker of this pool)
+  static __thread WorkPool *_cur_pool;
+  static __thread size_t _cur_worker;
+
+  void work(size_t idx);
+  bool get_task(size_t idx, TaskT& task);
+  void task_done();
+
+  // not copyable
+  WorkPool(const WorkPool&);
+  WorkPool& operator=(const WorkPool&);
+};
+
+} // namespace cnode
+
+#endif /* _CNODE_POOL_HPP_ */
@@ -16,14 +16,101 @@
 
 #ifndef _CNODE_UTIL_HPP_
 #define _CNODE_UTIL_HPP_
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <algorithm>
 #include <vector>
 
+#include <stdint.h>
+
 namespace cnode {
 
+/* compact vector of pointers. a single element is stored inline, so leaf
+ * nodes and nodes with only one child do not need a separate allocation.
+ * copying copies the pointers only.
+ */
+template<class T> class SmallPtrVec {
+public:
+  typedef T *value_type;
+  typedef T **iterator;
+  typedef T * const *const_iterator;
+
+  SmallPtrVec() : _size(0), _cap(1) { _u.one = 0; }
+  SmallPtrVec(const SmallPtrVec& v) : _size(0), _cap(1) {
+    _u.one = 0;
+    assign(v.begin(), v.end());
+  }
+  ~SmallPtrVec() {
+    if (_cap > 1) {
+      free(_u.many);
+    }
+  }
+  SmallPtrVec& operator=(const SmallPtrVec& v) {
+    if (this != &v) {
+      assign(v.begin(), v.end());
+    }
+    return *this;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return (_size == 0); }
+  T *operator[](size_t idx) const { return data()[idx]; }
+  T *& operator[](size_t idx) { return data()[idx]; }
+  iterator begin() { return data(); }
+  iterator end() { return (data() + _size); }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return (data() + _size); }
+
+  void push_back(T *p) {
+    if (_size == _cap) {
+      grow();
+    }
+    data()[_size++] = p;
+  }
+  iterator erase(iterator it) {
+    memmove(it, it + 1, (end() - it - 1) * sizeof(T *));
+    --_size;
+    return it;
+  }
+  // note: capacity is kept
+  void clear() { _size = 0; }
+  template<class I> void assign(I first, I last) {
+    _size = 0;
+    for (; first != last; ++first) {
+      push_back(*first);
+    }
+  }
+
+private:
+  union {
+    T *one;
+    T **many;
+  } _u;
+  uint32_t _size;
+  uint32_t _cap;
+
+  T **data() { return (_cap > 1 ? _u.many : &_u.one); }
+  T * const *data() const { return (_cap > 1 ? _u.many : &_u.one); }
+  void grow() {
+    uint32_t ncap = (_cap > 1 ? _cap * 2 : 4);
+    T **n = static_cast<T **>(malloc(ncap * sizeof(T *)));
+    if (!n) {
+      throw std::bad_alloc();
+    }
+    memcpy(n, data(), _size * sizeof(T *));
+    if (_cap > 1) {
+      free(_u.many);
+    }
+    _u.many = n;
+    _cap = ncap;
+  }
+};
+
 template<class N> class TreeNode {
 public:
   typedef N node_type;
-  typedef std::vector<N *> nodes_vec_type;
+  typedef SmallPtrVec<N> nodes_vec_type;
   typedef typename nodes_vec_type::iterator nodes_iter_type;
 
   TreeNode() : _parent(0) {}
@@ -40,10 +127,33 @@ public:
   node_type *getParent() const { return _parent; }
   node_type *childAt(size_t idx) { return _child_nodes[idx]; }
   void setParent(node_type *p) { _parent = p; }
-  void clearChildNodes() { _child_nodes.clear(); }
+  void clearChildNodes() {
+    _child_nodes.clear();
+    childNodesChanged();
+  }
   void addChildNode(node_type *cnode) {
     _child_nodes.push_back(cnode);
     cnode->_parent = static_cast<node_type *>(this);
+    childNodesChanged();
+  }
+
+  /* add empty slots that are filled in later with setChildNode() (e.g.,
+   * by different threads).
+   */
+  void addChildSlots(size_t num) {
+    for (size_t i = 0; i < num; i++) {
+      _child_nodes.push_back(0);
+    }
+    childNodesChanged();
+  }
+  void setChildNode(size_t idx, node_type *cnode) {
+    _child_nodes[idx] = cnode;
+    cnode->_parent = static_cast<node_type *>(this);
+  }
+
+  template<class Compare> void sortChildNodes(Compare cmp) {
+    std::stable_sort(_child_nodes.begin(), _child_nodes.end(), cmp);
+    childNodesChanged();
   }
 
   bool removeChildNode(node_type *cnode) {
@@ -51,6 +161,7 @@ public:
     while (it != _child_nodes.end()) {
       if (*it == cnode) {
         _child_nodes.erase(it);
+        childNodesChanged();
         return true;
       }
       ++it;
@@ -75,8 +186,13 @@ public:
       _child_nodes[i]->_parent = 0;
     }
     _child_nodes.clear();
+    childNodesChanged();
   }
 
+protected:
+  // called when the list of child nodes has changed
+  virtual void childNodesChanged() {}
+
 private:
   node_type *_parent;
   nodes_vec_type _child_nodes;
@@ -15,125 +15,475 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <memory>
+#include <thread>
+#include <tr1/unordered_map>
 
 #include <cli_cstore.h>
 #include <cnode/cnode.hpp>
+#include <cnode/cnode-pool.hpp>
 
 using namespace cnode;
 using namespace cstore;
 
+////// constants
+const char *CfgNode::C_ENV_BUILD_THREADS = "VYATTA_CFG_BUILD_THREADS";
+
+////// static
+const string CfgNode::_empty_str;
+const vector<string> CfgNode::_empty_values;
+__thread CfgNode::BuildContext *CfgNode::_build_ctx = 0;
+__thread unsigned int CfgNode::_build_depth = 0;
+
+static inline uint64_t
+_hash_mix(uint64_t h, uint64_t v)
+{
+  // splitmix64 finalizer over the combined value
+  h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return (h ^ (h >> 31));
+}
+
+static inline uint64_t
+_hash_str(uint64_t h, const string& s)
+{
+  // FNV-1a
+  uint64_t v = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < s.size(); i++) {
+    v = (v ^ static_cast<unsigned char>(s[i])) * 0x100000001b3ULL;
+  }
+  return _hash_mix(_hash_mix(h, s.size()), v);
+}
 
 ////// constructors/destructors
 // for parser
-CfgNode::CfgNode(Cpath& path_comps, char *name, char *val, char *comment,
-                 int deact, Cstore *cstore, bool tag_if_invalid)
-  : TreeNode<CfgNode>(),
-    _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
-    _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
-    _is_invalid(false), _exists(true)
-{
-  if (name && name[0]) {
+CfgNode::CfgNode(Cpath& path_comps, const StrView& name, const StrView& val,
+                 const StrView& comment, int deact, Cstore *cstore,
+                 bool tag_if_invalid)
+  : TreeNode<CfgNode>(), _flags(F_EXISTS), _hash(0), _name(&_empty_str),
+    _value(&_empty_str), _comment(&_empty_str), _values(0), _lazy(0), _index(0)
+{
+  if (name.len > 0) {
     // name must be non-empty
     path_comps.push(name);
   }
-  if (val) {
+  if (!val.isNull()) {
     // value could be empty
     path_comps.push(val);
   }
+  if (path_comps.size() == 0) {
+    // nothing to do for root node
+    return;
+  }
 
-  while (1) {
-    if (path_comps.size() == 0) {
-      // nothing to do for root node
-      break;
+  tr1::shared_ptr<Ctemplate> tmpl(cstore->parseTmpl(path_comps, false));
+  bool leaf_typeless = false;
+  if (tmpl.get()) {
+    vector<string> tcnodes;
+    cstore->tmplGetChildNodes(path_comps, tcnodes);
+    leaf_typeless = (tcnodes.size() == 0);
+  }
+
+  // restore path_comps
+  if (!val.isNull()) {
+    path_comps.pop();
+  }
+  if (name.len > 0) {
+    path_comps.pop();
+  }
+  init_parsed(name, val, comment, deact, tmpl, leaf_typeless, tag_if_invalid);
+}
+
+// for parser with the template already looked up
+CfgNode::CfgNode(const StrView& name, const StrView& val,
+                 const StrView& comment, int deact,
+                 const tr1::shared_ptr<Ctemplate>& tmpl, bool leaf_typeless,
+                 bool tag_if_invalid)
+  : TreeNode<CfgNode>(), _flags(F_EXISTS), _hash(0), _name(&_empty_str),
+    _value(&_empty_str), _comment(&_empty_str), _values(0), _lazy(0), _index(0)
+{
+  init_parsed(name, val, comment, deact, tmpl, leaf_typeless, tag_if_invalid);
+}
+
+// for active/working config
+CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
+                 bool recursive)
+  : TreeNode<CfgNode>(), _flags(F_EXISTS), _hash(0), _name(&_empty_str),
+    _value(&_empty_str), _comment(&_empty_str), _values(0), _lazy(0), _index(0)
+{
+  vector<string> cnodes;
+  if (!read_node(cstore, path_comps, active)
+      || !read_child_names(cstore, path_comps, active, cnodes)) {
+    // no child nodes
+    compute_hash();
+    return;
+  }
+
+  if (!recursive) {
+    // nothing further to do (no subtree hash without the child nodes)
+    return;
+  }
+
+  if (!build_parallel(cstore, path_comps, active, cnodes)) {
+    // recurse
+    ++_build_depth;
+    for (size_t i = 0; i < cnodes.size(); i++) {
+      path_comps.push(cnodes[i]);
+      CfgNode *cn = new CfgNode(cstore, path_comps, active, recursive);
+      addChildNode(cn);
+      path_comps.pop();
     }
+    --_build_depth;
+  }
 
-    setTmpl(cstore->parseTmpl(path_comps, false));
-    if (getTmpl().get()) {
-      // got the def
-      _is_tag = getTmpl()->isTag();
-      _is_leaf = (!_is_tag && !getTmpl()->isTypeless());
-
-      // match constructor from cstore (leaf node never _is_value)
-      _is_value = (getTmpl()->isValue() && !_is_leaf);
-      _is_multi = getTmpl()->isMulti();
-
-      /* XXX given the current definition of "default" (i.e., the
-       * "post-bug 1219" definition), the concept of "default" doesn't
-       * really apply to config files. however, if in the future we
-       * do go back to the original, simpler definition of "default"
-       * (which IMO is the right thing to do), the "default handling"
-       * here and elsewhere in the backend library will need to be
-       * revamped.
-       *
-       * in fact, in that case pretty much the only place that need to
-       * worry about "default" is in the "output" (i.e., "show")
-       * processing, and even there the only thing that needs to be
-       * done is to compare the current value with the "default value"
-       * in the template.
-       */
-      _is_default = false;
-      _is_deactivated = deact;
-
-      vector<string> tcnodes;
-      cstore->tmplGetChildNodes(path_comps, tcnodes);
-      if (tcnodes.size() == 0) {
-        // typeless leaf node
-        _is_leaf_typeless = true;
-      }
+  /* in a parallel build, some of the child nodes may still be in progress
+   * when this returns. the top of the build computes the hash when all
+   * workers are done.
+   */
+  if (!_build_ctx) {
+    compute_hash();
+  }
+}
 
-      if (comment) {
-        _comment = comment;
+////// struct BuildContext
+struct CfgNode::BuildContext {
+  BuildContext(size_t num_workers, bool a)
+    : pool(num_workers), views(), arenas(), active(a) {}
+
+  WorkPool pool;
+  // each worker reads from its own view and allocates from its own arena
+  vector<Cstore *> views;
+  vector<CfgNodeArena *> arenas;
+  bool active;
+};
+
+////// struct ChildIndex
+/* maps the keys (names/values, which are owned by the nodes) to the
+ * positions in the list of child nodes or values.
+ */
+struct CfgNode::ChildIndex {
+  struct Key {
+    Key(const char *str, size_t l) : s(str), len(l) {}
+    const char *s;
+    size_t len;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      // FNV-1a
+      size_t h = 2166136261U;
+      for (size_t i = 0; i < k.len; i++) {
+        h = (h ^ static_cast<unsigned char>(k.s[i])) * 16777619U;
       }
-      // ignore return
-    } else {
-      // not a valid node
-      _is_invalid = true;
-      if (tag_if_invalid) {
-        /* this is only used when the parser is creating a "tag node". force
-         * the node to be tag since we don't have template for invalid node.
-         */
-        _is_tag = true;
+      return h;
+    }
+  };
+  struct KeyEq {
+    bool operator()(const Key& a, const Key& b) const {
+      return (a.len == b.len && memcmp(a.s, b.s, a.len) == 0);
+    }
+  };
+  typedef tr1::unordered_map<Key, size_t, KeyHash, KeyEq> IndexT;
+
+  void add(const string& key, size_t idx) {
+    // keep the first one if there are duplicates (same as linear search)
+    map.insert(IndexT::value_type(Key(key.data(), key.size()), idx));
+  }
+  bool find(const char *key, size_t& idx) const {
+    IndexT::const_iterator it = map.find(Key(key, strlen(key)));
+    if (it == map.end()) {
+      return false;
+    }
+    idx = it->second;
+    return true;
+  }
+
+  IndexT map;
+};
+
+// key of a child node in the parent's index
+static inline const string&
+_child_key(const CfgNode *cn)
+{
+  return (cn->isValue() ? cn->getValue() : cn->getName());
+}
+
+////// struct LazyState
+struct CfgNode::LazyState {
+  LazyState(Cstore& c, const Cpath& p, bool a)
+    : cstore(c), path(p), active(a) {}
+
+  Cstore& cstore;
+  Cpath path;
+  bool active;
+};
+
+// for lazily loaded active/working config
+CfgNode::CfgNode(LazyState *lazy)
+  : TreeNode<CfgNode>(), _flags(F_EXISTS | F_LAZY_ATTRS | F_LAZY_CHILDREN),
+    _hash(0), _name(&_empty_str), _value(&_empty_str), _comment(&_empty_str),
+    _values(0), _lazy(lazy), _index(0)
+{
+}
+
+// for image
+CfgNode::CfgNode(uint16_t flags)
+  : TreeNode<CfgNode>(), _flags(flags), _hash(0), _name(&_empty_str),
+    _value(&_empty_str), _comment(&_empty_str), _values(0), _lazy(0), _index(0)
+{
+}
+
+CfgNode::CfgNode(const CfgNode& n)
+  : TreeNode<CfgNode>(loaded(n)), commit::CommitData(n), _flags(n._flags),
+    _hash(0), _name(n._name), _value(n._value), _comment(n._comment),
+    _values(n._values ? new vector<string>(*n._values) : 0), _lazy(0),
+    _index(0)
+{
+  // copies may be modified (e.g., commit tree drops child nodes)
+  setFlag(F_HASHED, false);
+  // private copies are not shared
+  if (flag(F_OWN_NAME)) {
+    _name = new string(*_name);
+  }
+  if (flag(F_OWN_VALUE)) {
+    _value = new string(*_value);
+  }
+  if (flag(F_OWN_COMMENT)) {
+    _comment = new string(*_comment);
+  }
+}
+
+CfgNode::~CfgNode()
+{
+  free_str(_name, F_OWN_NAME);
+  free_str(_value, F_OWN_VALUE);
+  free_str(_comment, F_OWN_COMMENT);
+  delete _values;
+  delete _lazy;
+  delete _index;
+}
+
+////// public functions
+CfgNode *
+CfgNode::createLazy(Cstore& cstore, const Cpath& path_comps, bool active)
+{
+  return new CfgNode(new LazyState(cstore, path_comps, active));
+}
+
+CfgNode *
+CfgNode::findChildNode(const char *name) const
+{
+  const nodes_vec_type& cnodes = getChildNodes();
+  if (cnodes.size() < C_INDEX_MIN_SIZE) {
+    for (size_t i = 0; i < cnodes.size(); i++) {
+      if (_child_key(cnodes[i]) == name) {
+        return cnodes[i];
       }
-      if (val) {
-        /* if parser got value for the invalid node, always treat it as
-         * "tag value" for simplicity.
-         */
-        _is_tag = true;
-        _is_value = true;
+    }
+    return NULL;
+  }
+  if (!_index) {
+    build_index();
+  }
+  size_t idx;
+  return (_index->find(name, idx) ? cnodes[idx] : NULL);
+}
+
+bool
+CfgNode::hasValue(const char *val) const
+{
+  const vector<string>& values = getValues();
+  if (values.size() < C_INDEX_MIN_SIZE) {
+    for (size_t i = 0; i < values.size(); i++) {
+      if (values[i] == val) {
+        return true;
       }
-      break;
     }
+    return false;
+  }
+  if (!_index) {
+    build_index();
+  }
+  size_t idx;
+  return _index->find(val, idx);
+}
+
+void
+CfgNode::setValue(const StrView& val)
+{
+  setFlag(F_HASHED, false);
+  set_str(_value, F_OWN_VALUE, val.str());
+  if (getParent()) {
+    // the value may be the key of this node in the parent's index
+    getParent()->drop_index();
+  }
+}
+
+void
+CfgNode::addMultiValue(const StrView& val)
+{
+  setFlag(F_HASHED, false);
+  drop_index();
+  if (!_values) {
+    _values = new vector<string>();
+  }
+  _values->push_back(val.str());
+}
+
+// order child nodes by tag value (tag node) or name
+struct ChildNodeLess {
+  ChildNodeLess(bool tag) : is_tag_node(tag) {}
+  bool operator()(const CfgNode *a, const CfgNode *b) const {
+    return (is_tag_node
+            ? Cstore::cmpNodeNames(a->getValue(), b->getValue()) < 0
+            : Cstore::cmpNodeNames(a->getName(), b->getName()) < 0);
+  }
+  bool is_tag_node;
+};
+
+void
+CfgNode::sortChildNodes()
+{
+  load_children();
+  setFlag(F_HASHED, false);
+  TreeNode<CfgNode>::sortChildNodes(ChildNodeLess(isTagNode()));
+  const nodes_vec_type& cnodes = TreeNode<CfgNode>::getChildNodes();
+  for (nodes_vec_type::const_iterator it = cnodes.begin();
+       it != cnodes.end(); ++it) {
+    (*it)->sortChildNodes();
+  }
+}
+
+////// private functions
+// a lazy node must be completely loaded before it is copied
+const CfgNode&
+CfgNode::loaded(const CfgNode& n)
+{
+  n.load_children();
+  return n;
+}
+
+void
+CfgNode::load_attrs()
+{
+  setFlag(F_LAZY_ATTRS, false);
+  if (!read_node(_lazy->cstore, _lazy->path, _lazy->active)) {
+    // no child nodes
+    setFlag(F_LAZY_CHILDREN, false);
+  }
+  release_lazy();
+}
+
+void
+CfgNode::load_child_nodes()
+{
+  load();
+  if (!flag(F_LAZY_CHILDREN)) {
+    return;
+  }
+  setFlag(F_LAZY_CHILDREN, false);
+  Cpath& path_comps = _lazy->path;
+  vector<string> cnodes;
+  if (read_child_names(_lazy->cstore, path_comps, _lazy->active, cnodes)) {
+    for (size_t i = 0; i < cnodes.size(); i++) {
+      path_comps.push(cnodes[i]);
+      addChildNode(createLazy(_lazy->cstore, path_comps, _lazy->active));
+      path_comps.pop();
+    }
+  }
+  release_lazy();
+}
 
-    break;
+void
+CfgNode::release_lazy()
+{
+  if (!flag(F_LAZY_ATTRS | F_LAZY_CHILDREN)) {
+    delete _lazy;
+    _lazy = 0;
   }
+}
+
+/* set up a node from the parser. a null template means the node is not
+ * valid. the typeless leaf flag depends on the template child nodes.
+ */
+void
+CfgNode::init_parsed(const StrView& name, const StrView& val,
+                     const StrView& comment, int deact,
+                     const tr1::shared_ptr<Ctemplate>& tmpl,
+                     bool leaf_typeless, bool tag_if_invalid)
+{
+  if (tmpl.get()) {
+    // got the def
+    setTmpl(tmpl);
+    setFlag(F_TAG, tmpl->isTag());
+    setFlag(F_LEAF, (!isTag() && !tmpl->isTypeless()));
 
-  // restore path_comps. also set value/name for both valid and invalid nodes.
-  if (val) {
-    if (_is_multi) {
-      _values.push_back(val);
+    // match constructor from cstore (leaf node never "value")
+    setFlag(F_VALUE, (tmpl->isValue() && !isLeaf()));
+    setFlag(F_MULTI, tmpl->isMulti());
+
+    /* XXX given the current definition of "default" (i.e., the
+     * "post-bug 1219" definition), the concept of "default" doesn't
+     * really apply to config files. however, if in the future we
+     * do go back to the original, simpler definition of "default"
+     * (which IMO is the right thing to do), the "default handling"
+     * here and elsewhere in the backend library will need to be
+     * revamped.
+     *
+     * in fact, in that case pretty much the only place that need to
+     * worry about "default" is in the "output" (i.e., "show")
+     * processing, and even there the only thing that needs to be
+     * done is to compare the current value with the "default value"
+     * in the template.
+     */
+    setFlag(F_DEFAULT, false);
+    setFlag(F_DEACTIVATED, deact);
+    setFlag(F_LEAF_TYPELESS, leaf_typeless);
+
+    if (!comment.isNull()) {
+      set_str(_comment, F_OWN_COMMENT, comment.str());
+    }
+  } else {
+    // not a valid node
+    setFlag(F_INVALID, true);
+    if (tag_if_invalid) {
+      /* this is only used when the parser is creating a "tag node". force
+       * the node to be tag since we don't have template for invalid node.
+       */
+      setFlag(F_TAG, true);
+    }
+    if (!val.isNull()) {
+      /* if parser got value for the invalid node, always treat it as
+       * "tag value" for simplicity.
+       */
+      setFlag(F_TAG, true);
+      setFlag(F_VALUE, true);
+    }
+  }
+
+  // set value/name for both valid and invalid nodes
+  if (!val.isNull()) {
+    if (isMulti()) {
+      addMultiValue(val);
     } else {
-      _value = val;
+      set_str(_value, F_OWN_VALUE, val.str());
     }
-    path_comps.pop();
   }
-  if (name && name[0]) {
-    _name = name;
-    path_comps.pop();
+  if (name.len > 0) {
+    set_str(_name, F_OWN_NAME, name.str());
   }
 }
 
-// for active/working config
-CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
-                 bool recursive)
-  : TreeNode<CfgNode>(),
-    _is_tag(false), _is_leaf(false), _is_multi(false), _is_value(false),
-    _is_default(false), _is_deactivated(false), _is_leaf_typeless(false),
-    _is_invalid(false), _exists(true)
+/* read the node at the specified path from the cstore (not including the
+ * child nodes). return false if the node cannot have child nodes.
+ */
+bool
+CfgNode::read_node(Cstore& cstore, Cpath& path_comps, bool active)
 {
   /* first get the def (only if path is not empty). if path is empty, i.e.,
    * "root", treat it as an intermediate node.
@@ -144,59 +494,73 @@ CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
       // got the def
       if (!cstore.cfgPathExists(path_comps, active)) {
         // path doesn't exist
-        _exists = false;
-        return;
+        setFlag(F_EXISTS, false);
+        return false;
       }
 
-      _is_value = getTmpl()->isValue();
-      _is_tag = getTmpl()->isTag();
-      _is_leaf = (!_is_tag && !getTmpl()->isTypeless());
-      _is_multi = getTmpl()->isMulti();
-      _is_default = cstore.cfgPathDefault(path_comps, active);
-      _is_deactivated = cstore.cfgPathDeactivated(path_comps, active);
-      cstore.cfgPathGetComment(path_comps, _comment, active);
-      // ignore return
+      setFlag(F_VALUE, getTmpl()->isValue());
+      setFlag(F_TAG, getTmpl()->isTag());
+      setFlag(F_LEAF, (!isTag() && !getTmpl()->isTypeless()));
+      setFlag(F_MULTI, getTmpl()->isMulti());
+      setFlag(F_DEFAULT, cstore.cfgPathDefault(path_comps, active));
+      setFlag(F_DEACTIVATED, cstore.cfgPathDeactivated(path_comps, active));
+      string comment;
+      if (cstore.cfgPathGetComment(path_comps, comment, active)) {
+        set_str(_comment, F_OWN_COMMENT, comment);
+      }
 
-      if (_is_leaf && _is_value) {
+      if (isLeaf() && isValue()) {
         /* "leaf value" so recursion should never reach here. if path is
          * specified by user, nothing further to do.
          */
-        return;
+        return false;
       }
     } else {
       // not a valid node
-      _is_invalid = true;
-      return;
+      setFlag(F_INVALID, true);
+      return false;
     }
   }
 
   // handle leaf node (note path_comps must be non-empty if this is leaf)
-  if (_is_leaf) {
-    _name = path_comps[path_comps.size() - 1];
-    if (_is_multi) {
+  if (isLeaf()) {
+    set_str(_name, F_OWN_NAME, path_comps[path_comps.size() - 1]);
+    if (isMulti()) {
       // multi-value node
-      cstore.cfgPathGetValuesDA(path_comps, _values, active, true);
+      vector<string> values;
+      cstore.cfgPathGetValuesDA(path_comps, values, active, true);
       // ignore return value
+      if (values.size() > 0) {
+        _values = new vector<string>();
+        _values->swap(values);
+      }
     } else {
       // single-value node
-      cstore.cfgPathGetValueDA(path_comps, _value, active, true);
+      string value;
+      cstore.cfgPathGetValueDA(path_comps, value, active, true);
       // ignore return value
+      set_str(_value, F_OWN_VALUE, value);
     }
-    return;
+    return false;
   }
 
   // handle intermediate (typeless) or tag
-  if (_is_value) {
+  if (isValue()) {
     // tag value
-    _name = path_comps[path_comps.size() - 2];
-    _value = path_comps[path_comps.size() - 1];
-  } else {
+    set_str(_name, F_OWN_NAME, path_comps[path_comps.size() - 2]);
+    set_str(_value, F_OWN_VALUE, path_comps[path_comps.size() - 1]);
+  } else if (path_comps.size() > 0) {
     // tag node or typeless node
-    _name = (path_comps.size() > 0 ? path_comps[path_comps.size() - 1] : "");
+    set_str(_name, F_OWN_NAME, path_comps[path_comps.size() - 1]);
   }
+  return true;
+}
 
-  // check child nodes
-  vector<string> cnodes;
+// return false if there are no child nodes
+bool
+CfgNode::read_child_names(Cstore& cstore, Cpath& path_comps, bool active,
+                          vector<string>& cnodes)
+{
   cstore.cfgPathGetChildNodesDA(path_comps, cnodes, active, true);
   if (cnodes.size() == 0) {
     // empty subtree. done.
@@ -204,22 +568,208 @@ CfgNode::CfgNode(Cstore& cstore, Cpath& path_comps, bool active,
     cstore.tmplGetChildNodes(path_comps, tcnodes);
     if (tcnodes.size() == 0) {
       // typeless leaf node
-      _is_leaf_typeless = true;
+      setFlag(F_LEAF_TYPELESS, true);
     }
-    return;
+    return false;
   }
+  return true;
+}
 
-  if (!recursive) {
-    // nothing further to do
-    return;
+/* compute the content hash of the subtree from the node itself and the
+ * hashes of the child nodes (in order). child nodes without a hash (i.e.,
+ * built in a parallel build) are hashed first.
+ */
+void
+CfgNode::compute_hash()
+{
+  uint64_t h = _hash_mix(0, (_flags & C_CONTENT_FLAGS));
+  h = _hash_str(h, *_name);
+  h = _hash_str(h, *_value);
+  h = _hash_str(h, *_comment);
+  const vector<string>& values = (_values ? *_values : _empty_values);
+  h = _hash_mix(h, values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    h = _hash_str(h, values[i]);
+  }
+  const nodes_vec_type& cnodes = TreeNode<CfgNode>::getChildNodes();
+  h = _hash_mix(h, cnodes.size());
+  for (nodes_vec_type::const_iterator it = cnodes.begin();
+       it != cnodes.end(); ++it) {
+    if (!(*it)->flag(F_HASHED)) {
+      (*it)->compute_hash();
+    }
+    h = _hash_mix(h, (*it)->_hash);
+  }
+  _hash = h;
+  setFlag(F_HASHED, true);
+}
+
+// index the child nodes, or the values of a multi-value node
+void
+CfgNode::build_index() const
+{
+  ChildIndex *index = new ChildIndex();
+  if (isLeaf()) {
+    const vector<string>& values = getValues();
+    for (size_t i = 0; i < values.size(); i++) {
+      index->add(values[i], i);
+    }
+  } else {
+    const nodes_vec_type& cnodes = getChildNodes();
+    for (size_t i = 0; i < cnodes.size(); i++) {
+      index->add(_child_key(cnodes[i]), i);
+    }
+  }
+  _index = index;
+}
+
+void
+CfgNode::drop_index() const
+{
+  if (_index) {
+    delete _index;
+    _index = 0;
+  }
+}
+
+/* build the child nodes in parallel if possible. return false if the
+ * caller should build them serially. the top of a (serial) build fans out
+ * all its child nodes if the subtree is large enough, i.e., it is the whole
+ * config or it has many child nodes. within a parallel build, large tag
+ * nodes fan out their values.
+ */
+bool
+CfgNode::build_parallel(Cstore& cstore, const Cpath& path_comps, bool active,
+                        const vector<string>& cnodes)
+{
+  if (_build_ctx) {
+    // running in a worker
+    if (!isTagNode() || cnodes.size() < C_PARALLEL_MIN_VALUES) {
+      return false;
+    }
+    submit_children(*_build_ctx, path_comps, cnodes);
+    return true;
+  }
+  if (_build_depth > 0) {
+    // already decided to build serially
+    return false;
+  }
+  if (cnodes.size() < 2
+      || (path_comps.size() > 0 && cnodes.size() < C_PARALLEL_MIN_CHILDREN)) {
+    // too small to be worth the threads and read views
+    return false;
+  }
+  size_t nthreads = get_build_threads();
+  if (nthreads < 2) {
+    return false;
+  }
+
+  BuildContext ctx(nthreads, active);
+  for (size_t i = 0; i < nthreads; i++) {
+    Cstore *view = cstore.createReadView();
+    if (!view) {
+      // not supported by the cstore
+      break;
+    }
+    ctx.views.push_back(view);
+  }
+  if (ctx.views.size() < nthreads) {
+    for (size_t i = 0; i < ctx.views.size(); i++) {
+      delete ctx.views[i];
+    }
+    return false;
+  }
+  CfgNodeArena *arena = CfgNodeArena::current();
+  if (arena) {
+    // arenas are not thread-safe. the caller's arena takes them over later.
+    for (size_t i = 0; i < nthreads; i++) {
+      ctx.arenas.push_back(new CfgNodeArena(arena->isMonotonic()));
+    }
   }
 
-  // recurse
+  submit_children(ctx, path_comps, cnodes);
+  ctx.pool.run();
+
+  for (size_t i = 0; i < ctx.views.size(); i++) {
+    delete ctx.views[i];
+  }
+  for (size_t i = 0; i < ctx.arenas.size(); i++) {
+    arena->adopt(ctx.arenas[i]);
+  }
+  return true;
+}
+
+// add a slot for each child node and a task to fill it in
+void
+CfgNode::submit_children(BuildContext& ctx, const Cpath& path_comps,
+                         const vector<string>& cnodes)
+{
+  size_t first = TreeNode<CfgNode>::numChildNodes();
+  addChildSlots(cnodes.size());
   for (size_t i = 0; i < cnodes.size(); i++) {
-    path_comps.push(cnodes[i]);
-    CfgNode *cn = new CfgNode(cstore, path_comps, active, recursive);
-    addChildNode(cn);
-    path_comps.pop();
+    Cpath cpath(path_comps);
+    cpath.push(cnodes[i]);
+    BuildContext *pctx = &ctx;
+    size_t idx = first + i;
+    ctx.pool.submit([this, pctx, idx, cpath](size_t worker) {
+      build_child(*pctx, worker, idx, cpath);
+    });
+  }
+}
+
+void
+CfgNode::build_child(BuildContext& ctx, size_t worker, size_t idx,
+                     const Cpath& path_comps)
+{
+  BuildContext *saved = _build_ctx;
+  _build_ctx = &ctx;
+  Cpath cpath(path_comps);
+  CfgNode *cn;
+  if (ctx.arenas.size() > 0) {
+    CfgNodeArena::Scope scope(*ctx.arenas[worker]);
+    cn = new CfgNode(*ctx.views[worker], cpath, ctx.active, true);
+  } else {
+    cn = new CfgNode(*ctx.views[worker], cpath, ctx.active, true);
+  }
+  setChildNode(idx, cn);
+  _build_ctx = saved;
+}
+
+size_t
+CfgNode::get_build_threads()
+{
+  const char *env = getenv(C_ENV_BUILD_THREADS);
+  size_t n = (env ? strtoul(env, NULL, 10)
+              : std::thread::hardware_concurrency());
+  return (n > C_MAX_BUILD_THREADS ? C_MAX_BUILD_THREADS : n);
+}
+
+/* set the specified string of the node. the string is interned in the
+ * current arena if there is one. otherwise the node keeps its own copy.
+ */
+void
+CfgNode::set_str(const string *& str, uint16_t own_flag, const string& val)
+{
+  free_str(str, own_flag);
+  if (val.empty()) {
+    str = &_empty_str;
+    return;
+  }
+  const string *s = CfgNodeArena::internString(val);
+  if (s) {
+    str = s;
+  } else {
+    str = new string(val);
+    setFlag(own_flag, true);
   }
 }
 
+void
+CfgNode::free_str(const string *& str, uint16_t own_flag)
+{
+  if (flag(own_flag)) {
+    delete str;
+    setFlag(own_flag, false);
+  }
+  str = &_empty_str;
+}
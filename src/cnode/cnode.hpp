@@ -20,42 +20,152 @@
 #include <vector>
 #include <string>
 
+#include <stdint.h>
+
 #include <cstore/cstore.hpp>
 #include <cnode/cnode-util.hpp>
+#include <cnode/cnode-arena.hpp>
 #include <commit/commit-algorithm.hpp>
 
 namespace cnode {
 
+class CfgImage;
+
 class CfgNode : public TreeNode<CfgNode>, public commit::CommitData {
 public:
-  // constructor for parser
-  CfgNode(cstore::Cpath& path_comps, char *name, char *val, char *comment,
+  /* constructor for parser. the strings are copied, so they can refer into
+   * the parser's input. a null value/comment means none.
+   */
+  CfgNode(cstore::Cpath& path_comps, const cstore::StrView& name,
+          const cstore::StrView& val, const cstore::StrView& comment,
           int deact, cstore::Cstore *cstore, bool tag_if_invalid = false);
-  // constructor for active/working config
+  /* same as above but with the template already looked up, along with
+   * whether the node is a typeless leaf (i.e., the template has no child
+   * nodes). this is used to look up each template only once per parse.
+   */
+  CfgNode(const cstore::StrView& name, const cstore::StrView& val,
+          const cstore::StrView& comment, int deact,
+          const std::tr1::shared_ptr<cstore::Ctemplate>& tmpl,
+          bool leaf_typeless, bool tag_if_invalid = false);
+  /* constructor for active/working config. a recursive build is done in
+   * parallel if the cstore supports read views (see
+   * Cstore::createReadView()): the top-level child nodes and the values of
+   * large tag nodes are built by a pool of workers. the number of workers
+   * can be set with the C_ENV_BUILD_THREADS environment variable (1 means
+   * serial build).
+   */
   CfgNode(cstore::Cstore& cstore, cstore::Cpath& path_comps,
           bool active = false, bool recursive = true);
 
-  ~CfgNode() {};
+  /* lazily loaded active/working config. the attributes and the child
+   * nodes of each node are only read from the cstore when they are first
+   * accessed, so the cstore must outlive the tree. the child nodes are
+   * allocated from the arena that is current at the time. note that
+   * accessing a lazy tree modifies it, i.e., a lazy tree must not be
+   * accessed from multiple threads.
+   */
+  static CfgNode *createLazy(cstore::Cstore& cstore,
+                             const cstore::Cpath& path_comps,
+                             bool active = false);
+
+  // copies share the child nodes (see getCommitTree())
+  CfgNode(const CfgNode& n);
+
+  ~CfgNode();
+
+  // nodes are allocated from the current arena (see cnode-arena.hpp)
+  static void *operator new(size_t size) {
+    return CfgNodeArena::allocate(size);
+  }
+  static void operator delete(void *p) {
+    CfgNodeArena::deallocate(p);
+  }
+
+  bool isTag() const { return attr(F_TAG); }
+  bool isTagNode() const { return (attr(F_TAG) && !flag(F_VALUE)); }
+  bool isLeaf() const { return attr(F_LEAF); }
+  bool isMulti() const { return attr(F_MULTI); }
+  bool isValue() const { return attr(F_VALUE); }
+  bool isDefault() const { return attr(F_DEFAULT); }
+  bool isDeactivated() const { return attr(F_DEACTIVATED); }
+  bool isLeafTypeless() const {
+    // depends on the child nodes
+    load_children();
+    return flag(F_LEAF_TYPELESS);
+  }
+  bool isInvalid() const { return attr(F_INVALID); }
+  bool isEmpty() const { return (!attr(F_LEAF) && numChildNodes() == 0); }
+  bool exists() const { return attr(F_EXISTS); }
+
+  const std::string& getName() const { load(); return *_name; }
+  const std::string& getValue() const { load(); return *_value; }
+  const std::vector<std::string>& getValues() const {
+    load();
+    return (_values ? *_values : _empty_values);
+  }
+  const std::string& getComment() const { load(); return *_comment; }
+
+  // these make sure the child nodes of a lazy node are loaded
+  const nodes_vec_type& getChildNodes() const {
+    load_children();
+    return TreeNode<CfgNode>::getChildNodes();
+  }
+  size_t numChildNodes() const {
+    load_children();
+    return TreeNode<CfgNode>::numChildNodes();
+  }
+  CfgNode *childAt(size_t idx) {
+    load_children();
+    return TreeNode<CfgNode>::childAt(idx);
+  }
+
+  // these make sure the template of a lazy node is loaded
+  std::tr1::shared_ptr<cstore::Ctemplate> getTmpl() const {
+    load();
+    return CommitData::getTmpl();
+  }
+  const vtw_def *getDef() const { load(); return CommitData::getDef(); }
+  unsigned int getPriority() const {
+    load();
+    return CommitData::getPriority();
+  }
+  void setPriority(unsigned int p) { load(); CommitData::setPriority(p); }
+  const vtw_node *getActions(vtw_act_type act, bool raw = false) const {
+    load();
+    return CommitData::getActions(act, raw);
+  }
+  bool isBeginEndNode() const {
+    load();
+    return CommitData::isBeginEndNode();
+  }
+
+  /* put the child nodes of the subtree in the canonical order, i.e., the
+   * order of the config from the cstore (see Cstore::cmpNodeNames()).
+   */
+  void sortChildNodes();
 
-  bool isTag() const { return _is_tag; }
-  bool isTagNode() const { return (_is_tag && !_is_value); }
-  bool isLeaf() const { return _is_leaf; }
-  bool isMulti() const { return _is_multi; }
-  bool isValue() const { return _is_value; }
-  bool isDefault() const { return _is_default; }
-  bool isDeactivated() const { return _is_deactivated; }
-  bool isLeafTypeless() const { return _is_leaf_typeless; }
-  bool isInvalid() const { return _is_invalid; }
-  bool isEmpty() const { return (!_is_leaf && numChildNodes() == 0); }
-  bool exists() const { return _exists; }
+  /* find the child node with the specified name (or value if the child
+   * is a tag value). return NULL if not found. nodes with many child nodes
+   * (or values, see hasValue()) build an index when first searched, i.e.,
+   * searching modifies the node.
+   */
+  CfgNode *findChildNode(const char *name) const;
+  // whether a multi-value node has the specified value
+  bool hasValue(const char *val) const;
 
-  const std::string& getName() const { return _name; }
-  const std::string& getValue() const { return _value; }
-  const std::vector<std::string>& getValues() const { return _values; }
-  const std::string& getComment() const { return _comment; }
+  void addMultiValue(const cstore::StrView& val);
+  void setValue(const cstore::StrView& val);
 
-  void addMultiValue(char *val) { _values.push_back(val); }
-  void setValue(char *val) { _value = val; }
+  /* content hash of the subtree rooted at this node. it is computed
+   * bottom-up when a tree is built from the cstore (not available for
+   * other trees, e.g., lazy trees, parsed trees, and copies).
+   */
+  bool hasSubtreeHash() const { return flag(F_HASHED); }
+  uint64_t getSubtreeHash() const { return _hash; }
+  // whether the two subtrees are known to be identical
+  bool sameSubtree(const CfgNode& n) const {
+    return (flag(F_HASHED) && n.flag(F_HASHED) && _hash == n._hash);
+  }
 
   // XXX testing
   void rprint(size_t lvl) {
@@ -70,19 +180,120 @@ public:
   }
 
 private:
-  bool _is_tag;
-  bool _is_leaf;
-  bool _is_multi;
-  bool _is_value;
-  bool _is_default;
-  bool _is_deactivated;
-  bool _is_leaf_typeless;
-  bool _is_invalid;
-  bool _exists;
-  std::string _name;
-  std::string _value;
-  std::vector<std::string> _values;
-  std::string _comment;
+  // reads and writes the node internals (see cnode-image.hpp)
+  friend class CfgImage;
+
+  /* node attributes are packed into one word. the "own" bits indicate
+   * that the corresponding string is a private copy (as opposed to a
+   * string interned in the arena, see CfgNodeArena::internString()).
+   */
+  enum {
+    F_TAG = 0x0001,
+    F_LEAF = 0x0002,
+    F_MULTI = 0x0004,
+    F_VALUE = 0x0008,
+    F_DEFAULT = 0x0010,
+    F_DEACTIVATED = 0x0020,
+    F_LEAF_TYPELESS = 0x0040,
+    F_INVALID = 0x0080,
+    F_EXISTS = 0x0100,
+    F_OWN_NAME = 0x0200,
+    F_OWN_VALUE = 0x0400,
+    F_OWN_COMMENT = 0x0800,
+    F_LAZY_ATTRS = 0x1000,
+    F_LAZY_CHILDREN = 0x2000,
+    F_HASHED = 0x4000
+  };
+  // the flags that are part of the content of a node
+  static const uint16_t C_CONTENT_FLAGS = 0x01ff;
+
+  // what is needed to load a lazy node
+  struct LazyState;
+  // shared by the workers of a parallel build
+  struct BuildContext;
+  // index for findChildNode() and hasValue()
+  struct ChildIndex;
+
+  static const char *C_ENV_BUILD_THREADS;
+  static const size_t C_MAX_BUILD_THREADS = 16;
+  // tag nodes with at least this many values are split among the workers
+  static const size_t C_PARALLEL_MIN_VALUES = 32;
+  /* a build below the root needs at least this many child nodes to run in
+   * parallel. smaller subtrees (e.g., a single interface) are built serially.
+   */
+  static const size_t C_PARALLEL_MIN_CHILDREN = 32;
+  // nodes with at least this many child nodes (or values) are indexed
+  static const size_t C_INDEX_MIN_SIZE = 64;
+
+  // parallel build this thread is working on (if any)
+  static __thread BuildContext *_build_ctx;
+  // nesting level of a serial build on this thread
+  static __thread unsigned int _build_depth;
+
+  static const std::string _empty_str;
+  static const std::vector<std::string> _empty_values;
+
+  uint16_t _flags;
+  uint64_t _hash;
+  const std::string *_name;
+  const std::string *_value;
+  const std::string *_comment;
+  // only allocated for multi-value nodes with values
+  std::vector<std::string> *_values;
+  // only allocated until a lazy node is completely loaded
+  LazyState *_lazy;
+  // only allocated when a large node is searched
+  mutable ChildIndex *_index;
+
+  // constructor for lazy node (see createLazy())
+  CfgNode(LazyState *lazy);
+  // constructor for node loaded from an image (see CfgImage)
+  explicit CfgNode(uint16_t flags);
+
+  bool flag(uint16_t f) const { return ((_flags & f) != 0); }
+  bool attr(uint16_t f) const { load(); return flag(f); }
+  void load() const {
+    if (flag(F_LAZY_ATTRS)) {
+      const_cast<CfgNode *>(this)->load_attrs();
+    }
+  }
+  void load_children() const {
+    if (flag(F_LAZY_ATTRS | F_LAZY_CHILDREN)) {
+      const_cast<CfgNode *>(this)->load_child_nodes();
+    }
+  }
+  static const CfgNode& loaded(const CfgNode& n);
+  void init_parsed(const cstore::StrView& name, const cstore::StrView& val,
+                   const cstore::StrView& comment, int deact,
+                   const std::tr1::shared_ptr<cstore::Ctemplate>& tmpl,
+                   bool leaf_typeless, bool tag_if_invalid);
+  void load_attrs();
+  void load_child_nodes();
+  void release_lazy();
+  void compute_hash();
+  void build_index() const;
+  void drop_index() const;
+  void childNodesChanged() { drop_index(); }
+  bool read_node(cstore::Cstore& cstore, cstore::Cpath& path_comps,
+                 bool active);
+  bool read_child_names(cstore::Cstore& cstore, cstore::Cpath& path_comps,
+                        bool active, std::vector<std::string>& cnodes);
+  bool build_parallel(cstore::Cstore& cstore, const cstore::Cpath& path_comps,
+                      bool active, const std::vector<std::string>& cnodes);
+  void submit_children(BuildContext& ctx, const cstore::Cpath& path_comps,
+                       const std::vector<std::string>& cnodes);
+  void build_child(BuildContext& ctx, size_t worker, size_t idx,
+                   const cstore::Cpath& path_comps);
+  static size_t get_build_threads();
+  void setFlag(uint16_t f, bool v) {
+    _flags = (v ? (_flags | f) : (_flags & ~f));
+  }
+  void set_str(const std::string *& str, uint16_t own_flag,
+               const std::string& val);
+  void free_str(const std::string *& str, uint16_t own_flag);
+
+  // not assignable
+  CfgNode& operator=(const CfgNode& n);
 };
 
 } // namespace cnode
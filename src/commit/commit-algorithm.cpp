@@ -188,7 +188,8 @@ _get_commit_prio_subtrees(CfgNode *sroot, PrioNode& parent)
 
   PrioNode *pn = &parent;
   // need a local copy since nodes can be detached
-  vector<CfgNode *> cnodes = sroot->getChildNodes();
+  vector<CfgNode *> cnodes(sroot->getChildNodes().begin(),
+                           sroot->getChildNodes().end());
   if (sroot->getPriority() && (sroot->isValue() || !sroot->isTag())) {
     // enforce hierarchical constraint
     unsigned int prio = sroot->getPriority();
@@ -558,8 +559,8 @@ _commit_check_cfg_node(Cstore& cs, CfgNode *node, CommittedPathListT& clist)
       // check if an immediate child node has changed.
       // if so do the syntax act here
       // This puts back the pre-larkspur behavior that features expect to happen.
-      vector <CfgNode *> childNodes;
-      childNodes = nodelist[i]->getChildNodes();
+      const CfgNode::nodes_vec_type& childNodes
+        = nodelist[i]->getChildNodes();
       for (size_t j = 0; j < childNodes.size(); j++){
         if (childNodes[j]->getCommitState() != COMMIT_STATE_UNCHANGED) {
           if (!_exec_node_actions(cs, *(nodelist[i]), syntax_act)) {
@@ -856,125 +857,156 @@ _execute_hooks(CommitHook hook)
 
 
 ////// class CommitData
+struct CommitData::Info {
+  Info()
+    : _commit_state(COMMIT_STATE_UNCHANGED), _commit_default(false, false),
+      _commit_create_failed(false), _commit_child_delete_failed(false),
+      _commit_subtree_changed(false) {}
+
+  Cpath _commit_path;
+  CommitState _commit_state;
+  vector<string> _commit_values;
+  vector<CommitState> _commit_values_states;
+  pair<string, string> _commit_value;
+  pair<bool, bool> _commit_default;
+  bool _commit_create_failed;
+  bool _commit_child_delete_failed;
+  bool _commit_subtree_changed;
+};
+
 CommitData::CommitData()
-  : _commit_state(COMMIT_STATE_UNCHANGED), _commit_create_failed(false),
-    _commit_child_delete_failed(false), _commit_subtree_changed(false)
+  : _def(), _info(0)
+{
+}
+
+CommitData::CommitData(const CommitData& d)
+  : _def(d._def), _info(d._info ? new Info(*d._info) : 0)
+{
+}
+
+CommitData::~CommitData()
 {
+  delete _info;
 }
 
 // member setters
 void
 CommitData::setCommitState(CommitState s)
 {
-  _commit_state = s;
+  if (!_info && s == COMMIT_STATE_UNCHANGED) {
+    // default. don't allocate.
+    return;
+  }
+  info()->_commit_state = s;
 }
 
 void
 CommitData::setCommitPath(const Cpath& p, bool is_val, const string& val,
                           const string& name)
 {
-  Cpath cp(p);
+  Cpath& cp = info()->_commit_path;
+  cp = p;
   if (is_val) {
     cp.push(val);
   } else if (name.size() > 0) {
     cp.push(name);
   }
-  _commit_path = cp;
 }
 
 void
 CommitData::setCommitMultiValues(const vector<string>& values,                                                   const vector<CommitState>& states)
 {
-  _commit_values = values;
-  _commit_values_states = states;
+  info()->_commit_values = values;
+  info()->_commit_values_states = states;
 }
 
 void
 CommitData::setCommitValue(const string& val1, const string& val2,                                         bool def1, bool def2)
 {
-  _commit_value.first = val1;
-  _commit_value.second = val2;
-  _commit_default.first = def1;
-  _commit_default.second = def2;
+  Info *i = info();
+  i->_commit_value.first = val1;
+  i->_commit_value.second = val2;
+  i->_commit_default.first = def1;
+  i->_commit_default.second = def2;
 }
 
 void
 CommitData::setCommitChildDeleteFailed()
 {
-  _commit_child_delete_failed = true;
+  info()->_commit_child_delete_failed = true;
 }
 
 void
 CommitData::setCommitCreateFailed()
 {
-  _commit_create_failed = true;
+  info()->_commit_create_failed = true;
 }
 
 void
 CommitData::setCommitSubtreeChanged()
 {
-  _commit_subtree_changed = true;
+  info()->_commit_subtree_changed = true;
 }
 
 // member getters
 CommitState
 CommitData::getCommitState() const
 {
-  return _commit_state;
+  return (_info ? _info->_commit_state : COMMIT_STATE_UNCHANGED);
 }
 
 Cpath
 CommitData::getCommitPath() const
 {
-  return _commit_path;
+  return (_info ? _info->_commit_path : Cpath());
 }
 
 size_t
 CommitData::numCommitMultiValues() const
 {
-  return _commit_values.size();
+  return (_info ? _info->_commit_values.size() : 0);
 }
 
 string
 CommitData::commitMultiValueAt(size_t idx) const
 {
-  return _commit_values[idx];
+  return _info->_commit_values[idx];
 }
 
 CommitState
 CommitData::commitMultiStateAt(size_t idx) const
 {
-  return _commit_values_states[idx];
+  return _info->_commit_values_states[idx];
 }
 
 string
 CommitData::commitValueBefore() const
 {
-  return _commit_value.first;
+  return (_info ? _info->_commit_value.first : "");
 }
 
 string
 CommitData::commitValueAfter() const
 {
-  return _commit_value.second;
+  return (_info ? _info->_commit_value.second : "");
 }
 
 bool
 CommitData::commitChildDeleteFailed() const
 {
-  return _commit_child_delete_failed;
+  return (_info && _info->_commit_child_delete_failed);
 }
 
 bool
 CommitData::commitCreateFailed() const
 {
-  return _commit_create_failed;
+  return (_info && _info->_commit_create_failed);
 }
 
 bool
 CommitData::commitSubtreeChanged() const
 {
-  return _commit_subtree_changed;
+  return (_info && _info->_commit_subtree_changed);
 }
 
 // member functions for tmpl stuff
@@ -1029,6 +1061,16 @@ CommitData::isBeginEndNode() const
   return (getActions(begin_act) || getActions(end_act));
 }
 
+// private functions
+CommitData::Info *
+CommitData::info()
+{
+  if (!_info) {
+    _info = new Info();
+  }
+  return _info;
+}
+
 
 ////// class PrioNode
 PrioNode::PrioNode(CfgNode *n)
@@ -1179,6 +1221,10 @@ commit::getCommitTree(CfgNode *cfg1, CfgNode *cfg2, const Cpath& cur_path)
     fprintf(stderr, "getCommitTree error (both config NULL)\n");
     exit(1);
   }
+  if (cfg1 && cfg2 && cfg1->sameSubtree(*cfg2)) {
+    // identical subtrees => nothing to commit
+    return NULL;
+  }
 
   bool is_leaf = false;
   CfgNode *cn = _get_commit_leaf_node(cfg1, cfg2, cur_path, is_leaf);
@@ -1364,7 +1410,7 @@ commit::doCommit(Cstore& cs, CfgNode& cfg1, CfgNode& cfg2)
     ret = cs.markSessionUnsaved();
   }
 
-  sync();
+  cs.syncCommittedConfig();
 
   setenv("COMMIT_STATUS", cst, 1);
   _execute_hooks(POST_COMMIT);
@@ -59,7 +59,8 @@ enum CommitHook {
 class CommitData {
 public:
   CommitData();
-  virtual ~CommitData() {}
+  CommitData(const CommitData& d);
+  ~CommitData();
 
   // setters
   void setCommitState(CommitState s);
@@ -95,16 +96,19 @@ public:
   bool isBeginEndNode() const;
 
 private:
+  /* the commit state of a node is kept in a separate record that is only
+   * allocated when the node is part of a commit tree. config trees that
+   * are just shown/compared/loaded only carry the (NULL) pointer.
+   */
+  struct Info;
+
   std::tr1::shared_ptr<cstore::Ctemplate> _def;
-  Cpath _commit_path;
-  CommitState _commit_state;
-  std::vector<std::string> _commit_values;
-  std::vector<CommitState> _commit_values_states;
-  std::pair<std::string, std::string> _commit_value;
-  std::pair<bool, bool> _commit_default;
-  bool _commit_create_failed;
-  bool _commit_child_delete_failed;
-  bool _commit_subtree_changed;
+  Info *_info;
+
+  Info *info();
+
+  // not assignable
+  CommitData& operator=(const CommitData& d);
 };
 
 class PrioNode : public TreeNode<PrioNode> {
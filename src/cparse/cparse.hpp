@@ -22,9 +22,22 @@
 
 namespace cparse {
 
+/* the parser is reentrant, i.e., different files can be parsed
+ * concurrently (with a different cstore each, e.g., a read view). the
+ * file or stream is read into memory first.
+ */
 cnode::CfgNode *parse_file(FILE *fin, cstore::Cstore& cs);
 cnode::CfgNode *parse_file(const char *fname, cstore::Cstore& cs);
 
+/* only build the subtree at the specified path (and the nodes on the path
+ * to it), i.e., the nodes outside of it are skipped without looking up
+ * their templates. the tree is still rooted at the config root.
+ */
+cnode::CfgNode *parse_file(FILE *fin, cstore::Cstore& cs,
+                           const cstore::Cpath& path);
+cnode::CfgNode *parse_file(const char *fname, cstore::Cstore& cs,
+                           const cstore::Cpath& path);
+
 } // namespace cparse
 
 #endif /* _CPARSE_HPP_ */
@@ -1,8 +1,15 @@
 #ifndef _CPARSE_DEF_H_
 #define _CPARSE_DEF_H_
 
+#include <cstore/util.hpp>
+
+namespace cparse {
+struct ParseState;
+}
+
+// token strings refer into the input (see ConfigLexer)
 typedef struct {
-  char *str;
+  cstore::StrView str;
   int deactivated;
 } lex_ret_t;
 
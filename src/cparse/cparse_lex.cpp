@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cparse_lex.hpp"
+#include "cparse.h"
+
+using namespace cparse;
+using namespace cstore;
+
+////// constants
+// returned by the state functions when no token has been produced yet
+static const int C_NO_TOKEN = -1;
+
+////// static
+// "space" does not include newline, which ends a node
+static inline bool
+_is_space(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v');
+}
+
+static inline bool
+_is_id_char(char c)
+{
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+          || (c >= '0' && c <= '9') || c == '-' || c == '_');
+}
+
+////// constructors/destructors
+ConfigLexer::ConfigLexer(const char *buf, size_t len)
+  : _cur(buf), _end(buf + len), _state(S_INITIAL), _lineno(1),
+    _deactivated(false), _text("")
+{
+}
+
+////// public functions
+int
+ConfigLexer::lex(lex_ret_t& lval)
+{
+  while (_cur < _end) {
+    int token;
+    switch (_state) {
+    case S_ID:
+      token = lex_id(lval);
+      break;
+    case S_VALUE:
+      token = lex_value(lval);
+      break;
+    default:
+      token = lex_initial(lval);
+      break;
+    }
+    if (token != C_NO_TOKEN) {
+      return token;
+    }
+  }
+  return 0;
+}
+
+////// private functions
+int
+ConfigLexer::lex_initial(lex_ret_t& lval)
+{
+  const char *start = _cur;
+  char c = *_cur;
+  if (c == '/' && (_cur + 1) < _end && _cur[1] == '*') {
+    _cur += 2;
+    return lex_comment(lval);
+  }
+  if (c == '/' && (_cur + 1) < _end && _cur[1] == '/') {
+    // to the end of the line
+    while (_cur < _end && *_cur != '\n') {
+      ++_cur;
+    }
+    return C_NO_TOKEN;
+  }
+
+  ++_cur;
+  if (c == '!') {
+    // applies to the next node
+    _deactivated = true;
+    return C_NO_TOKEN;
+  }
+  if (_is_space(c)) {
+    return C_NO_TOKEN;
+  }
+  if (c == '\n') {
+    ++_lineno;
+    return C_NO_TOKEN;
+  }
+  if (c == '}') {
+    _deactivated = false;
+    return ret_token(RIGHTB, start, lval);
+  }
+  if (_is_id_char(c)) {
+    while (_cur < _end && _is_id_char(*_cur)) {
+      ++_cur;
+    }
+    lval.deactivated = _deactivated;
+    _deactivated = false;
+    _state = S_ID;
+    return ret_token(NODE, start, lval);
+  }
+  _cur = start;
+  return syntax_error();
+}
+
+/* after a node name, there can be a value (separated by space and an
+ * optional ":"), the start of the child nodes, or the end of the line.
+ */
+int
+ConfigLexer::lex_id(lex_ret_t& lval)
+{
+  const char *p = _cur;
+  bool colon = (*p == ':');
+  if (colon) {
+    ++p;
+  }
+  const char *q = p;
+  while (q < _end && _is_space(*q)) {
+    ++q;
+  }
+  bool more = (q < _end && *q != '{' && *q != '\n');
+  if (q > p && (more || !colon || (q - p) > 1)) {
+    /* values follow (or just trailing space). note that a ":" followed by
+     * a single space at the end of the line is not allowed.
+     */
+    _cur = q;
+    _state = S_VALUE;
+    return C_NO_TOKEN;
+  }
+  if (colon) {
+    return syntax_error();
+  }
+
+  if (*_cur == '{') {
+    const char *start = _cur++;
+    _state = S_INITIAL;
+    return ret_token(LEFTB, start, lval);
+  }
+  if (*_cur == '\n') {
+    ++_cur;
+    ++_lineno;
+    _state = S_INITIAL;
+    return C_NO_TOKEN;
+  }
+  return syntax_error();
+}
+
+int
+ConfigLexer::lex_value(lex_ret_t& lval)
+{
+  const char *start = _cur;
+  char c = *_cur;
+  if (_is_space(c)) {
+    ++_cur;
+    return C_NO_TOKEN;
+  }
+  if (c == '"') {
+    ++_cur;
+    return lex_quoted(lval);
+  }
+  if (c == '{') {
+    ++_cur;
+    _state = S_INITIAL;
+    return ret_token(LEFTB, start, lval);
+  }
+  if (c == '\n') {
+    ++_cur;
+    ++_lineno;
+    _state = S_INITIAL;
+    return C_NO_TOKEN;
+  }
+
+  // unquoted value
+  while (_cur < _end && *_cur != '{' && *_cur != '\n' && !_is_space(*_cur)) {
+    ++_cur;
+  }
+  return ret_token(VALUE, start, lval);
+}
+
+// after the "/*"
+int
+ConfigLexer::lex_comment(lex_ret_t& lval)
+{
+  const char *start = _cur;
+  while (_cur < _end) {
+    if (*_cur == '*' && (_cur + 1) < _end && _cur[1] == '/') {
+      // strip the leading and trailing space
+      const char *b = start;
+      const char *e = _cur;
+      if (e > b && e[-1] == ' ') {
+        --e;
+      }
+      if (e > b && *b == ' ') {
+        ++b;
+      }
+      _cur += 2;
+      _text = lval.str = StrView(b, e - b);
+      return COMMENT;
+    }
+    if (*_cur == '\n') {
+      ++_lineno;
+    }
+    ++_cur;
+  }
+  // unterminated comment is ignored
+  return 0;
+}
+
+// after the opening quote. the value can span multiple lines.
+int
+ConfigLexer::lex_quoted(lex_ret_t& lval)
+{
+  const char *start = _cur;
+  while (_cur < _end) {
+    char c = *_cur;
+    if (c == '"') {
+      _text = lval.str = StrView(start, _cur - start);
+      ++_cur;
+      return VALUE;
+    }
+    if (c == '\\') {
+      if ((_cur + 2) < _end && _cur[1] == '"' && _cur[2] == '\n') {
+        /* backslash at the end of the value, i.e., "...\" at the end of
+         * the line. the value includes the backslash.
+         */
+        _text = lval.str = StrView(start, _cur + 1 - start);
+        _cur += 3;
+        ++_lineno;
+        _state = S_INITIAL;
+        return VALUE;
+      }
+      if ((_cur + 1) == _end || _cur[1] == '\n') {
+        return syntax_error();
+      }
+      // escape sequence is kept as is
+      _cur += 2;
+      continue;
+    }
+    if (c == '\n') {
+      ++_lineno;
+    }
+    ++_cur;
+  }
+  // unterminated string is ignored
+  return 0;
+}
+
+int
+ConfigLexer::ret_token(int token, const char *start, lex_ret_t& lval)
+{
+  _text = lval.str = StrView(start, _cur - start);
+  return token;
+}
+
+// the offending character is consumed
+int
+ConfigLexer::syntax_error()
+{
+  _text = StrView(_cur, 1);
+  ++_cur;
+  return SYNTAX_ERROR;
+}
+
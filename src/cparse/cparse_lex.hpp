@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CPARSE_LEX_HPP_
+#define _CPARSE_LEX_HPP_
+#include <cstddef>
+
+#include <cstore/util.hpp>
+#include "cparse_def.h"
+
+namespace cparse {
+
+/* scanner for config files. the whole input is in a buffer (normally the
+ * file read into memory), and the token strings are views into the buffer,
+ * i.e., the buffer must outlive them. nothing is copied and the buffer is not
+ * modified (it does not need to be NUL-terminated).
+ *
+ * all state is in the object, so different files can be scanned
+ * concurrently. the tokens are the same as those of the original flex
+ * scanner (cparse_lex.l): quoted values are returned as is between the
+ * quotes (including any backslash escapes), and a comment is returned
+ * without the leading and trailing space.
+ */
+class ConfigLexer {
+public:
+  ConfigLexer(const char *buf, size_t len);
+
+  // return the next token (0 at end of input) and set its value
+  int lex(lex_ret_t& lval);
+
+  // for error messages
+  int lineNo() const { return _lineno; }
+  const cstore::StrView& text() const { return _text; }
+
+private:
+  enum State {
+    S_INITIAL,
+    // after a node name
+    S_ID,
+    // after a node name and space, i.e., expecting value(s)
+    S_VALUE
+  };
+
+  const char *_cur;
+  const char *_end;
+  State _state;
+  int _lineno;
+  bool _deactivated;
+  // text of the last token
+  cstore::StrView _text;
+
+  int lex_initial(lex_ret_t& lval);
+  int lex_id(lex_ret_t& lval);
+  int lex_value(lex_ret_t& lval);
+  int lex_comment(lex_ret_t& lval);
+  int lex_quoted(lex_ret_t& lval);
+  int ret_token(int token, const char *start, lex_ret_t& lval);
+  int syntax_error();
+};
+
+} // end namespace cparse
+
+#endif /* _CPARSE_LEX_HPP_ */
+
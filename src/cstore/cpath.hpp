@@ -35,6 +35,7 @@ public:
 
   void push(const char *comp) { _data.push_back(comp); };
   void push(const std::string& comp) { _data.push_back(comp.c_str()); };
+  void push(const StrView& comp) { _data.push_back(comp.data, comp.len); };
   void pop() { _data.pop_back(); };
   void pop(std::string& last) { _data.pop_back(last); };
   void clear() { _data.assign("", 0); };
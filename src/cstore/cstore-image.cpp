@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <sstream>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstore/cstore-image.hpp>
+
+namespace cstore { // begin namespace cstore
+
+////// constants
+static const char C_IMAGE_MAGIC[8] = { 'V', 'Y', 'C', 'F', 'G', 'I', 'M', 'G' };
+static const uint32_t C_IMAGE_VERSION = 1;
+
+// node flags
+static const uint32_t NF_VALUE = 0x01;
+static const uint32_t NF_COMMENT = 0x02;
+static const uint32_t NF_DEACTIVATED = 0x04;
+static const uint32_t NF_DEFAULT = 0x08;
+
+struct ActiveImage::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_nodes;
+  uint64_t generation;
+  uint32_t num_values;
+  uint32_t strs_len;
+};
+
+struct ActiveImage::Node {
+  uint32_t name_off;
+  uint32_t name_len;
+  uint32_t first_child;
+  uint32_t num_children;
+  uint32_t first_value;
+  uint32_t num_values;
+  uint32_t comment_off;
+  uint32_t comment_len;
+  uint32_t flags;
+};
+
+struct ActiveImage::StrRef {
+  uint32_t off;
+  uint32_t len;
+};
+
+////// static
+static bool
+_node_name_less(const tr1::shared_ptr<ActiveImageNode>& a,
+                const tr1::shared_ptr<ActiveImageNode>& b)
+{
+  return (a->name < b->name);
+}
+
+static uint32_t
+_add_str(string& strs, const string& s, uint32_t& len)
+{
+  uint32_t off = strs.size();
+  strs.append(s);
+  len = s.size();
+  return off;
+}
+
+static bool
+_write_all(int fd, const char *data, size_t len)
+{
+  size_t done = 0;
+  while (done < len) {
+    ssize_t r = write(fd, data + done, len - done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+////// constructor/destructor
+ActiveImage::ActiveImage()
+  : _file(), _base(0), _size(0), _dev(0), _ino(0)
+{
+}
+
+ActiveImage::~ActiveImage()
+{
+  close();
+}
+
+////// public functions
+/* write the image of the specified tree and atomically replace the file.
+ * return false if fail (in which case the file is not touched).
+ */
+bool
+ActiveImage::publish(const string& file, const ActiveImageNode& root)
+{
+  // generation continues from the previous image
+  uint64_t gen = 1;
+  {
+    ActiveImage old;
+    if (old.open(file)) {
+      gen = old.getGeneration() + 1;
+    }
+  }
+
+  vector<Node> nodes;
+  vector<StrRef> vals;
+  string strs;
+  vector<const ActiveImageNode *> queue(1, &root);
+  nodes.push_back(Node());
+  // breadth-first so that the children of each node are contiguous
+  for (size_t i = 0; i < queue.size(); i++) {
+    const ActiveImageNode *n = queue[i];
+    Node rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.name_off = _add_str(strs, n->name, rec.name_len);
+    if (n->has_value) {
+      rec.flags |= NF_VALUE;
+      rec.first_value = vals.size();
+      rec.num_values = n->values.size();
+      for (size_t j = 0; j < n->values.size(); j++) {
+        StrRef v;
+        v.off = _add_str(strs, n->values[j], v.len);
+        vals.push_back(v);
+      }
+    }
+    if (n->has_comment) {
+      rec.flags |= NF_COMMENT;
+      rec.comment_off = _add_str(strs, n->comment, rec.comment_len);
+    }
+    rec.flags |= ((n->deactivated ? NF_DEACTIVATED : 0)
+                  | (n->is_default ? NF_DEFAULT : 0));
+
+    vector<tr1::shared_ptr<ActiveImageNode> > cnodes(n->children);
+    sort(cnodes.begin(), cnodes.end(), _node_name_less);
+    rec.first_child = queue.size();
+    rec.num_children = cnodes.size();
+    for (size_t j = 0; j < cnodes.size(); j++) {
+      queue.push_back(cnodes[j].get());
+      nodes.push_back(Node());
+    }
+    nodes[i] = rec;
+  }
+
+  Header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, C_IMAGE_MAGIC, sizeof(hdr.magic));
+  hdr.version = C_IMAGE_VERSION;
+  hdr.num_nodes = nodes.size();
+  hdr.generation = gen;
+  hdr.num_values = vals.size();
+  hdr.strs_len = strs.size();
+
+  std::ostringstream tmp;
+  tmp << file << ".tmp." << getpid();
+  int fd = ::open(tmp.str().c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ret = (_write_all(fd, reinterpret_cast<const char *>(&hdr),
+                         sizeof(hdr))
+              && _write_all(fd, reinterpret_cast<const char *>(&nodes[0]),
+                            nodes.size() * sizeof(Node))
+              && (vals.size() == 0
+                  || _write_all(fd, reinterpret_cast<const char *>(&vals[0]),
+                                vals.size() * sizeof(StrRef)))
+              && _write_all(fd, strs.data(), strs.size())
+              && fsync(fd) == 0);
+  ::close(fd);
+  if (!ret || rename(tmp.str().c_str(), file.c_str()) != 0) {
+    unlink(tmp.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool
+ActiveImage::open(const string& file)
+{
+  struct stat st;
+  if (stat(file.c_str(), &st) != 0) {
+    close();
+    _file = file;
+    return false;
+  }
+  if (_base && file == _file && st.st_dev == _dev && st.st_ino == _ino) {
+    // same image still mapped
+    return true;
+  }
+  close();
+  _file = file;
+
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED) {
+    return false;
+  }
+  _base = static_cast<const char *>(m);
+  _size = st.st_size;
+  _dev = st.st_dev;
+  _ino = st.st_ino;
+
+  // validate
+  const Header *h = header();
+  uint64_t need = (sizeof(Header) + (uint64_t) h->num_nodes * sizeof(Node)
+                   + (uint64_t) h->num_values * sizeof(StrRef)
+                   + h->strs_len);
+  if (memcmp(h->magic, C_IMAGE_MAGIC, sizeof(h->magic)) != 0
+      || h->version != C_IMAGE_VERSION || h->num_nodes == 0
+      || need > _size) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool
+ActiveImage::refresh()
+{
+  if (_file.empty()) {
+    return false;
+  }
+  return open(_file);
+}
+
+void
+ActiveImage::close()
+{
+  if (_base) {
+    munmap(const_cast<char *>(_base), _size);
+  }
+  _base = 0;
+  _size = 0;
+  _dev = 0;
+  _ino = 0;
+}
+
+uint64_t
+ActiveImage::getGeneration() const
+{
+  return (_base ? header()->generation : 0);
+}
+
+// return the node at the specified path or NO_NODE
+uint32_t
+ActiveImage::find(const Cpath& path) const
+{
+  if (!_base) {
+    return NO_NODE;
+  }
+  uint32_t n = 0;
+  for (size_t i = 0; i < path.size() && n != NO_NODE; i++) {
+    n = find_child(n, path[i]);
+  }
+  return n;
+}
+
+void
+ActiveImage::getChildNames(uint32_t node, vector<string>& names) const
+{
+  const Node *n = node_at(node);
+  if (!n) {
+    return;
+  }
+  for (uint32_t i = 0; i < n->num_children; i++) {
+    const Node *c = node_at(n->first_child + i);
+    string s;
+    if (c && get_str(c->name_off, c->name_len, s)) {
+      names.push_back(s);
+    }
+  }
+}
+
+bool
+ActiveImage::getValues(uint32_t node, vector<string>& values) const
+{
+  const Node *n = node_at(node);
+  if (!n || !(n->flags & NF_VALUE)
+      || ((uint64_t) n->first_value + n->num_values
+          > header()->num_values)) {
+    return false;
+  }
+  const StrRef *vals = reinterpret_cast<const StrRef *>(
+                         _base + sizeof(Header)
+                         + header()->num_nodes * sizeof(Node));
+  for (uint32_t i = 0; i < n->num_values; i++) {
+    string s;
+    if (!get_str(vals[n->first_value + i].off,
+                 vals[n->first_value + i].len, s)) {
+      return false;
+    }
+    values.push_back(s);
+  }
+  return true;
+}
+
+bool
+ActiveImage::getComment(uint32_t node, string& comment) const
+{
+  const Node *n = node_at(node);
+  return (n && (n->flags & NF_COMMENT)
+          && get_str(n->comment_off, n->comment_len, comment));
+}
+
+bool
+ActiveImage::isDeactivated(uint32_t node) const
+{
+  const Node *n = node_at(node);
+  return (n && (n->flags & NF_DEACTIVATED));
+}
+
+bool
+ActiveImage::isDefault(uint32_t node) const
+{
+  const Node *n = node_at(node);
+  return (n && (n->flags & NF_DEFAULT));
+}
+
+////// private functions
+const ActiveImage::Node *
+ActiveImage::node_at(uint32_t idx) const
+{
+  if (!_base || idx >= header()->num_nodes) {
+    return 0;
+  }
+  return (reinterpret_cast<const Node *>(_base + sizeof(Header)) + idx);
+}
+
+bool
+ActiveImage::get_str(uint32_t off, uint32_t len, string& s) const
+{
+  const Header *h = header();
+  if ((uint64_t) off + len > h->strs_len) {
+    return false;
+  }
+  const char *strs = (_base + sizeof(Header)
+                      + h->num_nodes * sizeof(Node)
+                      + h->num_values * sizeof(StrRef));
+  s.assign(strs + off, len);
+  return true;
+}
+
+// binary search among the (sorted) children of the node
+uint32_t
+ActiveImage::find_child(uint32_t node, const char *name) const
+{
+  const Node *n = node_at(node);
+  if (!n) {
+    return NO_NODE;
+  }
+  const Header *h = header();
+  const char *strs = (_base + sizeof(Header)
+                      + h->num_nodes * sizeof(Node)
+                      + h->num_values * sizeof(StrRef));
+  size_t nlen = strlen(name);
+  uint32_t lo = 0, hi = n->num_children;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    uint32_t idx = n->first_child + mid;
+    const Node *c = node_at(idx);
+    if (!c || (uint64_t) c->name_off + c->name_len > h->strs_len) {
+      return NO_NODE;
+    }
+    size_t clen = c->name_len;
+    int r = memcmp(strs + c->name_off, name, (clen < nlen ? clen : nlen));
+    if (r == 0) {
+      r = ((clen < nlen) ? -1 : ((clen > nlen) ? 1 : 0));
+    }
+    if (r == 0) {
+      return idx;
+    }
+    if (r < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NO_NODE;
+}
+
+} // end namespace cstore
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSTORE_IMAGE_H_
+#define _CSTORE_IMAGE_H_
+#include <vector>
+#include <string>
+#include <tr1/memory>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <cstore/cpath.hpp>
+
+namespace cstore { // begin namespace cstore
+
+using namespace std;
+
+/* node of the tree that is published as an image. this is only used to
+ * build the image at commit time.
+ */
+class ActiveImageNode {
+public:
+  ActiveImageNode(const string& n = "")
+    : name(n), has_value(false), has_comment(false), deactivated(false),
+      is_default(false) {};
+
+  string name;
+  vector<string> values;
+  string comment;
+  bool has_value;
+  bool has_comment;
+  bool deactivated;
+  bool is_default;
+  vector<tr1::shared_ptr<ActiveImageNode> > children;
+};
+
+/* immutable binary image of the active config.
+ *
+ * the image is written at commit time next to the active config (i.e.,
+ * "<active root>.image") and replaced atomically, so any process can
+ * mmap it and answer active config queries from memory without walking
+ * the active config directory.
+ *
+ * layout (native byte order):
+ *   header
+ *   node array (breadth-first, children of a node are contiguous and
+ *     sorted by name)
+ *   value array (offset/length pairs into string blob)
+ *   string blob
+ */
+class ActiveImage {
+public:
+  ActiveImage();
+  ~ActiveImage();
+
+  static const uint32_t NO_NODE = 0xffffffff;
+
+  static bool publish(const string& file, const ActiveImageNode& root);
+
+  // map the image. re-maps it if the file has been replaced.
+  bool open(const string& file);
+  /* re-check the file and re-open it if it has been replaced or removed
+   * (e.g., by a commit in another process). this is a single stat() as
+   * long as the same image is still in place.
+   */
+  bool refresh();
+  void close();
+  bool isOpen() const { return (_base != 0); };
+  const string& getFile() const { return _file; };
+  uint64_t getGeneration() const;
+
+  uint32_t find(const Cpath& path) const;
+  void getChildNames(uint32_t node, vector<string>& names) const;
+  bool getValues(uint32_t node, vector<string>& values) const;
+  bool getComment(uint32_t node, string& comment) const;
+  bool isDeactivated(uint32_t node) const;
+  bool isDefault(uint32_t node) const;
+
+private:
+  struct Header;
+  struct Node;
+  struct StrRef;
+
+  string _file;
+  const char *_base;
+  size_t _size;
+  dev_t _dev;
+  ino_t _ino;
+
+  const Header *header() const {
+    return reinterpret_cast<const Header *>(_base);
+  };
+  const Node *node_at(uint32_t idx) const;
+  bool get_str(uint32_t off, uint32_t len, string& s) const;
+  uint32_t find_child(uint32_t node, const char *name) const;
+};
+
+} // end namespace cstore
+
+#endif /* _CSTORE_IMAGE_H_ */
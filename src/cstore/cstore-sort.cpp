@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <cstore/cstore-sort.hpp>
+
+using namespace cstore;
+using namespace std;
+
+////// static
+// character classes are those of the "C" locale
+static inline bool
+_is_digit(char c)
+{
+  return (c >= '0' && c <= '9');
+}
+
+static inline bool
+_is_alpha(char c)
+{
+  return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'));
+}
+
+// letters sort before non-letters, and "~" before anything (even the end)
+static inline int
+_order(char c)
+{
+  if (_is_digit(c)) {
+    return 0;
+  } else if (_is_alpha(c)) {
+    return c;
+  } else if (c == '~') {
+    return -1;
+  } else if (c) {
+    return (c + 256);
+  }
+  return 0;
+}
+
+namespace {
+
+struct SortEntry {
+  SortEntry(const string& s, size_t i) : key(s.data(), s.size()), idx(i) {}
+
+  VersionKey key;
+  size_t idx;
+};
+
+struct SortEntryLess {
+  bool operator()(const SortEntry& a, const SortEntry& b) const {
+    return (VersionKey::cmp(a.key, b.key) < 0);
+  }
+};
+
+} // end anonymous namespace
+
+////// constructors/destructors
+/* split the string into epoch, upstream ("main"), and revision. this
+ * follows the apt implementation, including its handling of strings that
+ * are not valid versions (e.g., a "-" at the start of the upstream part
+ * is not a revision).
+ */
+VersionKey::VersionKey(const char *str, size_t len)
+  : _str(str), _has_rev(false)
+{
+  const char *a = str;
+  const char *end = str + len;
+  const char *m = static_cast<const char *>(memchr(a, ':', len));
+  if (!m) {
+    m = a;
+  }
+  if (m != a) {
+    // a zero epoch is the same as no epoch
+    while (*a == '0') {
+      ++a;
+    }
+    if (a == m) {
+      ++a;
+      ++m;
+    }
+  }
+  _epoch_begin = a - str;
+  _epoch_end = m - str;
+  if (m != a) {
+    // skip the ":"
+    ++m;
+  }
+  _main_begin = m - str;
+
+  const char *d = static_cast<const char *>(memrchr(m, '-', end - m));
+  _main_end = (d ? d : end) - str;
+  if (d && d != m) {
+    _has_rev = true;
+    _rev_begin = (d + 1) - str;
+  } else {
+    _rev_begin = end - str;
+  }
+  _rev_end = end - str;
+}
+
+////// public functions
+int
+VersionKey::cmp(const VersionKey& a, const VersionKey& b)
+{
+  int res = cmp_fragment(a._str + a._epoch_begin, a._str + a._epoch_end,
+                         b._str + b._epoch_begin, b._str + b._epoch_end);
+  if (res != 0) {
+    return res;
+  }
+  res = cmp_fragment(a._str + a._main_begin, a._str + a._main_end,
+                     b._str + b._main_begin, b._str + b._main_end);
+  if (res != 0) {
+    return res;
+  }
+
+  // no revision is the same as "-0"
+  static const char zero[] = "0";
+  if (a._has_rev && b._has_rev) {
+    return cmp_fragment(a._str + a._rev_begin, a._str + a._rev_end,
+                        b._str + b._rev_begin, b._str + b._rev_end);
+  } else if (a._has_rev) {
+    return cmp_fragment(a._str + a._rev_begin, a._str + a._rev_end,
+                        zero, zero + 1);
+  } else if (b._has_rev) {
+    return cmp_fragment(zero, zero + 1,
+                        b._str + b._rev_begin, b._str + b._rev_end);
+  }
+  return 0;
+}
+
+void
+VersionKey::sort(vector<string>& strs)
+{
+  vector<SortEntry> entries;
+  entries.reserve(strs.size());
+  for (size_t i = 0; i < strs.size(); i++) {
+    entries.push_back(SortEntry(strs[i], i));
+  }
+  std::sort(entries.begin(), entries.end(), SortEntryLess());
+
+  vector<string> sorted(strs.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    sorted[i].swap(strs[entries[i].idx]);
+  }
+  strs.swap(sorted);
+}
+
+////// private functions
+/* compare alternating runs of non-digits (by character) and digits
+ * (numerically). note that a string ending where the other has a run of
+ * zeros compares equal up to that point.
+ */
+int
+VersionKey::cmp_fragment(const char *a, const char *ae,
+                         const char *b, const char *be)
+{
+  while (a != ae && b != be) {
+    int first_diff = 0;
+
+    while (a != ae && b != be && (!_is_digit(*a) || !_is_digit(*b))) {
+      int ac = _order(*a);
+      int bc = _order(*b);
+      if (ac != bc) {
+        return (ac - bc);
+      }
+      ++a;
+      ++b;
+    }
+
+    while (a != ae && *a == '0') {
+      ++a;
+    }
+    while (b != be && *b == '0') {
+      ++b;
+    }
+    while (a != ae && b != be && _is_digit(*a) && _is_digit(*b)) {
+      if (!first_diff) {
+        first_diff = (*a - *b);
+      }
+      ++a;
+      ++b;
+    }
+
+    if (a != ae && _is_digit(*a)) {
+      return 1;
+    }
+    if (b != be && _is_digit(*b)) {
+      return -1;
+    }
+    if (first_diff) {
+      return first_diff;
+    }
+  }
+
+  if (a == ae && b == be) {
+    return 0;
+  }
+  if (a == ae) {
+    // a is shorter
+    return (*b == '~' ? 1 : -1);
+  }
+  // b is shorter
+  return (*a == '~' ? -1 : 1);
+}
+
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSTORE_SORT_H_
+#define _CSTORE_SORT_H_
+#include <cstddef>
+#include <vector>
+#include <string>
+
+#include <stdint.h>
+
+namespace cstore { // begin namespace cstore
+
+/* "version sort" of node names, i.e., the ordering of Debian package
+ * versions ("[epoch:]upstream[-revision]") as implemented by the apt
+ * library (debVersioningSystem::CmpVersion()), which was used before.
+ * the ordering must stay exactly the same since it determines the order
+ * of nodes everywhere (show output, commit, etc.).
+ *
+ * note that names are not required to be valid versions. for example,
+ * the "epoch" of an IPv6 address is everything before the first colon.
+ */
+class VersionKey {
+public:
+  // the string must outlive the key
+  VersionKey(const char *str, size_t len);
+
+  /* return <0, 0, or >0 like strcmp(). note that different strings can
+   * compare equal.
+   */
+  static int cmp(const VersionKey& a, const VersionKey& b);
+  static int cmp(const char *a, size_t alen, const char *b, size_t blen) {
+    return cmp(VersionKey(a, alen), VersionKey(b, blen));
+  }
+
+  /* sort the strings. the keys are computed once per string and the
+   * strings are moved (not copied), and the result is the same as sorting
+   * with the comparison above.
+   */
+  static void sort(std::vector<std::string>& strs);
+
+private:
+  // the parts are [_str + begin, _str + end)
+  const char *_str;
+  uint32_t _epoch_begin;
+  uint32_t _epoch_end;
+  uint32_t _main_begin;
+  uint32_t _main_end;
+  uint32_t _rev_begin;
+  uint32_t _rev_end;
+  bool _has_rev;
+
+  static int cmp_fragment(const char *a, const char *ae,
+                          const char *b, const char *be);
+};
+
+} // end namespace cstore
+
+#endif /* _CSTORE_SORT_H_ */
+
@@ -18,23 +18,28 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdarg>
+#include <cerrno>
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <algorithm>
 #include <sstream>
 #include <memory>
-
-#include <apt-pkg/version.h>
-#include <apt-pkg/debversion.h>
+#include <mutex>
 
 #include <cli_cstore.h>
 #include <cstore/cstore.hpp>
 #include <cstore/unionfs/cstore-unionfs.hpp>
+#include <cstore/unionfs/cstore-unionview.hpp>
+#include <cstore/oplog/cstore-oplog.hpp>
 #include <cstore/cstore-varref.hpp>
+#include <cstore/cstore-sort.hpp>
 #include <cnode/cnode.hpp>
 #include <cnode/cnode-algorithm.hpp>
+#include <cnode/cnode-image.hpp>
 #include <cparse/cparse.hpp>
 #include <commit/commit-algorithm.hpp>
 
@@ -53,6 +58,12 @@ const string Cstore::C_NODE_STATUS_STATIC = "static";
 // current levels
 const string Cstore::C_ENV_EDIT_LEVEL = "VYATTA_EDIT_LEVEL";
 const string Cstore::C_ENV_TMPL_LEVEL = "VYATTA_TEMPLATE_LEVEL";
+// durability of the committed config (default is "system")
+const string Cstore::C_ENV_COMMIT_DURABILITY = "VYATTA_COMMIT_DURABILITY";
+
+const string Cstore::C_DURABILITY_NONE = "none";
+const string Cstore::C_DURABILITY_CONFIG = "config";
+const string Cstore::C_DURABILITY_SYSTEM = "system";
 
 // shell-specific vars
 const string Cstore::C_ENV_SHELL_PROMPT = "PS1";
@@ -102,10 +113,23 @@ Cstore::Cstore(string& env)
 
 
 ////// factory functions
-// for "current session" (see UnionfsCstore constructor for details)
+/* for "current session" (see UnionfsCstore constructor for details).
+ * the backend is selected for the whole config store (see
+ * UnionfsCstore::getStoreBackend()).
+ */
 Cstore *
 Cstore::createCstore(bool use_edit_level)
 {
+  string backend = unionfs::UnionfsCstore::getStoreBackend();
+  if (backend == unionfs::UnionviewCstore::C_BACKEND_NAME) {
+    return (new unionfs::UnionviewCstore(use_edit_level));
+  }
+  if (backend == oplog::OplogCstore::C_BACKEND_NAME) {
+    return (new oplog::OplogCstore(use_edit_level));
+  }
+  if (!backend.empty()) {
+    output_internal("unknown config backend [%s]\n", backend.c_str());
+  }
   return (new unionfs::UnionfsCstore(use_edit_level));
 }
 
@@ -128,6 +152,16 @@ Cstore::contains_whitespace(const char *name) {
 Cstore *
 Cstore::createCstore(const string& session_id, string& env)
 {
+  string backend = unionfs::UnionfsCstore::getStoreBackend();
+  if (backend == unionfs::UnionviewCstore::C_BACKEND_NAME) {
+    return (new unionfs::UnionviewCstore(session_id, env));
+  }
+  if (backend == oplog::OplogCstore::C_BACKEND_NAME) {
+    return (new oplog::OplogCstore(session_id, env));
+  }
+  if (!backend.empty()) {
+    output_internal("unknown config backend [%s]\n", backend.c_str());
+  }
   return (new unionfs::UnionfsCstore(session_id, env));
 }
 
@@ -155,6 +189,13 @@ Cstore::parseTmpl(const Cpath& path_comps, bool validate_vals)
   return get_parsed_tmpl(path_comps, validate_vals);
 }
 
+void
+Cstore::cacheTmpl(const Cpath& path_comps,
+                  const tr1::shared_ptr<Ctemplate>& def)
+{
+  cache_tmpl(path_comps, def);
+}
+
 /* get parsed template of specified path as a string-string map
  *   tmap: (output) parsed template.
  * return true if successful. otherwise return false.
@@ -255,94 +296,7 @@ Cstore::deleteCfgPath(const Cpath& path_comps)
     output_user("%s\n", terr.c_str());
     return false;
   }
-
-  if (!cfg_path_exists(path_comps, false, true)) {
-    output_user("Nothing to delete (the specified %s does not exist)\n",
-                (!def->isValue() || def->isTag()) ? "node" : "value");
-    // treat as success
-    return true;
-  }
-
-  /* path already validated and in working config.
-   * cases:
-   *   1. has default value
-   *      => replace current value with default
-   *   2. no default value
-   *      => remove config path
-   */
-  if (def->getDefault()) {
-    // case 1. construct path for value file.
-    #if __GNUC__ < 6
-    auto_ptr<SavePaths> save(create_save_paths());
-    #else
-    unique_ptr<SavePaths> save(create_save_paths());
-    #endif
-    append_cfg_path(path_comps);
-    if (def->isValue()) {
-      // last comp is "value". need to go up 1 level.
-      pop_cfg_path();
-    }
-
-    /* assume default value is valid (parser should have validated).
-     * also call unmark_deactivated() in case the node being deleted was
-     * also deactivated. note that unmark_deactivated() succeeds if it's
-     * not marked deactivated. also mark "changed".
-     */
-    if (!(write_value(def->getDefault()) && mark_display_default()
-          && unmark_deactivated() && mark_changed_with_ancestors())) {
-      output_user("Failed to set default value during delete\n");
-      return false;
-    }
-    return true;
-  }
-
-  /* case 2.
-   * sub-cases:
-   *   (1) last path comp is "value", i.e., tag (value of tag node),
-   *       value of single-value node, or value of multi-value node.
-   *       (a) value of single-value node
-   *           => remove node
-   *       (b) value of multi-value node
-   *           => remove value. remove node if last value.
-   *       (c) value of tag node (i.e., tag)
-   *           => remove tag. remove node if last tag.
-   *   (2) last path comp is "node", i.e., typeless node, tag node,
-   *       single-value node, or multi-value node.
-   *       => remove node
-   */
-  bool ret = false;
-  #if __GNUC__ < 6
-  auto_ptr<SavePaths> save(create_save_paths());
-  #else
-  unique_ptr<SavePaths> save(create_save_paths());
-  #endif
-  append_cfg_path(path_comps);
-  if (!def->isValue()) {
-    // sub-case (2)
-    ret = remove_node();
-  } else {
-    // last comp is value
-    if (def->isTag()) {
-      // sub-case (1c)
-      ret = remove_tag();
-    } else if (def->isMulti()) {
-      // sub-case (1b)
-      pop_cfg_path();
-      ret = remove_value_from_multi(path_comps[path_comps.size() - 1]);
-    } else {
-      // sub-case (1a). delete node at 1 level up.
-      pop_cfg_path();
-      ret = remove_node();
-    }
-  }
-  if (ret) {
-    // mark changed
-    ret = mark_changed_with_ancestors();
-  }
-  if (!ret) {
-    output_user("Failed to delete specified config path\n");
-  }
-  return ret;
+  return delete_cfg_path(path_comps, def);
 }
 
 /* check if specified "logical path" is valid for "set" operation
@@ -1067,71 +1021,33 @@ Cstore::commentCfgPath(const Cpath& args)
     output_user("%s\n", terr.c_str());
     return false;
   }
-  // here we want to include deactivated nodes
-  if (!cfg_path_exists(path_comps, false, true)) {
-    output_user("The specified config node does not exist\n");
-    return false;
-  }
-  if (def->isLeafValue()) {
-    /* XXX differ from the original implementation, which allows commenting
-     *     on a "value" BUT silently "promote" the comment to the parent
-     *     "node". this will probably create confusion for the user.
-     *
-     *     just disallow such cases here.
-     */
-    output_user("Cannot comment on config values\n");
-    return false;
-  }
-  if (def->isTagNode()) {
-    /* XXX follow original implementation and disallow comment on a
-     *     "tag node". this is because "show" does not display such
-     *     comments (see bug 5794).
-     */
-    output_user("Cannot add comment at this level\n");
-    return false;
-  }
-  if (comment.find_first_of('*') != string::npos) {
-    // don't allow '*'. this is due to config files using C-style /**/
-    // comments. this probably belongs to lower-level, but we are enforcing
-    // it here.
-    output_user("Cannot use the '*' character in a comment\n");
-    return false;
-  }
-  if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION BELOW") != string::npos){
-    // Don't allow users to set configuration migration comments
-    return false;
-  }
-  if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION ABOVE") != string::npos){
-    // Don't allow users to set configuration migration comments
-    return false;
-  }
+  return comment_cfg_path(path_comps, comment, def);
+}
 
-  bool ret = false;
-  {
-    #if __GNUC__ < 6
-    auto_ptr<SavePaths> save(create_save_paths());
-    #else
-    unique_ptr<SavePaths> save(create_save_paths());
-    #endif
-    append_cfg_path(path_comps);
-    if (comment == "") {
-      // follow original impl: empty comment => remove it
-      ret = remove_comment();
-      if (!ret) {
-        output_user("Failed to remove comment for specified config node\n");
-      }
-    } else {
-      ret = set_comment(comment);
-      if (!ret) {
-        output_user("Failed to add comment for specified config node\n");
-      }
-    }
+/* make the result of a commit durable according to the durability mode:
+ *   system: flush everything (global sync()), including the files that
+ *           the commit actions wrote (e.g., in /etc and /config). this is
+ *           the default.
+ *   config: flush only the config itself, i.e., the filesystem(s) holding
+ *           it (backend-specific). files written by the commit actions are
+ *           not flushed before the post-commit hooks run.
+ *   none:   don't flush anything (leave it to the kernel).
+ * return true if successful. otherwise return false.
+ */
+bool
+Cstore::syncCommittedConfig()
+{
+  char *val = getenv(C_ENV_COMMIT_DURABILITY.c_str());
+  string mode = (val ? val : C_DURABILITY_SYSTEM);
+  if (mode == C_DURABILITY_NONE) {
+    return true;
   }
-  if (ret) {
-    // mark the root as changed for "comment"
-    ret = mark_changed_with_ancestors();
+  if (mode == C_DURABILITY_CONFIG && sync_committed_config()) {
+    return true;
   }
-  return ret;
+  // system mode or fall back
+  sync();
+  return true;
 }
 
 /* discard all changes in working config.
@@ -1930,90 +1846,938 @@ Cstore::unmarkCfgPathDeactivated(const Cpath& path_comps)
   return (unmark_deactivated() && mark_changed_with_ancestors());
 }
 
-// load specified config file
-bool
-Cstore::loadFile(const char *filename)
+/* applies "delete", "set", and "comment" commands to the working config.
+ * each command has the same effect (and output) as the corresponding
+ * deleteCfgPath(), validateSetPath()/setCfgPath(), or commentCfgPath()
+ * call, but the work is shared between commands.
+ *
+ * the set commands are applied as a walk of the tree formed by their
+ * paths. the state of each level of the current path (template, whether
+ * the value has been validated, whether it is in working config) is kept
+ * on a stack, and the cfg/tmpl paths are kept at the current path. the
+ * next path only pops the levels it does not share and pushes its own,
+ * so with the commands in config order (as generated by the diff), each
+ * node is looked up, validated, created, and marked changed once instead
+ * of once for every command below it.
+ *
+ * templates are cached by the tag-collapsed template path (e.g., one for
+ * all values of "interfaces ethernet"), so each template is parsed once.
+ * delete and comment commands use the same cache, but since they operate
+ * on full paths, they are applied from the root.
+ *
+ * the values of the set commands can be validated in advance (see
+ * validate()), in which case they are not validated again when the
+ * commands are applied (the ones that did not pass have been reported).
+ */
+/* whether the specified syntax checks only depend on the value itself,
+ * i.e., there are no references to other nodes (including the other
+ * values of a multi-value node) in the checks or in the commands of the
+ * exec validators. an exec validator that only uses "$VAR(@)" is assumed
+ * to check the value passed to it. the messages of the checks are only
+ * output, so they do not matter.
+ */
+static bool
+_syntax_context_free(const vtw_node *node)
 {
-  if (!inSession()) {
-    output_user("Cannot load config outside configuration session\n");
-    // exit handled by assert below
+  if (!node) {
+    return true;
   }
-  ASSERT_IN_SESSION;
-
-  FILE *fin = fopen(filename, "r");
-  if (!fin) {
-    output_user("Failed to open specified config file\n");
-    return false;
+  switch (node->vtw_node_oper) {
+  case HELP_OP:
+    return _syntax_context_free(node->vtw_node_left);
+  case VAR_OP:
+  case VAL_OP:
+  case B_QUOTE_OP:
+    if (node->vtw_node_string) {
+      const char *p = node->vtw_node_string;
+      while ((p = strstr(p, "$VAR(")) != NULL) {
+        p += 5;
+        if (p[0] != '@' || p[1] != ')') {
+          return false;
+        }
+      }
+    }
+    break;
+  default:
+    break;
   }
+  return (_syntax_context_free(node->vtw_node_left)
+          && _syntax_context_free(node->vtw_node_right));
+}
 
-  // get the config tree from the file
-  CfgNode *froot = cparse::parse_file(fin, *this);
-  fclose(fin);
-  if (!froot) {
-    output_user("Failed to parse specified config file\n");
-    return false;
+static bool
+_write_all(int fd, const string& data)
+{
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t r = write(fd, data.data() + done, data.size() - done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    done += r;
   }
+  return true;
+}
 
-  // get the config tree from the active config
-  Cpath args;
-  CfgNode aroot(*this, args, true, true);
+static bool
+_read_all(int fd, char *buf, size_t len)
+{
+  size_t got = 0;
+  while (got < len) {
+    ssize_t r = read(fd, buf + got, len - got);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    got += r;
+  }
+  return true;
+}
 
-  // get the "commands diff" between the two
-  vector<Cpath> del_list;
-  vector<Cpath> set_list;
-  vector<Cpath> com_list;
-  get_cmds_diff(aroot, *froot, del_list, set_list, com_list);
+class Cstore::CmdApplier {
+public:
+  CmdApplier(Cstore& cstore) : _cstore(cstore), _pushed(0), _shared(0) {}
+  ~CmdApplier() {
+    go_to_root();
+  }
+
+  // output an error message and return false if the command failed
+  bool apply(cnode::CmdVisitor::Op op, const Cpath& path);
+  // validate the values of the specified set commands in advance
+  void validate(const vector<Cpath>& set_list);
+
+private:
+  // path component standing for the value in a template path
+  static const char *C_VALUE_COMP;
+  // minimum number of values for each worker (see validate())
+  static const size_t C_MIN_VALIDATE_PER_WORKER = 64;
+
+  enum LevelType {
+    // typeless node, tag node, single-value node, or multi-value node
+    LT_NODE,
+    // value of tag node
+    LT_TAG_VALUE,
+    // value of single-value node or multi-value node
+    LT_VALUE
+  };
+  struct Level {
+    LevelType type;
+    // same as get_parsed_tmpl() on the path up to this level
+    tr1::shared_ptr<Ctemplate> def;
+    // whether the value has been validated
+    bool validated;
+    // whether this level is in working config (only if validated)
+    bool exists;
+  };
+  typedef MapT<Cpath, tr1::shared_ptr<Ctemplate>, CpathHash> TmplMapT;
+  // child nodes of a template that have a default value
+  typedef vector<pair<string, tr1::shared_ptr<Ctemplate> > > DefaultsT;
+  typedef MapT<Cpath, DefaultsT, CpathHash> DefaultsMapT;
+
+  Cstore& _cstore;
+  // current path and the state of each of its levels
+  Cpath _path;
+  vector<Level> _levels;
+  // tag-collapsed template path of the current path
+  Cpath _tpath;
+  // number of levels the cfg/tmpl paths are at
+  size_t _pushed;
+  TmplMapT _tmpls;
+  DefaultsMapT _defaults;
+  // number of levels shared by the last two paths (see go_to())
+  size_t _shared;
+  /* results of the validation in advance by path of the value (or of the
+   * typeless node). the values that did not pass have been reported.
+   */
+  MapT<Cpath, bool, CpathHash> _valid;
+
+  bool delete_path(const Cpath& path);
+  bool set_path(const Cpath& path);
+  bool comment_path(const Cpath& args);
+
+  bool go_to(const Cpath& path, bool for_set, string& error);
+  bool go_down(const char *comp, bool for_set, string& error);
+  void go_up();
+  void go_to_root() {
+    while (!_levels.empty()) {
+      go_up();
+    }
+  };
+  void push_level();
+  void pop_level();
+  bool level_exists();
+  tr1::shared_ptr<Ctemplate> get_tmpl(const char *node);
+  bool create_level();
+  bool create_default_children();
+  bool validate_val(const tr1::shared_ptr<Ctemplate>& def, const char *value);
+  bool validate_path(const Cpath& path);
+  void run_validate_worker(const vector<Cpath>& vpaths, size_t begin,
+                           size_t end, int fd);
+};
+
+const char *Cstore::CmdApplier::C_VALUE_COMP = "node.tag";
 
-  delete froot;
-  // "apply" the changes to the working config
-  for (size_t i = 0; i < del_list.size(); i++) {
-    if (!deleteCfgPath(del_list[i])) {
-      print_path_vec("Delete [", "] failed\n", del_list[i], "'");
+bool
+Cstore::CmdApplier::apply(cnode::CmdVisitor::Op op, const Cpath& path)
+{
+  switch (op) {
+  case cnode::CmdVisitor::OP_DELETE:
+    if (!delete_path(path)) {
+      _cstore.print_path_vec("Delete [", "] failed\n", path, "'");
+      return false;
     }
-  }
-  for (size_t i = 0; i < set_list.size(); i++) {
-    if (!validateSetPath(set_list[i]) || !setCfgPath(set_list[i])) {
-      print_path_vec("Set [", "] failed\n", set_list[i], "'");
+    break;
+  case cnode::CmdVisitor::OP_SET:
+    if (!set_path(path)) {
+      _cstore.print_path_vec("Set [", "] failed\n", path, "'");
+      return false;
     }
-  }
-  for (size_t i = 0; i < com_list.size(); i++) {
-    if (!commentCfgPath(com_list[i])) {
-      string comment = string(com_list[i][com_list[i].size()-1]);
-      if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION BELOW") == string::npos
-       && comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION ABOVE") == string::npos) {
-        print_path_vec("Comment [", "] failed\n", com_list[i], "'");
+    break;
+  case cnode::CmdVisitor::OP_COMMENT:
+    if (!comment_path(path)) {
+      string comment = string(path[path.size() - 1]);
+      if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION BELOW")
+          != string::npos
+          || comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION ABOVE")
+             != string::npos) {
+        // expected to fail (and ignored)
+        return true;
       }
+      _cstore.print_path_vec("Comment [", "] failed\n", path, "'");
+      return false;
     }
+    break;
   }
-
   return true;
 }
 
-/* "changed" status handling.
- * the "changed" status is used during commit to check if a node has been
- * changed. note that if a node is "changed", all of its ancestors are also
- * considered changed (this follows the original logic).
- *
- * the original backend implementation only uses the "changed" marker at
- * "root" to indicate whether the whole config has changed. for the rest
- * of the config hierarchy, the original implementation treated all nodes
- * that are present in the unionfs "changes only" directory as "changed".
- *
- * this worked until the introduction of "deactivate". since deactivated
- * nodes are also present in the "changes only" directory, the backend
- * treat them as "changed". on the other hand, deleted nodes don't appear
- * in "changes only", so they are _not_ treated as "changed". this creates
- * problems in various parts of the backend.
- *
- * the new CLI backend/library "marks" all changed nodes explicitly, and the
- * "changed" status depends on such markers. the marking is done using the
- * pure virtual mark_changed_with_ancestors() function, which is provided
- * by the low-level implementation, so it does not have to be done as a
- * "per-node file marker" as long as the low-level implementation can
- * correctly answer the "changed" query for a given path.
- *
- * note that "changed" nodes does not include "added" and "deleted" nodes.
- * for the convenience of implementation, the backend must always query
+/* validate the values of the specified set commands in advance. each value
+ * (and each typeless node, see validateSetPath()) is validated once, and
+ * the validations (including exec validators) are divided among worker
+ * processes. this runs against the config before any of the sets, so
+ * only the values whose syntax checks do not refer to other nodes (see
+ * _syntax_context_free()) are validated in advance. the rest are validated
+ * when they are applied, i.e., against the config as it is at that point.
+ * validate_value() only reads the config, but it is not reentrant (and may
+ * exec validators), so the workers are forked instead of being threads in
+ * this process. the workers collect the output for each value that does
+ * not pass, and all such values are reported with their paths before any
+ * of the sets is applied. if there are not enough values to make it
+ * worthwhile, nothing is done.
+ */
+void
+Cstore::CmdApplier::validate(const vector<Cpath>& set_list)
+{
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpus < 2) {
+    // validate serially when applying
+    return;
+  }
+
+  // collect the paths to validate (tag values are shared by many commands)
+  vector<Cpath> vpaths;
+  for (size_t i = 0; i < set_list.size(); i++) {
+    string terr;
+    bool valid = go_to(set_list[i], false, terr);
+    size_t n = _levels.size();
+    Cpath vpath;
+    for (size_t j = 0; j < n; j++) {
+      vpath.push(_path[j]);
+      if (j < _shared && j != (n - 1)) {
+        // seen with the previous path
+        continue;
+      }
+      const Level& l = _levels[j];
+      if (l.type == LT_NODE
+          && !(valid && j == (n - 1) && l.def->isTypeless())) {
+        // nothing to validate
+        continue;
+      }
+      const vtw_def *vdef = l.def->getDef();
+      if (!_syntax_context_free(vdef->actions[syntax_act].vtw_list_head)) {
+        // may depend on the sets before it. validate when applying.
+        continue;
+      }
+      if (_valid.insert(make_pair(vpath, false)).second) {
+        vpaths.push_back(vpath);
+      }
+    }
+  }
+  go_to_root();
+
+  size_t nworkers = vpaths.size() / C_MIN_VALIDATE_PER_WORKER;
+  if (nworkers > static_cast<size_t>(ncpus)) {
+    nworkers = ncpus;
+  }
+  if (nworkers < 2) {
+    // validate serially when applying
+    _valid.clear();
+    return;
+  }
+
+  // don't let the workers output what is buffered
+  fflush(NULL);
+  size_t chunk = (vpaths.size() + nworkers - 1) / nworkers;
+  vector<pid_t> pids;
+  vector<int> fds;
+  for (size_t b = 0; b < vpaths.size(); b += chunk) {
+    size_t e = (b + chunk < vpaths.size()) ? (b + chunk) : vpaths.size();
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+      break;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(pfd[0]);
+      run_validate_worker(vpaths, b, e, pfd[1]);
+    }
+    close(pfd[1]);
+    if (pid < 0) {
+      close(pfd[0]);
+      break;
+    }
+    pids.push_back(pid);
+    fds.push_back(pfd[0]);
+  }
+
+  /* collect the results (see run_validate_worker()). the values whose
+   * results are missing (e.g., the worker failed) are simply validated
+   * when applying.
+   */
+  vector<pair<size_t, string> > failures;
+  for (size_t w = 0; w < pids.size(); w++) {
+    size_t b = w * chunk;
+    size_t e = (b + chunk < vpaths.size()) ? (b + chunk) : vpaths.size();
+    size_t i = b;
+    for (; i < e; i++) {
+      char passed;
+      if (!_read_all(fds[w], &passed, 1)) {
+        break;
+      }
+      if (passed) {
+        _valid[vpaths[i]] = true;
+        continue;
+      }
+      uint32_t len;
+      string msg;
+      if (!_read_all(fds[w], reinterpret_cast<char *>(&len), sizeof(len))) {
+        break;
+      }
+      msg.resize(len);
+      if (len > 0 && !_read_all(fds[w], &(msg[0]), len)) {
+        break;
+      }
+      _valid[vpaths[i]] = false;
+      failures.push_back(make_pair(i, msg));
+    }
+    for (; i < e; i++) {
+      _valid.erase(vpaths[i]);
+    }
+    close(fds[w]);
+    while (waitpid(pids[w], NULL, 0) < 0 && errno == EINTR) {
+      // interrupted. wait again.
+    }
+  }
+  for (size_t i = (pids.size() * chunk); i < vpaths.size(); i++) {
+    // no worker (fork failed)
+    _valid.erase(vpaths[i]);
+  }
+
+  // report all values that did not pass (in the order of the commands)
+  for (size_t i = 0; i < failures.size(); i++) {
+    output_user("%s", failures[i].second.c_str());
+    _cstore.print_path_vec("Invalid value [", "]\n",
+                           vpaths[failures[i].first], "'");
+  }
+}
+
+// see deleteCfgPath()
+bool
+Cstore::CmdApplier::delete_path(const Cpath& path)
+{
+  string terr;
+  tr1::shared_ptr<Ctemplate> def;
+  if (go_to(path, false, terr)) {
+    def = _levels.back().def;
+  }
+  go_to_root();
+  if (!def.get()) {
+    output_user("%s\n", terr.c_str());
+    return false;
+  }
+  return _cstore.delete_cfg_path(path, def);
+}
+
+// see validateSetPath() and set_cfg_path()
+bool
+Cstore::CmdApplier::set_path(const Cpath& path)
+{
+  string terr;
+  if (!go_to(path, true, terr)) {
+    output_user("%s\n", terr.c_str());
+    return false;
+  }
+  size_t n = path.size();
+  tr1::shared_ptr<Ctemplate> def(_levels[n - 1].def);
+  LevelType type = _levels[n - 1].type;
+  if (def->isTag() && _cstore.contains_whitespace(path[n - 1])) {
+    output_user("Tag node value name must not contain whitespace\n");
+    return false;
+  }
+  if (!def->isValue()) {
+    if (!def->isTypeless()) {
+      output_user("Configuration path: [%s] requires a value\n",
+                  path.to_string().c_str());
+      return false;
+    }
+    // cfg/tmpl paths are at the typeless node
+    if (!validate_val(def, "")) {
+      return false;
+    }
+  }
+
+  // path is valid. create the levels that are not in working config.
+  size_t k = 0;
+  while (k < n && _levels[k].exists) {
+    ++k;
+  }
+  bool ret = true;
+  bool path_exists = (k == n);
+  if (k < n) {
+    while (_pushed > k) {
+      pop_level();
+    }
+    while (_pushed < n) {
+      push_level();
+      Level& l = _levels[_pushed - 1];
+      if (_pushed > (k + 1)) {
+        // may have been created as a default child of the level above
+        l.exists = level_exists();
+      }
+      if (!l.exists) {
+        if (!create_level()) {
+          break;
+        }
+        l.exists = true;
+      }
+    }
+    if (_pushed < n || !_levels[n - 1].exists) {
+      /* failed. drop the failed level and the ones below it so that they
+       * are looked up again (and output the same errors) next time.
+       */
+      ret = false;
+      pop_level();
+      while (_levels.size() > _pushed) {
+        _levels.pop_back();
+        _path.pop();
+        _tpath.pop();
+      }
+    }
+    // mark the deepest level created (and its ancestors) changed
+    if (_pushed > k && !_cstore.mark_changed_with_ancestors()) {
+      ret = false;
+    }
+  }
+
+  if (ret && def->isValue() && def->getDefault()) {
+    // the node is one level up from a tag value (see set_cfg_path())
+    string tag;
+    if (type == LT_TAG_VALUE) {
+      _cstore.pop_cfg_path(tag);
+    }
+    if (_cstore.marked_display_default(false)) {
+      if ((ret = _cstore.unmark_display_default())) {
+        vector<string> vvec;
+        _cstore.read_value_vec(vvec, false);
+        _cstore.write_value_vec(vvec, false);
+        path_exists = false;
+        ret = _cstore.mark_changed_with_ancestors();
+      }
+    }
+    if (type == LT_TAG_VALUE) {
+      _cstore.push_cfg_path(tag.c_str());
+    }
+  }
+  if (path_exists) {
+    output_user("Configuration path: [%s] already exists\n",
+                path.to_string().c_str());
+  }
+  return ret;
+}
+
+// see commentCfgPath()
+bool
+Cstore::CmdApplier::comment_path(const Cpath& args)
+{
+  Cpath path(args);
+  string comment;
+  path.pop(comment);
+
+  string terr;
+  tr1::shared_ptr<Ctemplate> def;
+  if (go_to(path, false, terr)) {
+    def = _levels.back().def;
+  }
+  go_to_root();
+  if (!def.get()) {
+    output_user("%s\n", terr.c_str());
+    return false;
+  }
+  return _cstore.comment_cfg_path(path, comment, def);
+}
+
+/* make the specified path the current path, keeping the levels shared with
+ * the current one. for a set, the values are validated and the existence
+ * in working config is looked up.
+ * return true if the path is valid. otherwise return false (the current
+ * path is then the valid part of it).
+ */
+bool
+Cstore::CmdApplier::go_to(const Cpath& path, bool for_set, string& error)
+{
+  // same as get_parsed_tmpl()
+  error = "Configuration path: [" + path.to_string() + "] is not valid\n";
+
+  size_t n = 0;
+  while (n < _levels.size() && n < path.size()
+         && (!for_set || _levels[n].validated)
+         && strcmp(_path[n], path[n]) == 0) {
+    ++n;
+  }
+  while (_levels.size() > n) {
+    go_up();
+  }
+  _shared = n;
+  for (size_t i = n; i < path.size(); i++) {
+    if (!go_down(path[i], for_set, error)) {
+      return false;
+    }
+  }
+  return (path.size() > 0);
+}
+
+// see get_parsed_tmpl() for the cases
+bool
+Cstore::CmdApplier::go_down(const char *comp, bool for_set, string& error)
+{
+  Level l;
+  l.validated = for_set;
+  l.exists = false;
+  bool pexists = true;
+  if (!_levels.empty()) {
+    const Level& p = _levels.back();
+    if (p.type == LT_VALUE || _path.back()[0] == 0) {
+      // value of single-/multi-value node or empty value. no children.
+      return false;
+    }
+    pexists = p.exists;
+    if (p.type == LT_NODE
+        && (p.def->isTag() || p.def->isMulti() || !p.def->isTypeless())) {
+      // comp is a value. tmpl and cfg paths are at the node.
+      l.type = (p.def->isTag() ? LT_TAG_VALUE : LT_VALUE);
+      _tpath.push(C_VALUE_COMP);
+      l.def = get_tmpl(NULL);
+      _path.push(comp);
+      bool valid = (!for_set || validate_val(l.def, comp));
+      _path.pop();
+      if (!valid) {
+        error = "Value validation failed";
+        _tpath.pop();
+        return false;
+      }
+    }
+  }
+  if (!l.def.get()) {
+    // comp is a node
+    if (comp[0] == 0) {
+      return false;
+    }
+    l.type = LT_NODE;
+    _tpath.push(comp);
+    l.def = get_tmpl(comp);
+    if (!l.def.get()) {
+      _tpath.pop();
+      return false;
+    }
+  }
+  _levels.push_back(l);
+  _path.push(comp);
+  push_level();
+  if (for_set && pexists) {
+    _levels.back().exists = level_exists();
+  }
+  return true;
+}
+
+void
+Cstore::CmdApplier::go_up()
+{
+  if (_pushed == _levels.size()) {
+    pop_level();
+  }
+  _levels.pop_back();
+  _path.pop();
+  _tpath.pop();
+}
+
+// push the cfg/tmpl paths of the next level
+void
+Cstore::CmdApplier::push_level()
+{
+  const char *comp = _path[_pushed];
+  switch (_levels[_pushed].type) {
+  case LT_NODE:
+    _cstore.push_tmpl_path(comp);
+    _cstore.push_cfg_path(comp);
+    break;
+  case LT_TAG_VALUE:
+    _cstore.push_tmpl_path_tag();
+    _cstore.push_cfg_path(comp);
+    break;
+  case LT_VALUE:
+    // value is at the node's cfg path
+    break;
+  }
+  ++_pushed;
+}
+
+void
+Cstore::CmdApplier::pop_level()
+{
+  --_pushed;
+  if (_levels[_pushed].type != LT_VALUE) {
+    _cstore.pop_tmpl_path();
+    _cstore.pop_cfg_path();
+  }
+}
+
+// whether the last pushed level is in working config (see cfg_path_exists())
+bool
+Cstore::CmdApplier::level_exists()
+{
+  if (_levels[_pushed - 1].type == LT_VALUE) {
+    return _cstore.cfg_value_exists(_path[_pushed - 1], false);
+  }
+  return _cstore.cfg_node_exists(false);
+}
+
+/* return the template of the specified child node of the tmpl path (NULL
+ * if it is not a valid node) or, if node is NULL, of the value of the node
+ * at the tmpl path. the template is cached under _tpath.
+ */
+tr1::shared_ptr<Ctemplate>
+Cstore::CmdApplier::get_tmpl(const char *node)
+{
+  TmplMapT::iterator it = _tmpls.find(_tpath);
+  if (it != _tmpls.end()) {
+    return it->second;
+  }
+
+  tr1::shared_ptr<Ctemplate> def;
+  if (!node) {
+    def.reset(_cstore.tmpl_parse());
+    if (!def.get()) {
+      exit_internal("failed to parse tmpl [%s]\n",
+                    _cstore.tmpl_path_to_str().c_str());
+    }
+    def->setIsValue(true);
+  } else {
+    _cstore.push_tmpl_path(node);
+    if (_cstore.tmpl_node_exists()) {
+      def.reset(_cstore.tmpl_parse());
+      if (!def.get()) {
+        exit_internal("failed to parse tmpl [%s]\n",
+                      _cstore.tmpl_path_to_str().c_str());
+      }
+      def->setIsValue(false);
+    }
+    _cstore.pop_tmpl_path();
+  }
+  _tmpls[_tpath] = def;
+  return def;
+}
+
+// create the last pushed level in working config (see set_cfg_path())
+bool
+Cstore::CmdApplier::create_level()
+{
+  const Level& l = _levels[_pushed - 1];
+  const char *comp = _path[_pushed - 1];
+  switch (l.type) {
+  case LT_NODE:
+    return (_cstore.add_node()
+            && (l.def->isTag() || create_default_children()));
+  case LT_TAG_VALUE:
+    return (_cstore.add_tag(l.def->getTagLimit())
+            && create_default_children());
+  case LT_VALUE:
+    if (l.def->isMulti()) {
+      return _cstore.add_value_to_multi(l.def->getMultiLimit(), comp);
+    }
+    return _cstore.write_value(comp);
+  }
+  return false;
+}
+
+/* create the child nodes that have default values for the last pushed
+ * level (see Cstore::create_default_children()). the child nodes are
+ * looked up once per template.
+ */
+bool
+Cstore::CmdApplier::create_default_children()
+{
+  Cpath tpath;
+  for (size_t i = 0; i < _pushed; i++) {
+    tpath.push(_tpath[i]);
+  }
+  DefaultsMapT::iterator it = _defaults.find(tpath);
+  if (it == _defaults.end()) {
+    DefaultsT defs;
+    vector<string> tcnodes;
+    _cstore.get_all_tmpl_child_node_names(tcnodes);
+    for (size_t i = 0; i < tcnodes.size(); i++) {
+      tr1::shared_ptr<Ctemplate> def;
+      _cstore.push_tmpl_path(tcnodes[i].c_str());
+      if (_cstore.tmpl_node_exists()) {
+        def.reset(_cstore.tmpl_parse());
+      }
+      _cstore.pop_tmpl_path();
+      if (def.get() && def->getDefault()) {
+        defs.push_back(make_pair(tcnodes[i], def));
+      }
+    }
+    it = _defaults.insert(make_pair(tpath, defs)).first;
+  }
+
+  const DefaultsT& defs = it->second;
+  for (size_t i = 0; i < defs.size(); i++) {
+    _cstore.push_cfg_path(defs[i].first.c_str());
+    bool ret = (_cstore.add_node()
+                && _cstore.write_value(defs[i].second->getDefault())
+                && _cstore.mark_display_default());
+    _cstore.pop_cfg_path();
+    if (!ret) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* validate the value (or typeless node) at the current path, which is
+ * given by _path (see Cstore::validate_val()). a value that has been
+ * validated in advance is not validated again.
+ */
+bool
+Cstore::CmdApplier::validate_val(const tr1::shared_ptr<Ctemplate>& def,
+                                 const char *value)
+{
+  MapT<Cpath, bool, CpathHash>::iterator it = _valid.find(_path);
+  if (it != _valid.end()) {
+    // if it did not pass, it has been reported
+    return it->second;
+  }
+  return _cstore.validate_val(def, value);
+}
+
+// validate the last level of the path (in a worker, see validate())
+bool
+Cstore::CmdApplier::validate_path(const Cpath& path)
+{
+  string terr;
+  if (!go_to(path, false, terr)) {
+    return false;
+  }
+  const Level& l = _levels.back();
+  if (l.type == LT_NODE) {
+    // typeless node. cfg/tmpl paths are at the node.
+    return _cstore.validate_val(l.def, "");
+  }
+  // cfg/tmpl paths need to be at the node of the value
+  if (l.type == LT_TAG_VALUE) {
+    pop_level();
+  }
+  bool ret = _cstore.validate_val(l.def, path[path.size() - 1]);
+  if (l.type == LT_TAG_VALUE) {
+    push_level();
+  }
+  return ret;
+}
+
+/* validate the specified range of paths and write the results to the file
+ * descriptor: for each path, one byte for whether it passed and, if not,
+ * the length (uint32_t) and the output of its validation. this runs in a
+ * forked worker and does not return.
+ */
+void
+Cstore::CmdApplier::run_validate_worker(const vector<Cpath>& vpaths,
+                                        size_t begin, size_t end, int fd)
+{
+  /* capture all output (including that of validators) in a temp file,
+   * which is emptied before each value.
+   */
+  FILE *tf = tmpfile();
+  int ofd = (tf ? fileno(tf) : open("/dev/null", O_WRONLY));
+  if (ofd >= 0) {
+    dup2(ofd, 1);
+    dup2(ofd, 2);
+    if (out_stream) {
+      dup2(ofd, fileno(out_stream));
+    }
+  }
+
+  string results;
+  for (size_t i = begin; i < end; i++) {
+    bool capture = false;
+    if (tf) {
+      fflush(NULL);
+      capture = (ftruncate(ofd, 0) == 0 && lseek(ofd, 0, SEEK_SET) == 0);
+    }
+    if (validate_path(vpaths[i])) {
+      results.push_back(1);
+      continue;
+    }
+    string msg;
+    if (capture) {
+      fflush(NULL);
+      off_t len = lseek(ofd, 0, SEEK_CUR);
+      if (len > 0) {
+        msg.resize(len);
+        if (pread(ofd, &(msg[0]), len, 0) != len) {
+          msg.clear();
+        }
+      }
+    }
+    uint32_t len = msg.size();
+    results.push_back(0);
+    results.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    results.append(msg);
+  }
+  _write_all(fd, results);
+  _exit(0);
+}
+
+// load specified config file
+bool
+Cstore::loadFile(const char *filename)
+{
+  if (!inSession()) {
+    output_user("Cannot load config outside configuration session\n");
+    // exit handled by assert below
+  }
+  ASSERT_IN_SESSION;
+
+  if (access(filename, R_OK) != 0) {
+    output_user("Failed to open specified config file\n");
+    return false;
+  }
+
+  // both trees are allocated from one arena (must outlive them)
+  CfgNodeArena arena;
+  CfgNodeArena::Scope ascope(arena);
+
+  /* get the config tree from the file. a binary image (see CfgImage) is
+   * loaded without parsing (but is rejected if it was written with
+   * different templates).
+   */
+  CfgNode *froot;
+  if (CfgImage::isImage(filename)) {
+    froot = CfgImage::load(filename, this);
+  } else {
+    froot = cparse::parse_file(filename, *this);
+  }
+  if (!froot) {
+    output_user("Failed to parse specified config file\n");
+    return false;
+  }
+
+  // get the config tree from the active config
+  Cpath args;
+  CfgNode aroot(*this, args, true, true);
+
+  /* "apply" the "commands diff" between the two to the working config.
+   * all deletes are done first, then the sets, and the comments last.
+   * the set commands are collected (rather than applied as they are
+   * generated) so that their values can be validated in advance.
+   */
+  vector<Cpath> del_list;
+  vector<Cpath> set_list;
+  vector<Cpath> com_list;
+  get_cmds_diff(aroot, *froot, del_list, set_list, com_list);
+  delete froot;
+  if (!applyCmds(del_list, set_list, com_list)) {
+    /* the errors have been output for each failed command. the rest of
+     * the config is loaded, so this is still a successful load.
+     */
+    output_user("Failed to apply some of the configuration commands\n");
+  }
+  return true;
+}
+
+/* apply the specified commands (e.g., from cnode::get_cmds_diff()) to the
+ * working config: the deletes first, then the sets, and the comments last.
+ * the commands are applied in bulk (see CmdApplier above), which is much
+ * faster than applying them one by one when there are many. the values of
+ * the sets are validated in parallel before any of them is applied.
+ * return true if all commands succeeded. otherwise return false.
+ */
+bool
+Cstore::applyCmds(const vector<Cpath>& del_list,
+                  const vector<Cpath>& set_list,
+                  const vector<Cpath>& com_list)
+{
+  ASSERT_IN_SESSION;
+
+  bool ret = true;
+  CmdApplier applier(*this);
+  for (size_t i = 0; i < del_list.size(); i++) {
+    if (!applier.apply(cnode::CmdVisitor::OP_DELETE, del_list[i])) {
+      ret = false;
+    }
+  }
+  applier.validate(set_list);
+  for (size_t i = 0; i < set_list.size(); i++) {
+    if (!applier.apply(cnode::CmdVisitor::OP_SET, set_list[i])) {
+      ret = false;
+    }
+  }
+  for (size_t i = 0; i < com_list.size(); i++) {
+    if (!applier.apply(cnode::CmdVisitor::OP_COMMENT, com_list[i])) {
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+/* "changed" status handling.
+ * the "changed" status is used during commit to check if a node has been
+ * changed. note that if a node is "changed", all of its ancestors are also
+ * considered changed (this follows the original logic).
+ *
+ * the original backend implementation only uses the "changed" marker at
+ * "root" to indicate whether the whole config has changed. for the rest
+ * of the config hierarchy, the original implementation treated all nodes
+ * that are present in the unionfs "changes only" directory as "changed".
+ *
+ * this worked until the introduction of "deactivate". since deactivated
+ * nodes are also present in the "changes only" directory, the backend
+ * treat them as "changed". on the other hand, deleted nodes don't appear
+ * in "changes only", so they are _not_ treated as "changed". this creates
+ * problems in various parts of the backend.
+ *
+ * the new CLI backend/library "marks" all changed nodes explicitly, and the
+ * "changed" status depends on such markers. the marking is done using the
+ * pure virtual mark_changed_with_ancestors() function, which is provided
+ * by the low-level implementation, so it does not have to be done as a
+ * "per-node file marker" as long as the low-level implementation can
+ * correctly answer the "changed" query for a given path.
+ *
+ * note that "changed" nodes does not include "added" and "deleted" nodes.
+ * for the convenience of implementation, the backend must always query
  * for "changed" nodes *after* "added" and "deleted" nodes. in other
  * words, the backend will only treat a node as "changed" if it is neither
  * "added" nor "deleted". currently there are only two places that perform
@@ -2102,6 +2866,12 @@ Cstore::markCfgPathCommitted(const Cpath& path_comps, bool is_delete)
   return mark_committed(is_delete);
 }
 
+int
+Cstore::cmpNodeNames(const string& a, const string& b)
+{
+  return VersionKey::cmp(a.data(), a.size(), b.data(), b.size());
+}
+
 
 ////// protected functions
 Cstore::SavePaths::~SavePaths() {
@@ -2158,10 +2928,10 @@ Cstore::assert_internal(bool cond, const char *fmt, ...)
 
 
 ////// private functions
-bool
-Cstore::sort_func_deb_version(string a, string b)
+void
+Cstore::sort_func_deb_version(vector<string>& nvec)
 {
-  return debVS.CmpVersion(a, b) < 0;
+  VersionKey::sort(nvec);
 }
 
 void
@@ -2172,7 +2942,7 @@ Cstore::sort_nodes(vector<string>& nvec, unsigned int sort_alg)
   if (p == _sort_func_map.end()) {
     return;
   }
-  sort(nvec.begin(), nvec.end(), p->second);
+  p->second(nvec);
 }
 
 /* try to append the logical path to template path.
@@ -2210,6 +2980,8 @@ Cstore::append_tmpl_path(const Cpath& path_comps, bool& is_tag)
 
 typedef MapT<Cpath, tr1::shared_ptr<Ctemplate>, CpathHash> TmplCacheT;
 static TmplCacheT _tmpl_cache;
+// the cache is shared by read views in different threads
+static std::mutex _tmpl_cache_mutex;
 
 /* check whether specified "logical path" is valid template path.
  * then template at the path is parsed.
@@ -2237,6 +3009,7 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
     }
     // we are starting from root => caching applies
     do_caching = true;
+    std::lock_guard<std::mutex> lock(_tmpl_cache_mutex);
     TmplCacheT::iterator p = _tmpl_cache.find(path_comps);
     if (p != _tmpl_cache.end()) {
       // return cached
@@ -2380,11 +3153,24 @@ Cstore::get_parsed_tmpl(const Cpath& path_comps, bool validate_vals,
 
   if (do_caching && rtmpl.get()) {
     // only cache if we got a valid template
+    std::lock_guard<std::mutex> lock(_tmpl_cache_mutex);
     _tmpl_cache[path_comps] = rtmpl;
   }
   return rtmpl;
 }
 
+// same as the caching in get_parsed_tmpl()
+void
+Cstore::cache_tmpl(const Cpath& path_comps,
+                   const tr1::shared_ptr<Ctemplate>& def)
+{
+  if (!def.get() || path_comps.size() == 0 || !tmpl_path_at_root()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_tmpl_cache_mutex);
+  _tmpl_cache[path_comps] = def;
+}
+
 /* check if specified "logical path" is valid for "activate" or
  * "deactivate" operation.
  * return parsed template if valid. otherwise return 0.
@@ -2540,6 +3326,178 @@ Cstore::cfg_path_exists(const Cpath& path_comps, bool active_cfg,
   return ret;
 }
 
+/* delete specified "logical path" from "working config".
+ *   def: parsed template of the path (see get_parsed_tmpl()).
+ * return true if successful. otherwise return false.
+ */
+bool
+Cstore::delete_cfg_path(const Cpath& path_comps,
+                        const tr1::shared_ptr<Ctemplate>& def)
+{
+  if (!cfg_path_exists(path_comps, false, true)) {
+    output_user("Nothing to delete (the specified %s does not exist)\n",
+                (!def->isValue() || def->isTag()) ? "node" : "value");
+    // treat as success
+    return true;
+  }
+
+  /* path already validated and in working config.
+   * cases:
+   *   1. has default value
+   *      => replace current value with default
+   *   2. no default value
+   *      => remove config path
+   */
+  if (def->getDefault()) {
+    // case 1. construct path for value file.
+    #if __GNUC__ < 6
+    auto_ptr<SavePaths> save(create_save_paths());
+    #else
+    unique_ptr<SavePaths> save(create_save_paths());
+    #endif
+    append_cfg_path(path_comps);
+    if (def->isValue()) {
+      // last comp is "value". need to go up 1 level.
+      pop_cfg_path();
+    }
+
+    /* assume default value is valid (parser should have validated).
+     * also call unmark_deactivated() in case the node being deleted was
+     * also deactivated. note that unmark_deactivated() succeeds if it's
+     * not marked deactivated. also mark "changed".
+     */
+    if (!(write_value(def->getDefault()) && mark_display_default()
+          && unmark_deactivated() && mark_changed_with_ancestors())) {
+      output_user("Failed to set default value during delete\n");
+      return false;
+    }
+    return true;
+  }
+
+  /* case 2.
+   * sub-cases:
+   *   (1) last path comp is "value", i.e., tag (value of tag node),
+   *       value of single-value node, or value of multi-value node.
+   *       (a) value of single-value node
+   *           => remove node
+   *       (b) value of multi-value node
+   *           => remove value. remove node if last value.
+   *       (c) value of tag node (i.e., tag)
+   *           => remove tag. remove node if last tag.
+   *   (2) last path comp is "node", i.e., typeless node, tag node,
+   *       single-value node, or multi-value node.
+   *       => remove node
+   */
+  bool ret = false;
+  #if __GNUC__ < 6
+  auto_ptr<SavePaths> save(create_save_paths());
+  #else
+  unique_ptr<SavePaths> save(create_save_paths());
+  #endif
+  append_cfg_path(path_comps);
+  if (!def->isValue()) {
+    // sub-case (2)
+    ret = remove_node();
+  } else {
+    // last comp is value
+    if (def->isTag()) {
+      // sub-case (1c)
+      ret = remove_tag();
+    } else if (def->isMulti()) {
+      // sub-case (1b)
+      pop_cfg_path();
+      ret = remove_value_from_multi(path_comps[path_comps.size() - 1]);
+    } else {
+      // sub-case (1a). delete node at 1 level up.
+      pop_cfg_path();
+      ret = remove_node();
+    }
+  }
+  if (ret) {
+    // mark changed
+    ret = mark_changed_with_ancestors();
+  }
+  if (!ret) {
+    output_user("Failed to delete specified config path\n");
+  }
+  return ret;
+}
+
+/* perform "comment" in working config on specified path.
+ *   def: parsed template of the path (see get_parsed_tmpl()).
+ * return true if valid. otherwise return false.
+ */
+bool
+Cstore::comment_cfg_path(const Cpath& path_comps, const string& comment,
+                         const tr1::shared_ptr<Ctemplate>& def)
+{
+  // here we want to include deactivated nodes
+  if (!cfg_path_exists(path_comps, false, true)) {
+    output_user("The specified config node does not exist\n");
+    return false;
+  }
+  if (def->isLeafValue()) {
+    /* XXX differ from the original implementation, which allows commenting
+     *     on a "value" BUT silently "promote" the comment to the parent
+     *     "node". this will probably create confusion for the user.
+     *
+     *     just disallow such cases here.
+     */
+    output_user("Cannot comment on config values\n");
+    return false;
+  }
+  if (def->isTagNode()) {
+    /* XXX follow original implementation and disallow comment on a
+     *     "tag node". this is because "show" does not display such
+     *     comments (see bug 5794).
+     */
+    output_user("Cannot add comment at this level\n");
+    return false;
+  }
+  if (comment.find_first_of('*') != string::npos) {
+    // don't allow '*'. this is due to config files using C-style /**/
+    // comments. this probably belongs to lower-level, but we are enforcing
+    // it here.
+    output_user("Cannot use the '*' character in a comment\n");
+    return false;
+  }
+  if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION BELOW") != string::npos){
+    // Don't allow users to set configuration migration comments
+    return false;
+  }
+  if (comment.find("CONFIGURATION COMMENTED OUT DURING MIGRATION ABOVE") != string::npos){
+    // Don't allow users to set configuration migration comments
+    return false;
+  }
+
+  bool ret = false;
+  {
+    #if __GNUC__ < 6
+    auto_ptr<SavePaths> save(create_save_paths());
+    #else
+    unique_ptr<SavePaths> save(create_save_paths());
+    #endif
+    append_cfg_path(path_comps);
+    if (comment == "") {
+      // follow original impl: empty comment => remove it
+      ret = remove_comment();
+      if (!ret) {
+        output_user("Failed to remove comment for specified config node\n");
+      }
+    } else {
+      ret = set_comment(comment);
+      if (!ret) {
+        output_user("Failed to add comment for specified config node\n");
+      }
+    }
+  }
+  if (ret) {
+    // mark the root as changed for "comment"
+    ret = mark_changed_with_ancestors();
+  }
+  return ret;
+}
+
 /* set specified "logical path" in "working config".
  *   output: whether to generate output
  * return true if successful. otherwise return false.
@@ -2925,8 +3883,12 @@ Cstore::add_tag(unsigned int tlimit)
   string t;
   pop_cfg_path(t);
   vector<string> cnodes;
-  // get child nodes, excluding deactivated ones.
-  get_all_child_node_names(cnodes, false, false);
+  if (tlimit > 0) {
+    /* get child nodes, excluding deactivated ones. only needed for the
+     * limit (listing all tags for each new one is quadratic).
+     */
+    get_all_child_node_names(cnodes, false, false);
+  }
   bool ret = false;
   do {
     if (tlimit > 0 && tlimit <= cnodes.size()) {
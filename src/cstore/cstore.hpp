@@ -61,6 +61,13 @@ public:
   // factory functions
   static Cstore *createCstore(bool use_edit_level = false);
   static Cstore *createCstore(const string& session_id, string& env);
+  /* return a new cstore for the same config and current paths, to be used
+   * only for reading the config and templates. each read view has its own
+   * path state so that different threads can each use their own view (the
+   * shared caches are synchronized). caller owns the returned object.
+   * return NULL if the backend does not support read views.
+   */
+  Cstore *createReadView() { return new_read_view(); };
 
   // constants
   static const string C_NODE_STATUS_DELETED;
@@ -70,6 +77,12 @@ public:
 
   static const string C_ENV_EDIT_LEVEL;
   static const string C_ENV_TMPL_LEVEL;
+  static const string C_ENV_COMMIT_DURABILITY;
+
+  // durability modes for the committed config (see syncCommittedConfig())
+  static const string C_DURABILITY_NONE;
+  static const string C_DURABILITY_CONFIG;
+  static const string C_DURABILITY_SYSTEM;
 
   static const string C_ENV_SHELL_PROMPT;
   static const string C_ENV_SHELL_CWORDS;
@@ -101,6 +114,12 @@ public:
   bool validateTmplPath(const Cpath& path_comps, bool validate_vals);
   tr1::shared_ptr<Ctemplate> parseTmpl(const Cpath& path_comps,
                                        bool validate_vals);
+  /* record the template of a path that is known to be the same as that of
+   * another path already parsed (e.g., another value of the same tag node),
+   * so that later lookups of the path are cached as if it had been parsed.
+   */
+  void cacheTmpl(const Cpath& path_comps,
+                 const tr1::shared_ptr<Ctemplate>& def);
   bool getParsedTmpl(const Cpath& path_comps, MapT<string, string>& tmap,
                      bool allow_val = true);
   void tmplGetChildNodes(const Cpath& path_comps, vector<string>& cnodes);
@@ -177,6 +196,7 @@ public:
   bool markCfgPathCommitted(const Cpath& path_comps, bool is_delete);
   virtual bool clearCommittedMarkers() = 0;
   virtual bool commitConfig(commit::PrioNode& pnode) = 0;
+  bool syncCommittedConfig();
   virtual bool getCommitLock() = 0;
     /* note: the getCommitLock() function must guarantee lock release/cleanup
      * upon process termination (either normally or abnormally). there is no
@@ -184,6 +204,8 @@ public:
      */
   // load
   bool loadFile(const char *filename);
+  bool applyCmds(const vector<Cpath>& del_list, const vector<Cpath>& set_list,
+                 const vector<Cpath>& com_list);
 
   /******
    * these functions are observers of the current "working config" or
@@ -296,6 +318,10 @@ public:
                         unsigned int sort_alg = SORT_DEFAULT) {
     sort_nodes(nvec, sort_alg);
   };
+  /* compare two node names in the default sort order (see sortNodes()).
+   * return value is negative, 0, or positive (like strcmp()).
+   */
+  static int cmpNodeNames(const string& a, const string& b);
 
   /* these are internal API functions and operate on current cfg and
    * tmpl paths during cstore operations. they are only used to work around
@@ -322,6 +348,8 @@ private:
   ////// member class
   // for variable reference
   class VarRef;
+  // applies commands to working config in bulk (see applyCmds())
+  class CmdApplier;
 
   ////// virtual
   /* "path modifiers"
@@ -373,6 +401,10 @@ private:
   virtual bool remove_comment() = 0;
   virtual bool set_comment(const string& comment) = 0;
   virtual bool discard_changes(unsigned long long& num_removed) = 0;
+  // flush what commit wrote (committed config and session state)
+  virtual bool sync_committed_config() = 0;
+  // see createReadView()
+  virtual Cstore *new_read_view() = 0;
 
   // observers for current work path
   virtual bool cfg_node_changed() = 0;
@@ -410,10 +442,10 @@ private:
 
   ////// implemented
   // for sorting
-  typedef bool (*SortFuncT)(std::string, std::string);
+  typedef void (*SortFuncT)(std::vector<std::string>&);
   static MapT<unsigned int, SortFuncT> _sort_func_map;
 
-  static bool sort_func_deb_version(string a, string b);
+  static void sort_func_deb_version(vector<string>& nvec);
   static void sort_nodes(vector<string>& nvec,
                          unsigned int sort_alg = SORT_DEFAULT);
 
@@ -458,6 +490,8 @@ private:
     string dummy;
     return get_parsed_tmpl(path_comps, validate_vals, dummy);
   };
+  void cache_tmpl(const Cpath& path_comps,
+                  const tr1::shared_ptr<Ctemplate>& def);
   tr1::shared_ptr<Ctemplate> validate_act_deact(const Cpath& path_comps,
                                                 const char *op);
   bool validate_rename_copy(const Cpath& args, const char *op);
@@ -466,6 +500,10 @@ private:
   bool cfg_path_exists(const Cpath& path_comps, bool active_cfg,
                        bool include_deactivated);
   bool set_cfg_path(const Cpath& path_comps, bool output);
+  bool delete_cfg_path(const Cpath& path_comps,
+                       const tr1::shared_ptr<Ctemplate>& def);
+  bool comment_cfg_path(const Cpath& path_comps, const string& comment,
+                        const tr1::shared_ptr<Ctemplate>& def);
   void get_child_nodes_status(const Cpath& path_comps,
                               MapT<string, string>& cmap,
                               vector<string> *sorted_keys);
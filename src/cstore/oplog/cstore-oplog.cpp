@@ -0,0 +1,1649 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include <cli_cstore.h>
+#include <cstore/oplog/cstore-oplog.hpp>
+#include <cnode/cnode.hpp>
+#include <commit/commit-algorithm.hpp>
+
+namespace cstore { // begin namespace cstore
+namespace oplog { // begin namespace oplog
+
+////// constants
+const string OplogCstore::C_BACKEND_NAME = "oplog";
+
+const string OplogCstore::C_ENV_OPLOG_ROOT = "VYATTA_OPLOG_DIR";
+const string OplogCstore::C_ENV_SESSION_LOG = "VYATTA_OPLOG_SESSION";
+
+const string OplogCstore::C_DEF_OPLOG_ROOT = "/opt/vyatta/config/oplog";
+const string OplogCstore::C_SNAPSHOT_FILE = "active.snap";
+const string OplogCstore::C_LOG_FILE = "active.log";
+const string OplogCstore::C_LOCK_FILE = "active.lock";
+const string OplogCstore::C_SESSION_PREFIX = "session_";
+
+static const string C_OPLOG_MAGIC = "vyatta-oplog";
+static const string C_OPLOG_VERSION = "1";
+
+// log operations
+enum {
+  OP_HEADER = 1,
+  OP_COMMIT,
+  OP_ADD_NODE,
+  OP_REMOVE_NODE,
+  OP_SET_VALUES,
+  OP_CLEAR_VALUES,
+  OP_SET_COMMENT,
+  OP_REMOVE_COMMENT,
+  OP_MARK,
+  OP_UNMARK,
+  OP_UNMARK_DESCENDANTS,
+  OP_MARK_CHANGED_ANCESTORS,
+  OP_RENAME,
+  OP_COPY,
+  OP_PUT_TREE,
+  OP_SET_UNSAVED
+};
+
+// markers (argument of mark/unmark operations)
+static const char FLAG_DEFAULT = 'd';
+static const char FLAG_DEACTIVATED = 'x';
+static const char FLAG_CHANGED = 'c';
+
+// flag bits in encoded tree
+static const unsigned char TF_VALUE = 0x01;
+static const unsigned char TF_COMMENT = 0x02;
+static const unsigned char TF_DEACTIVATED = 0x04;
+static const unsigned char TF_DEFAULT = 0x08;
+static const unsigned char TF_CHANGED = 0x10;
+
+
+////// in-memory tree
+class LogNode {
+public:
+  LogNode() : has_value(false), has_comment(false), deactivated(false),
+              is_default(false), changed(false) {};
+
+  LogNodePtr clone() const {
+    LogNodePtr n(new LogNode(*this));
+    MapT<string, LogNodePtr>::iterator it = n->children.begin();
+    for (; it != n->children.end(); ++it) {
+      it->second = it->second->clone();
+    }
+    return n;
+  };
+  /* copy as it ends up in the active config, i.e., without the markers
+   * that UnionfsCstore filters out when copying the working config.
+   */
+  LogNodePtr committed_clone() const {
+    LogNodePtr n(new LogNode(*this));
+    n->deactivated = false;
+    n->changed = false;
+    MapT<string, LogNodePtr>::iterator it = n->children.begin();
+    for (; it != n->children.end(); ++it) {
+      it->second = it->second->committed_clone();
+    }
+    return n;
+  };
+  bool *flag(char f) {
+    switch (f) {
+    case FLAG_DEFAULT:
+      return &is_default;
+    case FLAG_DEACTIVATED:
+      return &deactivated;
+    case FLAG_CHANGED:
+      return &changed;
+    }
+    return 0;
+  };
+
+  MapT<string, LogNodePtr> children;
+  vector<string> values;
+  string comment;
+  bool has_value;
+  bool has_comment;
+  bool deactivated;
+  bool is_default;
+  bool changed;
+};
+
+class LogRecord {
+public:
+  LogRecord(int o = 0) : op(o) {};
+
+  int op;
+  Cpath path;
+  vector<string> args;
+};
+
+
+////// static
+static void
+_put_u32(string& buf, uint32_t v)
+{
+  buf.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void
+_put_str(string& buf, const string& s)
+{
+  _put_u32(buf, s.size());
+  buf.append(s);
+}
+
+static bool
+_get_u32(const char *& p, const char *end, uint32_t& v)
+{
+  if (static_cast<size_t>(end - p) < sizeof(v)) {
+    return false;
+  }
+  memcpy(&v, p, sizeof(v));
+  p += sizeof(v);
+  return true;
+}
+
+static bool
+_get_str(const char *& p, const char *end, string& s)
+{
+  uint32_t len;
+  if (!_get_u32(p, end, len) || static_cast<size_t>(end - p) < len) {
+    return false;
+  }
+  s.assign(p, len);
+  p += len;
+  return true;
+}
+
+// FNV-1a
+static uint32_t
+_checksum(const char *data, size_t len)
+{
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/* record format:
+ *   <body length> <body> <checksum of body>
+ * body:
+ *   <op> <# path comps> <path comps...> <# args> <args...>
+ * all integers are 32-bit and all strings are length-prefixed.
+ */
+static void
+_encode_record(const LogRecord& rec, string& buf)
+{
+  string body;
+  _put_u32(body, rec.op);
+  _put_u32(body, rec.path.size());
+  for (size_t i = 0; i < rec.path.size(); i++) {
+    _put_str(body, rec.path[i]);
+  }
+  _put_u32(body, rec.args.size());
+  for (size_t i = 0; i < rec.args.size(); i++) {
+    _put_str(body, rec.args[i]);
+  }
+  _put_u32(buf, body.size());
+  buf.append(body);
+  _put_u32(buf, _checksum(body.data(), body.size()));
+}
+
+/* decode the record at p. return false if the record is incomplete or
+ * corrupted, e.g., the tail of a log that was being written when the
+ * system went down.
+ */
+static bool
+_decode_record(const char *& p, const char *end, LogRecord& rec)
+{
+  const char *q = p;
+  uint32_t len, csum, v, n;
+  if (!_get_u32(q, end, len) || static_cast<size_t>(end - q) < len) {
+    return false;
+  }
+  const char *body = q;
+  const char *bend = q + len;
+  q = bend;
+  if (!_get_u32(q, end, csum) || csum != _checksum(body, len)) {
+    return false;
+  }
+  if (!_get_u32(body, bend, v)) {
+    return false;
+  }
+  rec.op = v;
+  rec.path.clear();
+  rec.args.clear();
+  if (!_get_u32(body, bend, n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    string s;
+    if (!_get_str(body, bend, s)) {
+      return false;
+    }
+    rec.path.push(s);
+  }
+  if (!_get_u32(body, bend, n)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    string s;
+    if (!_get_str(body, bend, s)) {
+      return false;
+    }
+    rec.args.push_back(s);
+  }
+  p = q;
+  return true;
+}
+
+static void
+_encode_tree(const LogNode& node, string& buf)
+{
+  unsigned char flags = ((node.has_value ? TF_VALUE : 0)
+                         | (node.has_comment ? TF_COMMENT : 0)
+                         | (node.deactivated ? TF_DEACTIVATED : 0)
+                         | (node.is_default ? TF_DEFAULT : 0)
+                         | (node.changed ? TF_CHANGED : 0));
+  _put_u32(buf, flags);
+  if (node.has_value) {
+    _put_u32(buf, node.values.size());
+    for (size_t i = 0; i < node.values.size(); i++) {
+      _put_str(buf, node.values[i]);
+    }
+  }
+  if (node.has_comment) {
+    _put_str(buf, node.comment);
+  }
+  _put_u32(buf, node.children.size());
+  MapT<string, LogNodePtr>::const_iterator it = node.children.begin();
+  for (; it != node.children.end(); ++it) {
+    _put_str(buf, it->first);
+    _encode_tree(*(it->second), buf);
+  }
+}
+
+static LogNodePtr
+_decode_tree(const char *& p, const char *end)
+{
+  LogNodePtr node(new LogNode);
+  uint32_t flags, n;
+  if (!_get_u32(p, end, flags)) {
+    return LogNodePtr();
+  }
+  node->has_value = (flags & TF_VALUE);
+  node->has_comment = (flags & TF_COMMENT);
+  node->deactivated = (flags & TF_DEACTIVATED);
+  node->is_default = (flags & TF_DEFAULT);
+  node->changed = (flags & TF_CHANGED);
+  if (node->has_value) {
+    if (!_get_u32(p, end, n)) {
+      return LogNodePtr();
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      string s;
+      if (!_get_str(p, end, s)) {
+        return LogNodePtr();
+      }
+      node->values.push_back(s);
+    }
+  }
+  if (node->has_comment && !_get_str(p, end, node->comment)) {
+    return LogNodePtr();
+  }
+  if (!_get_u32(p, end, n)) {
+    return LogNodePtr();
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    string name;
+    if (!_get_str(p, end, name)) {
+      return LogNodePtr();
+    }
+    LogNodePtr c = _decode_tree(p, end);
+    if (!c) {
+      return LogNodePtr();
+    }
+    node->children[name] = c;
+  }
+  return node;
+}
+
+static LogNode *
+_find_node(const LogNodePtr& root, const Cpath& path, size_t len)
+{
+  LogNode *n = root.get();
+  for (size_t i = 0; n && i < len; i++) {
+    MapT<string, LogNodePtr>::iterator it = n->children.find(path[i]);
+    n = ((it != n->children.end()) ? it->second.get() : 0);
+  }
+  return n;
+}
+
+static LogNode *
+_find_node(const LogNodePtr& root, const Cpath& path)
+{
+  return _find_node(root, path, path.size());
+}
+
+// put subtree at the specified path, creating any missing ancestors
+static void
+_put_tree(LogNodePtr& root, const Cpath& path, const LogNodePtr& sub)
+{
+  if (path.size() == 0) {
+    root = sub;
+    return;
+  }
+  if (!root) {
+    root.reset(new LogNode);
+  }
+  LogNode *n = root.get();
+  for (size_t i = 0; i < (path.size() - 1); i++) {
+    LogNodePtr& c = n->children[path[i]];
+    if (!c) {
+      c.reset(new LogNode);
+    }
+    n = c.get();
+  }
+  n->children[path.back()] = sub;
+}
+
+static void
+_remove_tree(LogNodePtr& root, const Cpath& path)
+{
+  if (path.size() == 0) {
+    root.reset();
+    return;
+  }
+  LogNode *p = _find_node(root, path, path.size() - 1);
+  if (p) {
+    p->children.erase(path.back());
+  }
+}
+
+static void
+_unmark_descendants(LogNode *node, char f, bool include_self)
+{
+  if (include_self) {
+    *(node->flag(f)) = false;
+  }
+  MapT<string, LogNodePtr>::iterator it = node->children.begin();
+  for (; it != node->children.end(); ++it) {
+    _unmark_descendants(it->second.get(), f, true);
+  }
+}
+
+// generate the records that turn "from" into "to" at the specified path
+static void
+_diff_tree(const LogNode *from, const LogNode *to, Cpath& path,
+           vector<LogRecord>& recs)
+{
+  LogRecord rec;
+  rec.path = path;
+  if (to->has_value != from->has_value
+      || (to->has_value && to->values != from->values)) {
+    rec.op = (to->has_value ? OP_SET_VALUES : OP_CLEAR_VALUES);
+    rec.args = to->values;
+    recs.push_back(rec);
+    rec.args.clear();
+  }
+  if (to->has_comment != from->has_comment
+      || (to->has_comment && to->comment != from->comment)) {
+    rec.op = (to->has_comment ? OP_SET_COMMENT : OP_REMOVE_COMMENT);
+    if (to->has_comment) {
+      rec.args.push_back(to->comment);
+    }
+    recs.push_back(rec);
+    rec.args.clear();
+  }
+  const char flags[] = { FLAG_DEFAULT, FLAG_DEACTIVATED, FLAG_CHANGED };
+  for (size_t i = 0; i < sizeof(flags); i++) {
+    bool t = *(const_cast<LogNode *>(to)->flag(flags[i]));
+    bool f = *(const_cast<LogNode *>(from)->flag(flags[i]));
+    if (t != f) {
+      rec.op = (t ? OP_MARK : OP_UNMARK);
+      rec.args.push_back(string(1, flags[i]));
+      recs.push_back(rec);
+      rec.args.clear();
+    }
+  }
+
+  MapT<string, LogNodePtr>::const_iterator it = from->children.begin();
+  for (; it != from->children.end(); ++it) {
+    if (to->children.find(it->first) == to->children.end()) {
+      rec.op = OP_REMOVE_NODE;
+      rec.path.push(it->first);
+      recs.push_back(rec);
+      rec.path.pop();
+    }
+  }
+  for (it = to->children.begin(); it != to->children.end(); ++it) {
+    MapT<string, LogNodePtr>::const_iterator fit
+      = from->children.find(it->first);
+    path.push(it->first);
+    if (fit == from->children.end()) {
+      rec.op = OP_PUT_TREE;
+      rec.path = path;
+      rec.args.push_back("");
+      _encode_tree(*(it->second), rec.args[0]);
+      recs.push_back(rec);
+      rec.args.clear();
+    } else {
+      _diff_tree(fit->second.get(), it->second.get(), path, recs);
+    }
+    path.pop();
+  }
+}
+
+static void
+_make_header(LogRecord& rec, const string& gen)
+{
+  rec.op = OP_HEADER;
+  rec.args.push_back(C_OPLOG_MAGIC);
+  rec.args.push_back(C_OPLOG_VERSION);
+  rec.args.push_back(gen);
+}
+
+static bool
+_check_header(const LogRecord& rec, unsigned long long& gen)
+{
+  if (rec.op != OP_HEADER || rec.args.size() != 3
+      || rec.args[0] != C_OPLOG_MAGIC || rec.args[1] != C_OPLOG_VERSION) {
+    return false;
+  }
+  gen = strtoull(rec.args[2].c_str(), NULL, 10);
+  return true;
+}
+
+/* get the log position ("<gen>:<offset>") that a session delta was
+ * recorded against.
+ */
+static bool
+_check_session_header(const LogRecord& rec, unsigned long long& gen,
+                      unsigned long long& offset)
+{
+  if (!_check_header(rec, gen)) {
+    return false;
+  }
+  size_t i = rec.args[2].find(':');
+  offset = ((i != string::npos)
+            ? strtoull(rec.args[2].c_str() + i + 1, NULL, 10) : 0);
+  return true;
+}
+
+static string
+_ull_to_str(unsigned long long v)
+{
+  std::ostringstream s;
+  s << v;
+  return s.str();
+}
+
+// read the whole file. return false if it doesn't exist or can't be read.
+static bool
+_read_file(const FsPath& file, string& data)
+{
+  int fd = open(file.path_cstr(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  bool ret = false;
+  if (fstat(fd, &st) == 0) {
+    data.resize(st.st_size);
+    size_t done = 0;
+    while (done < data.size()) {
+      ssize_t r = read(fd, &(data[done]), data.size() - done);
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      if (r <= 0) {
+        break;
+      }
+      done += r;
+    }
+    data.resize(done);
+    ret = true;
+  }
+  close(fd);
+  return ret;
+}
+
+static bool
+_write_all(int fd, const string& data)
+{
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t r = write(fd, data.data() + done, data.size() - done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+
+////// constructor/destructor
+// see UnionfsCstore for details on the two constructors
+OplogCstore::OplogCstore(bool use_edit_level)
+  : UnionfsCstore(use_edit_level)
+{
+  init_oplog();
+  char *val;
+  if ((val = getenv(C_ENV_SESSION_LOG.c_str()))) {
+    session_file = val;
+  }
+}
+
+OplogCstore::OplogCstore(const string& sid, string& env)
+  : UnionfsCstore(sid, env)
+{
+  init_oplog();
+  session_file = oplog_root;
+  session_file.push(C_SESSION_PREFIX + sid);
+
+  // the rest of the session uses the same session log
+  string declr = " declare -x -r "; // readonly vars
+  env += "; {";
+  env += (declr + C_ENV_SESSION_LOG + "=" + session_file.path_cstr() + ";");
+  env += " } >&/dev/null || true";
+}
+
+OplogCstore::~OplogCstore()
+{
+}
+
+void
+OplogCstore::init_oplog()
+{
+  char *val;
+  if ((val = getenv(C_ENV_OPLOG_ROOT.c_str()))) {
+    oplog_root = val;
+  } else {
+    oplog_root = C_DEF_OPLOG_ROOT;
+  }
+  snapshot_file = oplog_root;
+  snapshot_file.push(C_SNAPSHOT_FILE);
+  log_file = oplog_root;
+  log_file.push(C_LOG_FILE);
+  lock_file = oplog_root;
+  lock_file.push(C_LOCK_FILE);
+  active_loaded = false;
+  work_loaded = false;
+  log_valid = false;
+  unsaved = false;
+  active_gen = 0;
+  active_log_size = 0;
+  session_log_size = 0;
+  num_delta_records = 0;
+}
+
+
+////// public virtual functions declared in base class
+bool
+OplogCstore::markSessionUnsaved()
+{
+  if (sessionUnsaved()) {
+    // already marked. treat as success.
+    return true;
+  }
+  LogRecord rec(OP_SET_UNSAVED);
+  rec.args.push_back("1");
+  if (!work_op(rec)) {
+    output_internal("failed to mark unsaved [%s]\n",
+                    session_file.path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::unmarkSessionUnsaved()
+{
+  if (!sessionUnsaved()) {
+    // not marked. treat as success.
+    return true;
+  }
+  LogRecord rec(OP_SET_UNSAVED);
+  rec.args.push_back("0");
+  if (!work_op(rec)) {
+    output_internal("failed to unmark unsaved [%s]\n",
+                    session_file.path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::sessionUnsaved()
+{
+  return (load_work() && unsaved);
+}
+
+bool
+OplogCstore::sessionChanged()
+{
+  return (load_work() && work_tree->changed);
+}
+
+bool
+OplogCstore::setupSession()
+{
+  if (session_file.length() == 0) {
+    output_internal("setup session without session log\n");
+    return false;
+  }
+  try {
+    b_fs::create_directories(oplog_root.path_cstr());
+    b_fs::create_directories(tmp_root.path_cstr());
+  } catch (...) {
+    output_internal("setup session failed to create session directories\n");
+    return false;
+  }
+  if (!path_exists(snapshot_file)) {
+    // first use of the store. save the imported config.
+    int lfd = lock_log();
+    if (lfd < 0) {
+      return false;
+    }
+    bool ret = (reload_active()
+                && (path_exists(snapshot_file) || compact_log()));
+    close(lfd);
+    if (!ret) {
+      return false;
+    }
+  }
+  if (!load_active()) {
+    return false;
+  }
+  if (path_exists(session_file)) {
+    // session already exists
+    return true;
+  }
+  work_tree = active_tree->clone();
+  work_loaded = true;
+  unsaved = false;
+  return rewrite_session();
+}
+
+bool
+OplogCstore::teardownSession()
+{
+  if (!inSession()) {
+    output_internal("teardown invalid session [%s]\n",
+                    session_file.path_cstr());
+    return false;
+  }
+  bool ret = false;
+  try {
+    if (b_fs::remove(session_file.path_cstr())) {
+      b_fs::remove_all(tmp_root.path_cstr());
+      ret = true;
+    }
+  } catch (...) {
+  }
+  if (!ret) {
+    output_internal("failed to remove session [%s]\n",
+                    session_file.path_cstr());
+  }
+  work_loaded = false;
+  return ret;
+}
+
+bool
+OplogCstore::inSession()
+{
+  return (session_file.length() > 0 && path_exists(session_file));
+}
+
+/* same decisions as UnionfsCstore::construct_commit_active(), applied to
+ * the in-memory trees.
+ */
+void
+OplogCstore::construct_commit_tree(commit::PrioNode& node,
+                                   LogNodePtr& nactive)
+{
+  const Cpath& path = node.getCommitPath();
+  if (_find_node(nactive, path)) {
+    _remove_tree(nactive, path);
+    cnode::CfgNode *c = node.getCfgNode();
+    if (c && c->isTag() && path.size() > 0) {
+      LogNode *p = _find_node(nactive, path, path.size() - 1);
+      if (p && p->children.empty()) {
+        Cpath ppath(path);
+        ppath.pop();
+        _remove_tree(nactive, ppath);
+      }
+    }
+  }
+  if (node.succeeded()) {
+    // prio subtree succeeded
+    LogNode *w = _find_node(work_tree, path);
+    if (w) {
+      _put_tree(nactive, path, w->committed_clone());
+    }
+    if (!node.hasSubtreeFailure()) {
+      // whole subtree succeeded => stop recursion
+      return;
+    }
+  } else {
+    // prio subtree failed
+    LogNode *a = _find_node(active_tree, path);
+    if (a) {
+      _put_tree(nactive, path, a->clone());
+    }
+    if (!node.hasSubtreeSuccess()) {
+      // whole subtree failed => stop recursion
+      return;
+    }
+  }
+  for (size_t i = 0; i < node.numChildNodes(); i++) {
+    construct_commit_tree(*(node.childAt(i)), nactive);
+  }
+}
+
+/* the trees may have been loaded long before the commit lock was taken
+ * (e.g., while the commit tree was being built), and other sessions may
+ * have committed since. so everything below is done under the log lock
+ * against the active config as it is now in the log.
+ */
+bool
+OplogCstore::commitConfig(commit::PrioNode& node)
+{
+  int lfd = lock_log();
+  if (lfd < 0) {
+    return false;
+  }
+  bool ret = (reload_active() && load_work() && commit_locked(node));
+  close(lfd);
+  return ret;
+}
+
+// see commitConfig(). the log lock must be held.
+bool
+OplogCstore::commit_locked(commit::PrioNode& node)
+{
+  LogNodePtr nactive;
+  construct_commit_tree(node, nactive);
+  if (!nactive) {
+    nactive.reset(new LogNode);
+  }
+
+  // append the changes as one transaction
+  vector<LogRecord> recs;
+  Cpath root;
+  _diff_tree(active_tree.get(), nactive.get(), root, recs);
+  if (recs.size() > 0) {
+    recs.push_back(LogRecord(OP_COMMIT));
+    if (!ensure_log()
+        || !append_records(log_file, recs, active_log_size, true)) {
+      output_internal("failed to append commit to [%s]\n",
+                      log_file.path_cstr());
+      return false;
+    }
+  }
+  active_tree = nactive;
+
+  /* the working config loses the markers, same as the filtered copy that
+   * UnionfsCstore syncs back into the working config.
+   */
+  work_tree = work_tree->committed_clone();
+  unsaved = false;
+
+  if (active_log_size > C_COMPACT_THRESHOLD && !compact_log()) {
+    // the log is still valid, so just try again next time
+    output_internal("failed to compact [%s]\n", log_file.path_cstr());
+  }
+  return rewrite_session();
+}
+
+
+////// virtual functions defined in base class
+bool
+OplogCstore::cfg_node_exists(bool active_cfg)
+{
+  return (get_cur_node(active_cfg) != 0);
+}
+
+bool
+OplogCstore::add_node()
+{
+  LogRecord rec(OP_ADD_NODE);
+  get_cur_path(rec.path);
+  if (!work_op(rec)) {
+    output_internal("failed to add node [%s]\n", cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::remove_node()
+{
+  LogRecord rec(OP_REMOVE_NODE);
+  get_cur_path(rec.path);
+  if (!work_op(rec)) {
+    output_internal("failed to remove node [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+void
+OplogCstore::get_all_child_node_names_impl(vector<string>& cnodes,
+                                           bool active_cfg)
+{
+  LogNode *n = get_cur_node(active_cfg);
+  if (!n) {
+    return;
+  }
+  MapT<string, LogNodePtr>::iterator it = n->children.begin();
+  for (; it != n->children.end(); ++it) {
+    cnodes.push_back(it->first);
+  }
+}
+
+bool
+OplogCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
+{
+  LogNode *n = get_cur_node(active_cfg);
+  if (!n || !n->has_value) {
+    return false;
+  }
+  vvec.insert(vvec.end(), n->values.begin(), n->values.end());
+  return true;
+}
+
+bool
+OplogCstore::write_value_vec(const vector<string>& vvec, bool active_cfg)
+{
+  LogRecord rec(OP_SET_VALUES);
+  get_cur_path(rec.path);
+  rec.args = vvec;
+  if (!(active_cfg ? active_op(rec) : work_op(rec))) {
+    output_internal("failed to write node value [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::rename_child_node(const char *oname, const char *nname)
+{
+  LogRecord rec(OP_RENAME);
+  get_cur_path(rec.path);
+  rec.args.push_back(oname);
+  rec.args.push_back(nname);
+  if (!work_op(rec)) {
+    output_internal("cannot rename node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::copy_child_node(const char *oname, const char *nname)
+{
+  LogRecord rec(OP_COPY);
+  get_cur_path(rec.path);
+  rec.args.push_back(oname);
+  rec.args.push_back(nname);
+  if (!work_op(rec)) {
+    output_internal("cannot copy node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+    return false;
+  }
+  return true;
+}
+
+bool
+OplogCstore::mark_display_default()
+{
+  return mark_op(OP_MARK, FLAG_DEFAULT, "mark default");
+}
+
+bool
+OplogCstore::unmark_display_default()
+{
+  return mark_op(OP_UNMARK, FLAG_DEFAULT, "unmark default");
+}
+
+bool
+OplogCstore::marked_display_default(bool active_cfg)
+{
+  LogNode *n = get_cur_node(active_cfg);
+  return (n && n->is_default);
+}
+
+bool
+OplogCstore::marked_deactivated(bool active_cfg)
+{
+  LogNode *n = get_cur_node(active_cfg);
+  return (n && n->deactivated);
+}
+
+bool
+OplogCstore::mark_deactivated()
+{
+  return mark_op(OP_MARK, FLAG_DEACTIVATED, "mark deactivated");
+}
+
+bool
+OplogCstore::unmark_deactivated()
+{
+  return mark_op(OP_UNMARK, FLAG_DEACTIVATED, "unmark deactivated");
+}
+
+bool
+OplogCstore::unmark_deactivated_descendants()
+{
+  LogRecord rec(OP_UNMARK_DESCENDANTS);
+  get_cur_path(rec.path);
+  rec.args.push_back(string(1, FLAG_DEACTIVATED));
+  rec.args.push_back("0"); // don't unmark the node itself
+  if (!work_op(rec)) {
+    output_internal("failed to unmark deactivated descendants [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+// mark current work path and all ancestors as "changed"
+bool
+OplogCstore::mark_changed_with_ancestors()
+{
+  LogRecord rec(OP_MARK_CHANGED_ANCESTORS);
+  get_cur_path(rec.path);
+  if (!work_op(rec)) {
+    output_internal("failed to mark changed [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+/* remove all "changed" markers under the current work path. this is used,
+ * e.g., at the end of "commit" to reset a subtree.
+ */
+bool
+OplogCstore::unmark_changed_with_descendants()
+{
+  if (!get_cur_node(false)) {
+    // nothing to unmark
+    return true;
+  }
+  LogRecord rec(OP_UNMARK_DESCENDANTS);
+  get_cur_path(rec.path);
+  rec.args.push_back(string(1, FLAG_CHANGED));
+  rec.args.push_back("1");
+  if (!work_op(rec)) {
+    output_internal("failed to unmark changed with descendants [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+// remove the comment at the current work path
+bool
+OplogCstore::remove_comment()
+{
+  LogNode *n = get_cur_node(false);
+  if (!n || !n->has_comment) {
+    return false;
+  }
+  LogRecord rec(OP_REMOVE_COMMENT);
+  get_cur_path(rec.path);
+  if (!work_op(rec)) {
+    output_internal("failed to remove comment [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+// set comment at the current work path
+bool
+OplogCstore::set_comment(const string& comment)
+{
+  LogRecord rec(OP_SET_COMMENT);
+  get_cur_path(rec.path);
+  rec.args.push_back(comment);
+  return work_op(rec);
+}
+
+// get comment at the current work or active path
+bool
+OplogCstore::get_comment(string& comment, bool active_cfg)
+{
+  LogNode *n = get_cur_node(active_cfg);
+  if (!n || !n->has_comment) {
+    return false;
+  }
+  comment = n->comment;
+  return true;
+}
+
+// discard all changes in working config
+bool
+OplogCstore::discard_changes(unsigned long long& num_removed)
+{
+  if (!load_work()) {
+    output_internal("discard failed [%s]\n", session_file.path_cstr());
+    return false;
+  }
+  // unsaved marker is kept
+  num_removed = num_delta_records;
+  work_tree = active_tree->clone();
+  return rewrite_session();
+}
+
+/* commit already fsyncs the log transaction and the rewritten session
+ * file, so only the records appended to the session log since then
+ * (e.g., the unsaved marker) need to be flushed.
+ */
+bool
+OplogCstore::sync_committed_config()
+{
+  int fd = open(session_file.path_cstr(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return (errno == ENOENT);
+  }
+  bool ret = (fsync(fd) == 0);
+  close(fd);
+  return ret;
+}
+
+/* the config trees are loaded from the log into this object and are not
+ * shared, so read views are not supported (trees are built serially).
+ */
+Cstore *
+OplogCstore::new_read_view()
+{
+  return 0;
+}
+
+// whether current work path is "changed"
+bool
+OplogCstore::cfg_node_changed()
+{
+  LogNode *n = get_cur_node(false);
+  return (n && n->changed);
+}
+
+
+////// private functions
+// convert the current (escaped) work path into logical components
+void
+OplogCstore::get_cur_path(Cpath& path)
+{
+  get_edit_level(path);
+}
+
+LogNode *
+OplogCstore::get_cur_node(bool active_cfg)
+{
+  if (!(active_cfg ? load_active() : load_work())) {
+    return 0;
+  }
+  Cpath path;
+  get_cur_path(path);
+  return _find_node((active_cfg ? active_tree : work_tree), path);
+}
+
+bool
+OplogCstore::mark_op(int op, char flag, const char *what)
+{
+  LogNode *n = get_cur_node(false);
+  if (n && *(n->flag(flag)) == (op == OP_MARK)) {
+    // already in the requested state. treat as success.
+    return true;
+  }
+  LogRecord rec(op);
+  get_cur_path(rec.path);
+  rec.args.push_back(string(1, flag));
+  if (!work_op(rec)) {
+    output_internal("failed to %s [%s]\n", what, cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+/* apply one record to the specified tree. return false if the record does
+ * not apply to the tree (e.g., its path does not exist).
+ */
+bool
+OplogCstore::apply_record(LogNodePtr& root, const LogRecord& rec)
+{
+  const Cpath& path = rec.path;
+  LogNode *n = ((rec.op == OP_ADD_NODE || rec.op == OP_PUT_TREE)
+                ? 0 : _find_node(root, path));
+  switch (rec.op) {
+  case OP_SET_UNSAVED:
+    unsaved = (rec.args.size() > 0 && rec.args[0] == "1");
+    return true;
+  case OP_ADD_NODE: {
+    if (path.size() == 0) {
+      return false;
+    }
+    LogNode *p = _find_node(root, path, path.size() - 1);
+    if (!p || p->children.find(path.back()) != p->children.end()) {
+      return false;
+    }
+    p->children[path.back()] = LogNodePtr(new LogNode);
+    return true;
+  }
+  case OP_PUT_TREE: {
+    if (rec.args.size() != 1) {
+      return false;
+    }
+    const char *p = rec.args[0].data();
+    LogNodePtr sub = _decode_tree(p, p + rec.args[0].size());
+    if (!sub) {
+      return false;
+    }
+    _put_tree(root, path, sub);
+    return true;
+  }
+  case OP_MARK_CHANGED_ANCESTORS: {
+    // mark the existing part of the path
+    LogNode *a = root.get();
+    for (size_t i = 0; a; i++) {
+      a->changed = true;
+      if (i == path.size()) {
+        break;
+      }
+      MapT<string, LogNodePtr>::iterator it = a->children.find(path[i]);
+      a = ((it != a->children.end()) ? it->second.get() : 0);
+    }
+    return true;
+  }
+  }
+
+  if (!n) {
+    return false;
+  }
+  switch (rec.op) {
+  case OP_REMOVE_NODE:
+    if (path.size() == 0) {
+      return false;
+    }
+    _remove_tree(root, path);
+    return true;
+  case OP_SET_VALUES:
+    n->values = rec.args;
+    n->has_value = true;
+    return true;
+  case OP_CLEAR_VALUES:
+    n->values.clear();
+    n->has_value = false;
+    return true;
+  case OP_SET_COMMENT:
+    if (rec.args.size() != 1) {
+      return false;
+    }
+    n->comment = rec.args[0];
+    n->has_comment = true;
+    return true;
+  case OP_REMOVE_COMMENT:
+    n->comment.clear();
+    n->has_comment = false;
+    return true;
+  case OP_MARK:
+  case OP_UNMARK: {
+    bool *f = ((rec.args.size() == 1 && rec.args[0].size() == 1)
+               ? n->flag(rec.args[0][0]) : 0);
+    if (!f) {
+      return false;
+    }
+    *f = (rec.op == OP_MARK);
+    return true;
+  }
+  case OP_UNMARK_DESCENDANTS:
+    if (rec.args.size() != 2 || rec.args[0].size() != 1
+        || !n->flag(rec.args[0][0])) {
+      return false;
+    }
+    _unmark_descendants(n, rec.args[0][0], (rec.args[1] == "1"));
+    return true;
+  case OP_RENAME:
+  case OP_COPY: {
+    if (rec.args.size() != 2) {
+      return false;
+    }
+    MapT<string, LogNodePtr>::iterator oit = n->children.find(rec.args[0]);
+    if (oit == n->children.end()
+        || n->children.find(rec.args[1]) != n->children.end()) {
+      return false;
+    }
+    LogNodePtr c = oit->second;
+    if (rec.op == OP_RENAME) {
+      n->children.erase(oit);
+    } else {
+      c = c->clone();
+    }
+    n->children[rec.args[1]] = c;
+    return true;
+  }
+  }
+  return false;
+}
+
+// apply a record to the working config and record it in the session log
+bool
+OplogCstore::work_op(LogRecord& rec)
+{
+  if (!load_work() || !apply_record(work_tree, rec)) {
+    return false;
+  }
+  vector<LogRecord> recs(1, rec);
+  if (!append_records(session_file, recs, session_log_size, false)) {
+    output_internal("failed to append to [%s]\n", session_file.path_cstr());
+    return false;
+  }
+  if (rec.op != OP_SET_UNSAVED) {
+    ++num_delta_records;
+  }
+  return true;
+}
+
+// apply a record to the active config as a committed transaction
+bool
+OplogCstore::active_op(LogRecord& rec)
+{
+  int lfd = lock_log();
+  if (lfd < 0) {
+    return false;
+  }
+  vector<LogRecord> recs(1, rec);
+  recs.push_back(LogRecord(OP_COMMIT));
+  bool ret = (reload_active() && apply_record(active_tree, rec)
+              && ensure_log()
+              && append_records(log_file, recs, active_log_size, true));
+  close(lfd);
+  return ret;
+}
+
+/* lock the log against other writers. return the fd holding the lock
+ * (to be closed by the caller to release it) or -1 on failure. all
+ * changes to the snapshot and the log are made under this lock after
+ * reload_active().
+ */
+int
+OplogCstore::lock_log()
+{
+  try {
+    b_fs::create_directories(oplog_root.path_cstr());
+  } catch (...) {
+  }
+  int fd = open(lock_file.path_cstr(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    output_internal("failed to open [%s]\n", lock_file.path_cstr());
+    return -1;
+  }
+  while (flock(fd, LOCK_EX) != 0) {
+    if (errno != EINTR) {
+      output_internal("failed to lock [%s]\n", lock_file.path_cstr());
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+/* drop the cached active config and load it again, i.e., pick up what
+ * other processes have committed since it was loaded. the working config
+ * is layered on the active config, so it is reloaded as well if the
+ * active config has changed.
+ */
+bool
+OplogCstore::reload_active()
+{
+  unsigned long long gen = active_gen;
+  unsigned long long size = active_log_size;
+  bool loaded = active_loaded;
+  active_loaded = false;
+  if (!load_active()) {
+    return false;
+  }
+  if (!loaded || gen != active_gen || size != active_log_size) {
+    work_loaded = false;
+  }
+  return true;
+}
+
+/* load the active config: the snapshot plus the committed transactions
+ * in the log. if neither exists yet, import the active config directory
+ * of the unionfs backend.
+ */
+bool
+OplogCstore::load_active()
+{
+  if (active_loaded) {
+    return true;
+  }
+  /* compaction replaces the snapshot before the log, so a reader may see
+   * a new log with an old snapshot. retry in that case.
+   */
+  for (int attempt = 0; attempt < 3; attempt++) {
+    LogNodePtr root;
+    unsigned long long sgen = 0, lgen = 0;
+    string sdata, ldata;
+    bool have_snap = _read_file(snapshot_file, sdata);
+    bool have_log = _read_file(log_file, ldata);
+    if (have_snap) {
+      const char *p = sdata.data();
+      const char *end = p + sdata.size();
+      LogRecord hdr, rec;
+      if (!_decode_record(p, end, hdr) || !_check_header(hdr, sgen)
+          || !_decode_record(p, end, rec) || rec.op != OP_PUT_TREE
+          || !apply_record(root, rec)) {
+        output_internal("invalid snapshot [%s]\n", snapshot_file.path_cstr());
+        return false;
+      }
+    } else if (!have_log) {
+      // new store
+      root = import_dir(active_root);
+    }
+    if (!root) {
+      root.reset(new LogNode);
+    }
+
+    unsigned long long log_end = 0;
+    bool lvalid = false;
+    if (have_log) {
+      const char *start = ldata.data();
+      const char *p = start;
+      const char *end = p + ldata.size();
+      LogRecord hdr;
+      if (_decode_record(p, end, hdr) && _check_header(hdr, lgen)) {
+        if (lgen > sgen) {
+          // snapshot was replaced after we read it
+          continue;
+        }
+        if (lgen == sgen) {
+          lvalid = true;
+          log_end = (p - start);
+          vector<LogRecord> trans;
+          LogRecord rec;
+          while (_decode_record(p, end, rec)) {
+            if (rec.op != OP_COMMIT) {
+              trans.push_back(rec);
+              continue;
+            }
+            // only apply complete transactions
+            for (size_t i = 0; i < trans.size(); i++) {
+              apply_record(root, trans[i]);
+            }
+            trans.clear();
+            log_end = (p - start);
+          }
+        }
+      }
+    }
+    active_tree = root;
+    active_gen = sgen;
+    active_log_size = log_end;
+    log_valid = lvalid;
+    active_loaded = true;
+    return true;
+  }
+  output_internal("failed to load [%s]\n", oplog_root.path_cstr());
+  return false;
+}
+
+/* load the working config: the active config plus the session delta.
+ * like the "changes only" dir in unionfs, the delta is layered on top of
+ * the current active config, so records that no longer apply (e.g., the
+ * node has been deleted by another session's commit) are skipped.
+ */
+bool
+OplogCstore::load_work()
+{
+  if (work_loaded) {
+    return true;
+  }
+  if (!inSession() || !load_active()) {
+    return false;
+  }
+  string data;
+  if (!_read_file(session_file, data)) {
+    output_internal("failed to read [%s]\n", session_file.path_cstr());
+    return false;
+  }
+  const char *start = data.data();
+  const char *p = start;
+  const char *end = p + data.size();
+  LogRecord hdr, rec;
+  unsigned long long bgen, boffset;
+  if (!_decode_record(p, end, hdr)
+      || !_check_session_header(hdr, bgen, boffset)) {
+    output_internal("invalid session log [%s]\n", session_file.path_cstr());
+    return false;
+  }
+  if (bgen > active_gen || (bgen == active_gen && boffset > active_log_size)) {
+    /* the delta was recorded against a newer active config than the
+     * cached one (e.g., a commit from another process). the delta is
+     * minimal against that config, so it must be layered on it.
+     */
+    active_loaded = false;
+    if (!load_active()) {
+      return false;
+    }
+  }
+  work_tree = active_tree->clone();
+  unsaved = false;
+  num_delta_records = 0;
+  while (_decode_record(p, end, rec)) {
+    apply_record(work_tree, rec);
+    if (rec.op != OP_SET_UNSAVED) {
+      ++num_delta_records;
+    }
+  }
+  session_log_size = (p - start);
+  work_loaded = true;
+  return true;
+}
+
+// build a tree from a config directory in unionfs layout
+LogNodePtr
+OplogCstore::import_dir(const FsPath& dir)
+{
+  if (!path_is_directory(dir)) {
+    return LogNodePtr();
+  }
+  LogNodePtr n(new LogNode);
+  string data;
+  FsPath f(dir);
+  f.push(C_VAL_NAME);
+  if (read_whole_file(f, data)) {
+    n->has_value = true;
+    parse_value_str(data, n->values);
+  }
+  f.pop();
+  f.push(C_COMMENT_FILE);
+  n->has_comment = read_whole_file(f, n->comment);
+  f.pop();
+  f.push(C_MARKER_DEF_VALUE);
+  n->is_default = path_exists(f);
+  f.pop();
+  f.push(C_MARKER_DEACTIVATE);
+  n->deactivated = path_exists(f);
+
+  vector<string> cnodes;
+  get_all_child_dir_names(dir, cnodes);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    FsPath c(dir);
+    push_path(c, cnodes[i].c_str());
+    LogNodePtr cn = import_dir(c);
+    if (cn) {
+      n->children[cnodes[i]] = cn;
+    }
+  }
+  return n;
+}
+
+/* append records to the specified log file. anything beyond valid_end
+ * (e.g., a partially written record) is discarded first.
+ */
+bool
+OplogCstore::append_records(const FsPath& file, const vector<LogRecord>& recs,
+                            unsigned long long& valid_end, bool durable)
+{
+  string buf;
+  for (size_t i = 0; i < recs.size(); i++) {
+    _encode_record(recs[i], buf);
+  }
+  int fd = open(file.path_cstr(), O_WRONLY | O_CREAT | O_CLOEXEC, 0664);
+  if (fd < 0) {
+    return false;
+  }
+  bool ret = (ftruncate(fd, valid_end) == 0
+              && lseek(fd, valid_end, SEEK_SET) >= 0
+              && _write_all(fd, buf)
+              && (!durable || fsync(fd) == 0));
+  close(fd);
+  if (ret) {
+    valid_end += buf.size();
+  }
+  return ret;
+}
+
+// replace the file with the specified content (durably)
+bool
+OplogCstore::write_file_atomic(const FsPath& file, const string& data)
+{
+  string tmp = file.path_cstr();
+  tmp += ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0664);
+  if (fd < 0) {
+    return false;
+  }
+  bool ret = (_write_all(fd, data) && fsync(fd) == 0);
+  close(fd);
+  if (!ret || rename(tmp.c_str(), file.path_cstr()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  // make the rename itself durable
+  if ((fd = open(oplog_root.path_cstr(), O_RDONLY | O_CLOEXEC)) >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  return true;
+}
+
+// make sure there is a log for the current generation to append to
+bool
+OplogCstore::ensure_log()
+{
+  if (!load_active()) {
+    return false;
+  }
+  if (log_valid) {
+    return true;
+  }
+  LogRecord hdr;
+  _make_header(hdr, _ull_to_str(active_gen));
+  string buf;
+  _encode_record(hdr, buf);
+  if (!write_file_atomic(log_file, buf)) {
+    output_internal("failed to create [%s]\n", log_file.path_cstr());
+    return false;
+  }
+  active_log_size = buf.size();
+  log_valid = true;
+  return true;
+}
+
+/* write the active config into a new snapshot and start a new log. the
+ * log lock must be held and the active config reloaded under it.
+ */
+bool
+OplogCstore::compact_log()
+{
+  unsigned long long gen = active_gen + 1;
+  string buf;
+  LogRecord hdr;
+  _make_header(hdr, _ull_to_str(gen));
+  _encode_record(hdr, buf);
+  LogRecord rec(OP_PUT_TREE);
+  rec.args.push_back("");
+  _encode_tree(*active_tree, rec.args[0]);
+  _encode_record(rec, buf);
+  if (!write_file_atomic(snapshot_file, buf)) {
+    return false;
+  }
+  active_gen = gen;
+  log_valid = false;
+  return ensure_log();
+}
+
+/* rewrite the session log as the minimal delta between the current
+ * active config and the working config.
+ */
+bool
+OplogCstore::rewrite_session()
+{
+  vector<LogRecord> recs;
+  Cpath root;
+  _diff_tree(active_tree.get(), work_tree.get(), root, recs);
+  num_delta_records = recs.size();
+  if (unsaved) {
+    LogRecord rec(OP_SET_UNSAVED);
+    rec.args.push_back("1");
+    recs.push_back(rec);
+  }
+
+  // base of the delta is the current log position
+  LogRecord hdr;
+  _make_header(hdr, _ull_to_str(active_gen) + ":"
+                    + _ull_to_str(active_log_size));
+  string buf;
+  _encode_record(hdr, buf);
+  for (size_t i = 0; i < recs.size(); i++) {
+    _encode_record(recs[i], buf);
+  }
+  if (!write_file_atomic(session_file, buf)) {
+    output_internal("failed to write [%s]\n", session_file.path_cstr());
+    return false;
+  }
+  session_log_size = buf.size();
+  return true;
+}
+
+} // end namespace oplog
+} // end namespace cstore
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSTORE_OPLOG_H_
+#define _CSTORE_OPLOG_H_
+#include <vector>
+#include <string>
+
+#include <cstore/unionfs/cstore-unionfs.hpp>
+
+namespace cstore { // begin namespace cstore
+namespace oplog { // begin namespace oplog
+
+using unionfs::FsPath;
+namespace b_fs = boost::filesystem;
+
+class LogNode;
+class LogRecord;
+typedef tr1::shared_ptr<LogNode> LogNodePtr;
+
+/* log-structured backend.
+ *
+ * the whole config tree is held in memory. on disk, the active config is
+ * a compacted snapshot file plus an append-only log of the operations
+ * committed since the snapshot. a session is a private log of the
+ * operations performed in the session (the "delta"), recorded against
+ * the log offset at which the session was set up. the working config is
+ * the active config with the delta replayed on top of it, i.e., the same
+ * layering as the "changes only" dir over the active dir in unionfs.
+ *
+ * commit appends the resulting active changes to the log as a single
+ * transaction and fsyncs it. all writes to the log are made under a lock
+ * file after reloading the active config, so they are always appended at
+ * the end of the log as it is on disk. the log is compacted into a new snapshot
+ * once it grows beyond a threshold.
+ *
+ * the backend is only used if it is selected for the whole store (see
+ * UnionfsCstore::getStoreBackend()), so every reader of the active config
+ * (including op mode) reads the log, and no session commits to the active
+ * dir instead. the active dir is only imported when the store is first
+ * used, so it is stale once the store is switched to this backend.
+ *
+ * template handling, path/level handling, commit markers and the commit
+ * lock are the same as UnionfsCstore.
+ */
+class OplogCstore : public unionfs::UnionfsCstore {
+public:
+  OplogCstore(bool use_edit_level);
+  OplogCstore(const string& session_id, string& env);
+  virtual ~OplogCstore();
+
+  // name selecting this backend for the store (see getStoreBackend())
+  static const string C_BACKEND_NAME;
+
+  ////// public virtual functions declared in base class
+  bool markSessionUnsaved();
+  bool unmarkSessionUnsaved();
+  bool sessionUnsaved();
+  bool sessionChanged();
+  bool setupSession();
+  bool teardownSession();
+  bool inSession();
+  bool commitConfig(commit::PrioNode& pnode);
+
+private:
+  // constants
+  static const string C_ENV_OPLOG_ROOT;
+  static const string C_ENV_SESSION_LOG;
+  static const string C_DEF_OPLOG_ROOT;
+  static const string C_SNAPSHOT_FILE;
+  static const string C_LOG_FILE;
+  static const string C_LOCK_FILE;
+  static const string C_SESSION_PREFIX;
+
+  // compact the active log into a new snapshot beyond this size
+  static const size_t C_COMPACT_THRESHOLD = 1048576;
+
+  // files
+  FsPath oplog_root;
+  FsPath snapshot_file;
+  FsPath log_file;
+  FsPath lock_file;
+  FsPath session_file;
+
+  // in-memory state
+  LogNodePtr active_tree;
+  LogNodePtr work_tree;
+  bool active_loaded;
+  bool work_loaded;
+  bool log_valid;
+  bool unsaved;
+  unsigned long long active_gen;
+  unsigned long long active_log_size;
+  unsigned long long session_log_size;
+  unsigned long long num_delta_records;
+
+  void init_oplog();
+  bool load_active();
+  bool load_work();
+  int lock_log();
+  bool reload_active();
+  LogNodePtr import_dir(const FsPath& dir);
+  bool apply_record(LogNodePtr& root, const LogRecord& rec);
+  bool work_op(LogRecord& rec);
+  bool active_op(LogRecord& rec);
+  void get_cur_path(Cpath& path);
+  LogNode *get_cur_node(bool active_cfg);
+  bool append_records(const FsPath& file, const vector<LogRecord>& recs,
+                      unsigned long long& valid_end, bool durable);
+  bool write_file_atomic(const FsPath& file, const string& data);
+  bool ensure_log();
+  bool compact_log();
+  bool rewrite_session();
+  void construct_commit_tree(commit::PrioNode& node, LogNodePtr& nactive);
+  bool commit_locked(commit::PrioNode& node);
+
+  ////// virtual functions defined in base class
+  // these operate on current work path
+  bool add_node();
+  bool remove_node();
+  void get_all_child_node_names_impl(vector<string>& cnodes, bool active_cfg);
+  bool write_value_vec(const vector<string>& vvec, bool active_cfg);
+  bool rename_child_node(const char *oname, const char *nname);
+  bool copy_child_node(const char *oname, const char *nname);
+  bool mark_display_default();
+  bool unmark_display_default();
+  bool mark_deactivated();
+  bool unmark_deactivated();
+  bool unmark_deactivated_descendants();
+  bool mark_changed_with_ancestors();
+  bool unmark_changed_with_descendants();
+  bool remove_comment();
+  bool set_comment(const string& comment);
+  bool discard_changes(unsigned long long& num_removed);
+  bool sync_committed_config();
+  Cstore *new_read_view();
+
+  // observers for work path
+  bool cfg_node_changed();
+
+  // observers for work path or active path
+  bool cfg_node_exists(bool active_cfg);
+  bool read_value_vec(vector<string>& vvec, bool active_cfg);
+  bool marked_deactivated(bool active_cfg);
+  bool get_comment(string& comment, bool active_cfg);
+  bool marked_display_default(bool active_cfg);
+
+  // marker operations at current work path
+  bool mark_op(int op, char flag, const char *what);
+};
+
+} // end namespace oplog
+} // end namespace cstore
+
+#endif /* _CSTORE_OPLOG_H_ */
@@ -41,7 +41,9 @@ public:
   svector(const char *raw_data, size_t dlen);
   ~svector();
 
-  void push_back(const char *e);
+  void push_back(const char *e) { push_back(e, strlen(e)); };
+  // the element does not need to be NUL-terminated
+  void push_back(const char *e, size_t elen);
   void pop_back();
   void pop_back(std::string& last);
 
@@ -196,9 +198,8 @@ svector<P>::~svector()
 }
 
 template<class P> void
-svector<P>::push_back(const char *e)
+svector<P>::push_back(const char *e, size_t elen)
 {
-  size_t elen = strlen(e);
   while ((_len + elen + 2) >= _buf_size) {
     // make sure there's space for (data + SEP + e + 0)
     grow_data();
@@ -206,7 +207,8 @@ svector<P>::push_back(const char *e)
 
   char *start = _elems[_num_elems];
   *start = ELEM_SEP;
-  memcpy(start + 1, e, elen + 1);
+  memcpy(start + 1, e, elen);
+  start[1 + elen] = 0;
   inc_num_elems();
   _len += (elen + 1);
   _elems[_num_elems] = start + 1 + elen;
@@ -19,13 +19,18 @@
 #include <cstring>
 #include <fstream>
 #include <sstream>
+#include <mutex>
 
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/mount.h>
+#include <sys/file.h>
 #include <wait.h>
 #include <dirent.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <utime.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -46,6 +51,8 @@ const string UnionfsCstore::C_ENV_ACTIVE_ROOT
   = "VYATTA_ACTIVE_CONFIGURATION_DIR";
 const string UnionfsCstore::C_ENV_CHANGE_ROOT = "VYATTA_CHANGES_ONLY_DIR";
 const string UnionfsCstore::C_ENV_TMP_ROOT = "VYATTA_CONFIG_TMP";
+const string UnionfsCstore::C_ENV_COMMIT_LOCK_TIMEOUT
+  = "VYATTA_COMMIT_LOCK_TIMEOUT";
 
 // default root dirs/paths
 const string UnionfsCstore::C_DEF_TMPL_ROOT
@@ -73,6 +80,12 @@ const string UnionfsCstore::C_TAG_NAME = "node.tag";
 const string UnionfsCstore::C_VAL_NAME = "node.val";
 const string UnionfsCstore::C_DEF_NAME = "node.def";
 const string UnionfsCstore::C_COMMIT_LOCK_FILE = "/opt/vyatta/config/.lock";
+const string UnionfsCstore::C_COMMIT_QUEUE_SUFFIX = ".queue";
+const string UnionfsCstore::C_COMMIT_QUEUE_SEQ_FILE = ".seq";
+const string UnionfsCstore::C_ACTIVE_IMAGE_SUFFIX = ".image";
+const string UnionfsCstore::C_BACKEND_SUFFIX = ".backend";
+const string UnionfsCstore::C_SESSION_REGISTRY_DIR = ".sessions";
+const string UnionfsCstore::C_GRAVEYARD_DIR = ".graveyard";
 
 pid_t pid;
 int status;
@@ -81,9 +94,19 @@ int commpipe[2];
 ////// static
 static MapT<char, string> _fs_escape_chars;
 static MapT<string, char> _fs_unescape_chars;
+/* caches below may be used by read views in different threads (see
+ * Cstore::createReadView()).
+ */
+static std::mutex _cache_mutex;
+
 static void
 _init_fs_escape_chars()
 {
+  std::lock_guard<std::mutex> lock(_cache_mutex);
+  if (!_fs_escape_chars.empty()) {
+    // already done
+    return;
+  }
   _fs_escape_chars[-1] = "\%\%\%";
   _fs_escape_chars['%'] = "\%25";
   _fs_escape_chars['/'] = "\%2F";
@@ -109,11 +132,14 @@ static MapT<string, string> _escape_path_name_cache;
 static string
 _escape_path_name(const string& path)
 {
-  MapT<string, string>::iterator p
-    = _escape_path_name_cache.find(path);
-  if (p != _escape_path_name_cache.end()) {
-    // found escaped string in cache. just return it.
-    return p->second;
+  {
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    MapT<string, string>::iterator p
+      = _escape_path_name_cache.find(path);
+    if (p != _escape_path_name_cache.end()) {
+      // found escaped string in cache. just return it.
+      return p->second;
+    }
   }
 
   // special case for empty string
@@ -123,6 +149,7 @@ _escape_path_name(const string& path)
   }
 
   // cache it before return
+  std::lock_guard<std::mutex> lock(_cache_mutex);
   _escape_path_name_cache[path] = npath;
   return npath;
 }
@@ -132,11 +159,14 @@ static MapT<string, string> _unescape_path_name_cache;
 static string
 _unescape_path_name(const string& path)
 {
-  MapT<string, string>::iterator p
-    = _unescape_path_name_cache.find(path);
-  if (p != _unescape_path_name_cache.end()) {
-    // found unescaped string in cache. just return it.
-    return p->second;
+  {
+    std::lock_guard<std::mutex> lock(_cache_mutex);
+    MapT<string, string>::iterator p
+      = _unescape_path_name_cache.find(path);
+    if (p != _unescape_path_name_cache.end()) {
+      // found unescaped string in cache. just return it.
+      return p->second;
+    }
   }
 
   // assume all escape patterns are 3-char
@@ -163,53 +193,116 @@ _unescape_path_name(const string& path)
     }
   }
   // cache it before return
+  std::lock_guard<std::mutex> lock(_cache_mutex);
   _unescape_path_name_cache[path] = npath;
   return npath;
 }
 
-// Fall-through for Boost's filesystem::copy_file "complexity"
-void stream_file( const char* srce_file, const char* dest_file )
+/* timed blocking lock operations for the commit lock.
+ * the timeout is implemented with an interval timer so that a signal
+ * that arrives just before blocking does not leave us blocked forever.
+ */
+static volatile sig_atomic_t _lock_timed_out = 0;
+
+static void
+_lock_alarm_handler(int sig)
 {
-    std::ifstream srce( srce_file, std::ios::binary ) ;
-    std::ofstream dest( dest_file, std::ios::binary ) ;
-    dest << srce.rdbuf() ;
+  _lock_timed_out = 1;
 }
 
-vector<int> getActiveCommits()
-{
-  string process_name = "vbash";
-  vector<int> pids;
-
-  DIR *dp = opendir("/proc");
-  if (dp != NULL) {
-    struct dirent *dirp;
-    while ((dirp = readdir(dp))) {
-      int pid = atoi(dirp->d_name);
-      if (pid > 0) {
-        string command_path = string("/proc/") + dirp->d_name + "/cmdline";
-        std::ifstream command_file(command_path.c_str());
-        string command_line;
-        getline(command_file, command_line);
-        if (!command_line.empty()) {
-          size_t pos = command_line.find('\0');
-          if (pos != string::npos) {
-            command_line = command_line.substr(0, pos);
-          }
-          pos = command_line.rfind('/');
-          if (pos != string::npos) {
-            command_line = command_line.substr(pos + 1);
-          }
-          if (process_name == command_line) {
-            pids.push_back(pid);
-          }
-        }
-      }
+/* perform a blocking flock() (use_flock) or lockf() on fd with a timeout
+ * in seconds (negative for no timeout, 0 for non-blocking).
+ * return true if the lock is acquired.
+ */
+static bool
+_timed_lock(int fd, bool use_flock, long timeout)
+{
+  if (timeout == 0) {
+    return ((use_flock ? flock(fd, LOCK_SH | LOCK_NB)
+                       : lockf(fd, F_TLOCK, 0)) == 0);
+  }
+  struct sigaction sa, osa;
+  struct itimerval itv, oitv;
+  if (timeout > 0) {
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _lock_alarm_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // no SA_RESTART
+    sigaction(SIGALRM, &sa, &osa);
+    memset(&itv, 0, sizeof(itv));
+    itv.it_value.tv_sec = timeout;
+    itv.it_interval.tv_sec = 1;
+    _lock_timed_out = 0;
+    setitimer(ITIMER_REAL, &itv, &oitv);
+  }
+  int r;
+  do {
+    r = (use_flock ? flock(fd, LOCK_SH) : lockf(fd, F_LOCK, 0));
+  } while (r != 0 && errno == EINTR && !_lock_timed_out);
+  if (timeout > 0) {
+    setitimer(ITIMER_REAL, &oitv, NULL);
+    sigaction(SIGALRM, &osa, NULL);
+  }
+  return (r == 0);
+}
+
+/* start time of the process (field 22 of /proc/<pid>/stat, in clock
+ * ticks since boot), which together with the pid identifies the process,
+ * i.e., a reused pid has a different start time. return false if the
+ * process does not exist.
+ */
+static bool
+_proc_start_time(pid_t pid, string& start)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+  std::ifstream fin(path);
+  string stat;
+  if (!fin || !getline(fin, stat)) {
+    return false;
+  }
+  // the command name (field 2) may contain anything except the last ')'
+  size_t idx = stat.rfind(')');
+  if (idx == string::npos) {
+    return false;
+  }
+  std::istringstream fields(stat.substr(idx + 1));
+  // fields 3 to 22
+  for (int i = 3; i <= 22; i++) {
+    if (!(fields >> start)) {
+      return false;
     }
   }
+  return true;
+}
 
-  closedir(dp);
+// pid of the session's shell if the session ID is a pid (otherwise 0)
+static pid_t
+_session_pid(const string& sid)
+{
+  if (sid.empty() || sid.find_first_not_of("0123456789") != string::npos) {
+    return 0;
+  }
+  return (pid_t) strtol(sid.c_str(), NULL, 10);
+}
 
-  return pids;
+// remaining seconds until deadline (negative timeout means no timeout)
+static long
+_time_left(long timeout, time_t deadline)
+{
+  if (timeout < 0) {
+    return -1;
+  }
+  long left = (long) (deadline - time(NULL));
+  return (left > 0 ? left : 0);
+}
+
+// Fall-through for Boost's filesystem::copy_file "complexity"
+void stream_file( const char* srce_file, const char* dest_file )
+{
+    std::ifstream srce( srce_file, std::ios::binary ) ;
+    std::ofstream dest( dest_file, std::ios::binary ) ;
+    dest << srce.rdbuf() ;
 }
 
 ////// constructor/destructor
@@ -272,6 +365,8 @@ UnionfsCstore::UnionfsCstore(bool use_edit_level)
   orig_mutable_cfg_path = mutable_cfg_path;
   orig_tmpl_path = tmpl_path;
   _init_fs_escape_chars();
+  // the session (if any) is in use
+  renew_session_lease();
 }
 
 /* "specific session" constructor.
@@ -330,6 +425,20 @@ UnionfsCstore::~UnionfsCstore()
 {
 }
 
+////// public functions
+string
+UnionfsCstore::getStoreBackend()
+{
+  char *val = getenv(C_ENV_ACTIVE_ROOT.c_str());
+  string file = (val ? string(val) : C_DEF_ACTIVE_ROOT) + C_BACKEND_SUFFIX;
+  std::ifstream fin(file.c_str());
+  string name;
+  if (fin) {
+    fin >> name;
+  }
+  return name;
+}
+
 ////// public virtual functions declared in base class
 bool
 UnionfsCstore::markSessionUnsaved()
@@ -388,27 +497,12 @@ UnionfsCstore::sessionChanged()
 bool
 UnionfsCstore::setupSession()
 {
-  vector<FsPath> directories;
-  vector<int> pids;
-  vector<int> old_pids;
-  FsPath old_config;
-  FsPath work_base;
-
-  string work_string = work_root.path_cstr();
-  work_base = work_string.erase(work_string.find_last_of("/"));
-
-  try {
-    b_fs::directory_iterator di(work_base.path_cstr());
-    for (; di != b_fs::directory_iterator(); ++di) {
-      old_config = di->path().string().c_str();
-      if (path_is_directory(old_config)) {
-        directories.push_back(old_config);
-      }
-    }
-  } catch (...) {
-    if (path_exists(active_root)) {
-      output_internal("no session directories found [%s]\n", work_root.path_cstr());
-    }
+  /* register first so that a concurrent setup does not consider the new
+   * session directories stale. if that fails, the session is not in the
+   * registry, and the liveness check falls back to the session's shell.
+   */
+  if (!register_session()) {
+    output_internal("setup session failed to register session\n");
   }
 
   if (!path_exists(work_root)) {
@@ -435,71 +529,52 @@ UnionfsCstore::setupSession()
     return false;
   }
 
-  pids = getActiveCommits();
-
+  /* remove stale config sessions of the current user. only the registry
+   * entries of the existing sessions are checked.
+   */
+  FsPath work_base = get_work_base();
+  FsPath reg_dir = work_base;
+  reg_dir.push(C_SESSION_REGISTRY_DIR);
+  string wprefix = C_DEF_WORK_PREFIX.substr(C_DEF_WORK_PREFIX.rfind('/') + 1);
+  string cur_sid = get_session_id();
   struct stat config_info;
-  stat(work_root.path_cstr(), &config_info);
-  int current_uid = (int) config_info.st_uid;
-  bool failed = false;
-
-  for (size_t i = 0; i < directories.size(); i++) {
-    struct stat directory_info;
-    int directory_uid;
-    int current_pid = 0;
-
-    // find uid for the current directory and the active config directory
-
-    stat(directories[i].path_cstr(), &directory_info);
-    directory_uid = (int) directory_info.st_uid;
-
-    // remove old config session directories but only for the current user
-
-    if (directory_uid == current_uid && directory_uid != 0 ) {
-      string config_match = work_base.path_cstr() + std::string("/new_config_");
-      string current_path = directories[i].path_cstr();
-
-      if (current_path.find(config_match) != std::string::npos) {
-        current_pid = atoi(current_path.erase(current_path.find(config_match), config_match.length()).c_str());
-
-        // umount only inactive config session directory, don't touch active sessions
-
-        if (std::find(pids.begin(), pids.end(), current_pid) == pids.end()) {
-          old_pids.push_back(current_pid);
-          output_internal("found inactive config [%d]\n", current_pid);
-          output_internal("umount [%s]\n", directories[i].path_cstr());
-          if (!do_umount(directories[i])) {
-            failed = true;
-          }
-        }
-      }
+  if (stat(work_root.path_cstr(), &config_info) != 0) {
+    return true;
+  }
+  DIR *dp = opendir(work_base.path_cstr());
+  if (!dp) {
+    if (path_exists(active_root)) {
+      output_internal("no session directories found [%s]\n",
+                      work_root.path_cstr());
     }
+    return true;
   }
-
-  if (!old_pids.empty()) {
-    for (size_t i = 0; i < directories.size(); i++) {
-
-      int current_pid;
-      string current_path;
-
-      current_path = directories[i].path_cstr();
-      current_pid = atoi(current_path.erase(0, (current_path.find_last_of("_")) + 1).c_str());
-
-      if (std::find(old_pids.begin(), old_pids.end(), current_pid) != old_pids.end()) {
-        try {
-          if (b_fs::remove_all(directories[i].path_cstr()) == 0) {
-            failed = true;
-          }
-        } catch (...) {
-          failed = true;
-        }
-      }
+  vector<string> stale;
+  struct dirent *de;
+  while ((de = readdir(dp))) {
+    string dname = de->d_name;
+    if (dname.find(wprefix) != 0) {
+      continue;
+    }
+    string sid = dname.substr(wprefix.size());
+    if (sid == cur_sid || session_alive(reg_dir, sid)) {
+      continue;
+    }
+    // only for the current user
+    FsPath d = work_base;
+    d.push(dname);
+    struct stat directory_info;
+    if (stat(d.path_cstr(), &directory_info) == 0
+        && directory_info.st_uid == config_info.st_uid
+        && directory_info.st_uid != 0) {
+      stale.push_back(sid);
     }
   }
-
-  if (failed) {
-    output_internal("failed to remove old config session directories\n");
+  closedir(dp);
+  for (size_t i = 0; i < stale.size(); i++) {
+    output_internal("found inactive config [%s]\n", stale[i].c_str());
+    remove_stale_session(work_base, stale[i]);
   }
-
   return true;
 }
 
@@ -524,19 +599,28 @@ UnionfsCstore::teardownSession()
     return false;
   }
 
-  // remove session directories
-  bool ret = false;
-  try {
-    if (b_fs::remove_all(work_root.path_cstr()) != 0
-        && b_fs::remove_all(change_root.path_cstr()) != 0
-        && b_fs::remove_all(tmp_root.path_cstr()) != 0) {
-      ret = true;
+  /* remove session directories. they are moved to the graveyard and
+   * removed in the background if possible.
+   */
+  bool ret = true;
+  const FsPath *dirs[] = { &work_root, &change_root, &tmp_root };
+  for (size_t i = 0; i < (sizeof(dirs) / sizeof(dirs[0])); i++) {
+    if (move_to_graveyard(*dirs[i])) {
+      continue;
+    }
+    try {
+      if (b_fs::remove_all(dirs[i]->path_cstr()) == 0) {
+        ret = false;
+      }
+    } catch (...) {
+      ret = false;
     }
-  } catch (...) {
   }
   if (!ret) {
     output_internal("failed to remove session directories\n");
   }
+  reap_graveyard(work_root);
+  unregister_session();
   return ret;
 }
 
@@ -564,8 +648,12 @@ UnionfsCstore::clearCommittedMarkers()
   return true;
 }
 
+/* construct the "temp active" tree for the specified prio subtree.
+ *   work_src: root of the working config to take succeeded subtrees from.
+ */
 bool
-UnionfsCstore::construct_commit_active(commit::PrioNode& node)
+UnionfsCstore::construct_commit_active(commit::PrioNode& node,
+                                       const FsPath& work_src)
 {
   #if __GNUC__ < 6
   auto_ptr<SavePaths> save(create_save_paths());
@@ -576,7 +664,8 @@ UnionfsCstore::construct_commit_active(commit::PrioNode& node)
   append_cfg_path(node.getCommitPath());
 
   FsPath ap(get_active_path());
-  FsPath wp(get_work_path());
+  FsPath wp(work_src);
+  wp /= mutable_cfg_path;
   FsPath tap(tmp_active_root);
   tap /= mutable_cfg_path;
 
@@ -645,7 +734,7 @@ UnionfsCstore::construct_commit_active(commit::PrioNode& node)
     // success present in subtree
   }
   for (size_t i = 0; i < node.numChildNodes(); i++) {
-    if (!construct_commit_active(*(node.childAt(i)))) {
+    if (!construct_commit_active(*(node.childAt(i)), work_src)) {
       return false;
     }
   }
@@ -808,7 +897,7 @@ UnionfsCstore::commitConfig(commit::PrioNode& node)
     return false;
   }
 
-  if (!construct_commit_active(node)) {
+  if (!construct_commit_active(node, work_root)) {
     return false;
   }
 
@@ -819,6 +908,7 @@ UnionfsCstore::commitConfig(commit::PrioNode& node)
     output_internal("failed to remove [%s]\n", change_root.path_cstr());
     return false;
   }
+  invalidate_active_image();
   /* note: unionfs can't cope with whole directory being removed, so just
    * remove the content.
    */
@@ -840,6 +930,7 @@ UnionfsCstore::commitConfig(commit::PrioNode& node)
   if (!do_mount(change_root, active_root, work_root)) {
     return false;
   }
+  publish_active_image();
   if (!sync_dir(tmp_work_root, work_root, work_root)) {
     return false;
   }
@@ -864,26 +955,603 @@ UnionfsCstore::commitConfig(commit::PrioNode& node)
   return true;
 }
 
+/* publish the image of the (new) active config. failure here does not
+ * fail the commit since the observers fall back to the active dir when
+ * there is no image.
+ */
+void
+UnionfsCstore::publish_active_image()
+{
+  string ifile = get_active_image_file();
+  ActiveImageNode root;
+  try {
+    build_image_tree(active_root, root);
+  } catch (...) {
+    output_internal("failed to build active image\n");
+    unlink(ifile.c_str());
+    active_image.close();
+    return;
+  }
+  if (!ActiveImage::publish(ifile, root)) {
+    output_internal("failed to publish active image [%s]\n", ifile.c_str());
+    // don't leave a stale image around
+    unlink(ifile.c_str());
+  }
+  // pick up the new image immediately in this process
+  active_image.open(ifile);
+}
+
+/* remove the image before the active config is modified so that readers
+ * fall back to the active dir until the new image (if any) is published.
+ */
+void
+UnionfsCstore::invalidate_active_image()
+{
+  unlink(get_active_image_file().c_str());
+  active_image.close();
+}
+
+// build the image tree of the specified active config dir
+void
+UnionfsCstore::build_image_tree(const FsPath& dir, ActiveImageNode& inode)
+{
+  FsPath p = dir;
+  p.push(C_VAL_NAME);
+  string data;
+  if (read_whole_file(p, data)) {
+    inode.has_value = true;
+    parse_value_str(data, inode.values);
+  }
+  p = dir;
+  p.push(C_COMMENT_FILE);
+  inode.has_comment = read_whole_file(p, inode.comment);
+  p = dir;
+  p.push(C_MARKER_DEACTIVATE);
+  inode.deactivated = path_exists(p);
+  p = dir;
+  p.push(C_MARKER_DEF_VALUE);
+  inode.is_default = path_exists(p);
+
+  vector<string> cnodes;
+  get_all_child_dir_names(dir, cnodes);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    tr1::shared_ptr<ActiveImageNode> c(new ActiveImageNode(cnodes[i]));
+    FsPath cdir = dir;
+    cdir.push(_escape_path_name(cnodes[i]));
+    build_image_tree(cdir, *c);
+    inode.children.push_back(c);
+  }
+}
+
+/* find the current path in the image of the active config.
+ * return false if there is no usable image (caller should fall back to
+ * the active dir). otherwise return true, and node is set to the image
+ * node or ActiveImage::NO_NODE if the path does not exist.
+ */
 bool
-UnionfsCstore::getCommitLock()
+UnionfsCstore::get_active_image_node(uint32_t& node)
+{
+  if (!(active_image.getFile().empty()
+        ? active_image.open(get_active_image_file())
+        : active_image.refresh())) {
+    return false;
+  }
+  // split the (escaped) mutable path without touching the filesystem
+  Cpath path;
+  const char *p = mutable_cfg_path.path_cstr();
+  while (*p) {
+    const char *e = strchr(p, '/');
+    size_t len = (e ? (size_t) (e - p) : strlen(p));
+    if (len > 0) {
+      path.push(_unescape_path_name(string(p, len)));
+    }
+    p += len + (e ? 1 : 0);
+  }
+  node = active_image.find(path);
+  return true;
+}
+
+// parent of the session directories
+FsPath
+UnionfsCstore::get_work_base()
+{
+  string wstr = work_root.path_cstr();
+  size_t idx = wstr.rfind('/');
+  return FsPath(idx == string::npos ? string(".") : wstr.substr(0, idx));
+}
+
+// session ID, i.e., the suffix of the work root
+string
+UnionfsCstore::get_session_id()
+{
+  string wstr = work_root.path_cstr();
+  string wprefix = C_DEF_WORK_PREFIX.substr(C_DEF_WORK_PREFIX.rfind('/') + 1);
+  size_t idx = wstr.rfind('/');
+  wstr = (idx == string::npos ? wstr : wstr.substr(idx + 1));
+  return (wstr.find(wprefix) == 0 ? wstr.substr(wprefix.size()) : "");
+}
+
+/* register the current session in the session registry, i.e., record the
+ * start time of the session's shell (process <sid>) in the registry file.
+ * if the session ID is not a pid, the file is empty, and its mtime is the
+ * start of a lease (see renew_session_lease()).
+ */
+bool
+UnionfsCstore::register_session()
+{
+  string sid = get_session_id();
+  if (sid.empty()) {
+    // not a standard session dir. nothing to register.
+    return true;
+  }
+  /* the registry is shared by all users (sticky like /tmp), and the
+   * entries can be read but not modified by other users.
+   */
+  FsPath reg = get_work_base();
+  try {
+    b_fs::create_directories(reg.path_cstr());
+  } catch (...) {
+  }
+  reg.push(C_SESSION_REGISTRY_DIR);
+  if (mkdir(reg.path_cstr(), 01777) == 0) {
+    chmod(reg.path_cstr(), 01777);
+  } else if (errno != EEXIST) {
+    output_internal("failed to create session registry [%s]\n",
+                    reg.path_cstr());
+    return false;
+  }
+  reg.push(sid);
+
+  string start;
+  pid_t spid = _session_pid(sid);
+  if (spid > 0 && !_proc_start_time(spid, start)) {
+    // no shell. the entry would be stale right away.
+    return false;
+  }
+  // write a temp file and rename it so that readers never see a partial one
+  string tmp = string(reg.path_cstr()) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    output_internal("failed to open session registry [%s]\n", tmp.c_str());
+    return false;
+  }
+  fchmod(fd, 0644);
+  bool ret = (write(fd, start.data(), start.size())
+              == static_cast<ssize_t>(start.size()));
+  ret = (close(fd) == 0 && ret);
+  if (!ret || rename(tmp.c_str(), reg.path_cstr()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// remove the current session from the registry
+void
+UnionfsCstore::unregister_session()
+{
+  string sid = get_session_id();
+  if (sid.empty()) {
+    return;
+  }
+  FsPath reg = get_work_base();
+  reg.push(C_SESSION_REGISTRY_DIR);
+  reg.push(sid);
+  unlink(reg.path_cstr());
+}
+
+// renew the lease of the current session if its ID is not a pid
+void
+UnionfsCstore::renew_session_lease()
+{
+  string sid = get_session_id();
+  if (sid.empty() || _session_pid(sid) > 0) {
+    return;
+  }
+  FsPath reg = get_work_base();
+  reg.push(C_SESSION_REGISTRY_DIR);
+  reg.push(sid);
+  // fails harmlessly if the session is not registered
+  utime(reg.path_cstr(), NULL);
+}
+
+/* whether the specified session is live, i.e., the start time of process
+ * <sid> is still the one in its registry file, or, if the session ID is not
+ * a pid, its lease has not expired. a stale registry file is removed.
+ */
+bool
+UnionfsCstore::session_alive(const FsPath& reg_dir, const string& sid)
+{
+  FsPath reg = reg_dir;
+  reg.push(sid);
+  pid_t spid = _session_pid(sid);
+  std::ifstream fin(reg.path_cstr());
+  struct stat st;
+  if (!fin || stat(reg.path_cstr(), &st) != 0 || st.st_uid != geteuid()) {
+    /* not registered (e.g., created before the registry existed or the
+     * registration failed), or left by another user with the same session
+     * ID (i.e., pid), which says nothing about our session. fall back to
+     * checking the session's shell.
+     */
+    return (spid > 0 && (kill(spid, 0) == 0 || errno == EPERM));
+  }
+  bool alive;
+  if (spid > 0) {
+    string rstart, start;
+    getline(fin, rstart);
+    alive = (_proc_start_time(spid, start) && start == rstart);
+  } else {
+    alive = (time(NULL) < st.st_mtime + (time_t) C_SESSION_LEASE);
+  }
+  if (!alive) {
+    unlink(reg.path_cstr());
+  }
+  return alive;
+}
+
+// unmount and remove the directories of a stale session
+void
+UnionfsCstore::remove_stale_session(const FsPath& work_base,
+                                    const string& sid)
+{
+  const string *prefixes[] = { &C_DEF_WORK_PREFIX, &C_DEF_CHANGE_PREFIX,
+                               &C_DEF_TMP_PREFIX };
+  bool failed = false;
+  for (size_t i = 0; i < (sizeof(prefixes) / sizeof(prefixes[0])); i++) {
+    FsPath d = work_base;
+    d.push(prefixes[i]->substr(prefixes[i]->rfind('/') + 1) + sid);
+    if (!path_exists(d)) {
+      continue;
+    }
+    if (i == 0) {
+      output_internal("umount [%s]\n", d.path_cstr());
+      if (!do_umount(d)) {
+        failed = true;
+        continue;
+      }
+    }
+    if (move_to_graveyard(d)) {
+      continue;
+    }
+    try {
+      if (b_fs::remove_all(d.path_cstr()) == 0) {
+        failed = true;
+      }
+    } catch (...) {
+      failed = true;
+    }
+  }
+  if (failed) {
+    output_internal("failed to remove old config session directories\n");
+  }
+  FsPath wd = work_base;
+  wd.push(C_GRAVEYARD_DIR);
+  reap_graveyard(wd);
+}
+
+/* get a unique path for the specified dir in the graveyard in its parent
+ * dir (so that moving it there is just a rename). return false if fail.
+ */
+bool
+UnionfsCstore::get_graveyard_path(const FsPath& d, FsPath& g)
+{
+  static unsigned int seq = 0;
+  string dstr = d.path_cstr();
+  size_t idx = dstr.rfind('/');
+  if (idx == string::npos) {
+    return false;
+  }
+  g = dstr.substr(0, idx);
+  g.push(C_GRAVEYARD_DIR);
+  try {
+    b_fs::create_directories(g.path_cstr());
+  } catch (...) {
+    return false;
+  }
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), ".%d.%ld.%u", (int) getpid(),
+           (long) time(NULL), seq++);
+  g.push(dstr.substr(idx + 1) + suffix);
+  return true;
+}
+
+/* move the specified dir into the graveyard in its parent dir. return
+ * false if fail.
+ */
+bool
+UnionfsCstore::move_to_graveyard(const FsPath& d)
+{
+  FsPath g;
+  if (!path_exists(d) || !get_graveyard_path(d, g)) {
+    return false;
+  }
+  if (rename(d.path_cstr(), g.path_cstr()) != 0) {
+    output_internal("failed to move [%s] to graveyard [%s]\n",
+                    d.path_cstr(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/* remove everything in the graveyard next to the specified dir in a
+ * background process.
+ */
+void
+UnionfsCstore::reap_graveyard(const FsPath& d)
 {
-  int fd;
+  string dstr = d.path_cstr();
+  size_t idx = dstr.rfind('/');
+  if (idx == string::npos) {
+    return;
+  }
+  FsPath g(dstr.substr(0, idx));
+  g.push(C_GRAVEYARD_DIR);
+  if (!path_exists(g)) {
+    return;
+  }
+
+  // double fork so that the reaper is not left as a zombie
+  pid_t cpid = fork();
+  if (cpid < 0) {
+    return;
+  }
+  if (cpid == 0) {
+    if (fork() != 0) {
+      _exit(0);
+    }
+    setsid();
+    int nfd = open("/dev/null", O_RDWR);
+    if (nfd >= 0) {
+      dup2(nfd, 0);
+      dup2(nfd, 1);
+      dup2(nfd, 2);
+      if (nfd > 2) {
+        close(nfd);
+      }
+    }
+    if (nice(10) < 0) {
+      // not fatal
+    }
+    vector<string> entries;
+    DIR *dp = opendir(g.path_cstr());
+    if (dp) {
+      struct dirent *de;
+      while ((de = readdir(dp))) {
+        string dname = de->d_name;
+        if (dname != "." && dname != "..") {
+          entries.push_back(dname);
+        }
+      }
+      closedir(dp);
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+      FsPath e = g;
+      e.push(entries[i]);
+      try {
+        b_fs::remove_all(e.path_cstr());
+      } catch (...) {
+        // another reaper or not ours. skip.
+      }
+    }
+    _exit(0);
+  }
+  int status;
+  waitpid(cpid, &status, 0);
+}
 
-  fd = open(C_COMMIT_LOCK_FILE.c_str(),
-	    O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+/* get the commit lock, waiting for up to the number of seconds in
+ * C_ENV_COMMIT_LOCK_TIMEOUT (default 0, i.e., fail immediately if locked;
+ * negative to wait forever).
+ *
+ * waiters are served in FIFO order: each waiter takes a ticket in the
+ * queue dir (a file named by a sequence number, flock'ed by the waiter)
+ * and waits for all earlier tickets to be released before taking the
+ * lock itself. all locks are released when the process terminates.
+ * without a timeout, the lock is simply tried without queueing.
+ */
+bool
+UnionfsCstore::getCommitLock()
+{
+  int fd = open(C_COMMIT_LOCK_FILE.c_str(), O_RDWR | O_CREAT | O_CLOEXEC,
+                0666);
   if (fd < 0) {
     // should not happen since all commit processes should have write access
     output_internal("getCommitLock() failed to open lock file\n");
     return false;
   }
-  if (lockf(fd, F_TLOCK, 0) < 0) {
+  long timeout = 0;
+  char *val = getenv(C_ENV_COMMIT_LOCK_TIMEOUT.c_str());
+  if (val) {
+    timeout = strtol(val, NULL, 10);
+  }
+  time_t deadline = time(NULL) + timeout;
+
+  int tfd = -1;
+  string ticket;
+  if (timeout == 0) {
+    // not going to wait => no need to queue
+  } else if (!get_commit_ticket(tfd, ticket)) {
+    // no queue => just the lock itself
+    output_internal("getCommitLock() failed to get ticket\n");
+  }
+  bool ret = wait_commit_queue(ticket, fd, timeout, deadline);
+  if (ret && !_timed_lock(fd, false, 0)) {
+    /* held by someone outside the queue (or the previous holder has not
+     * quite exited yet).
+     */
+    ret = false;
+    if (timeout != 0) {
+      report_commit_lock_holder(fd);
+      ret = _timed_lock(fd, false, _time_left(timeout, deadline));
+    }
+  }
+  if (!ticket.empty()) {
+    /* our ticket is no longer needed by newcomers. keep it locked until
+     * we exit if we got the lock so that waiters already queued behind
+     * us keep waiting.
+     */
+    unlink(ticket.c_str());
+  }
+  if (!ret) {
     // locked by someone else
+    if (tfd >= 0) {
+      close(tfd);
+    }
+    close(fd);
     return false;
   }
-  // got the lock
+
+  // got the lock. record the holder for waiters.
+  char buf[64];
+  int len = snprintf(buf, sizeof(buf), "%d %ld\n", (int) getpid(),
+                     (long) time(NULL));
+  if (pwrite(fd, buf, len, 0) != len || ftruncate(fd, len) != 0) {
+    output_internal("getCommitLock() failed to record holder\n");
+  }
   return true;
 }
 
+/* take a ticket in the commit queue. the ticket file is created locked
+ * and then linked into place so that it is never seen unlocked.
+ *
+ * ticket numbers come from a counter file in the queue dir, so they keep
+ * increasing and are never reused. a waiter can therefore safely remove
+ * a released ticket by name without hitting a newer waiter's ticket.
+ */
+bool
+UnionfsCstore::get_commit_ticket(int& tfd, string& ticket)
+{
+  string qdir = C_COMMIT_LOCK_FILE + C_COMMIT_QUEUE_SUFFIX;
+  if (mkdir(qdir.c_str(), 01777) == 0) {
+    chmod(qdir.c_str(), 01777);
+  } else if (errno != EEXIST) {
+    return false;
+  }
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/.tmp.%d", (int) getpid());
+  string tmp = qdir + buf;
+  tfd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (tfd < 0) {
+    return false;
+  }
+  string seq = qdir + "/" + C_COMMIT_QUEUE_SEQ_FILE;
+  int sfd = open(seq.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (flock(tfd, LOCK_EX) != 0 || sfd < 0 || flock(sfd, LOCK_EX) != 0) {
+    if (sfd >= 0) {
+      close(sfd);
+    }
+    close(tfd);
+    unlink(tmp.c_str());
+    tfd = -1;
+    return false;
+  }
+  // shared by all users
+  fchmod(sfd, 0666);
+  ssize_t len = pread(sfd, buf, sizeof(buf) - 1, 0);
+  buf[(len > 0) ? len : 0] = 0;
+  unsigned long n = strtoul(buf, NULL, 10) + 1;
+  int slen = snprintf(buf, sizeof(buf), "%lu\n", n);
+  if (pwrite(sfd, buf, slen, 0) == slen && ftruncate(sfd, slen) == 0) {
+    snprintf(buf, sizeof(buf), "/%020lu", n);
+    ticket = qdir + buf;
+    if (link(tmp.c_str(), ticket.c_str()) != 0) {
+      ticket = "";
+    }
+  }
+  close(sfd);
+  unlink(tmp.c_str());
+  if (ticket.empty()) {
+    close(tfd);
+    tfd = -1;
+    return false;
+  }
+  return true;
+}
+
+// get the sorted sequence numbers of the tickets in the commit queue
+void
+UnionfsCstore::get_commit_queue(const string& qdir,
+                                vector<unsigned long>& seqs)
+{
+  DIR *dp = opendir(qdir.c_str());
+  if (!dp) {
+    return;
+  }
+  struct dirent *de;
+  while ((de = readdir(dp))) {
+    if (de->d_name[0] >= '0' && de->d_name[0] <= '9') {
+      seqs.push_back(strtoul(de->d_name, NULL, 10));
+    }
+  }
+  closedir(dp);
+  std::sort(seqs.begin(), seqs.end());
+}
+
+/* wait for all tickets before the specified ticket to be released.
+ * return false if timed out.
+ */
+bool
+UnionfsCstore::wait_commit_queue(const string& ticket, int lock_fd,
+                                 long timeout, time_t deadline)
+{
+  if (ticket.empty()) {
+    return true;
+  }
+  string qdir = C_COMMIT_LOCK_FILE + C_COMMIT_QUEUE_SUFFIX;
+  unsigned long mine = strtoul(ticket.c_str() + qdir.size() + 1, NULL, 10);
+  vector<unsigned long> seqs;
+  get_commit_queue(qdir, seqs);
+  bool reported = false;
+  for (size_t i = 0; i < seqs.size() && seqs[i] < mine; i++) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "/%020lu", seqs[i]);
+    string t = qdir + buf;
+    int fd = open(t.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      // already gone
+      continue;
+    }
+    bool ok = _timed_lock(fd, true, 0);
+    if (!ok && timeout != 0) {
+      if (!reported) {
+        report_commit_lock_holder(lock_fd);
+        reported = true;
+      }
+      ok = _timed_lock(fd, true, _time_left(timeout, deadline));
+    }
+    if (ok) {
+      // released (holder/waiter exited or gave up)
+      unlink(t.c_str());
+    }
+    close(fd);
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// tell the user who is holding the commit lock and for how long
+void
+UnionfsCstore::report_commit_lock_holder(int lock_fd)
+{
+  char buf[64];
+  ssize_t len = pread(lock_fd, buf, sizeof(buf) - 1, 0);
+  int pid = 0;
+  long since = 0;
+  if (len > 0) {
+    buf[len] = 0;
+    if (sscanf(buf, "%d %ld", &pid, &since) != 2) {
+      pid = 0;
+    }
+  }
+  if (pid > 0) {
+    output_user("Waiting for commit lock held by process %d for %ld "
+                "seconds\n", pid, (long) (time(NULL) - since));
+  } else {
+    output_user("Waiting for commit lock\n");
+  }
+}
 
 ////// virtual functions defined in base class
 /* check if current tmpl_path is a valid tmpl dir.
@@ -911,6 +1579,8 @@ UnionfsCstore::tmpl_parse()
     return 0;
   }
 
+  // the template parser is not reentrant, so hold the lock while parsing
+  std::lock_guard<std::mutex> lock(_cache_mutex);
   ParsedTmplCacheT::iterator p = _parsed_tmpl_cache.find(tp);
   if (p != _parsed_tmpl_cache.end()) {
     // found in cache
@@ -931,6 +1601,10 @@ UnionfsCstore::tmpl_parse()
 bool
 UnionfsCstore::cfg_node_exists(bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    return (inode != ActiveImage::NO_NODE);
+  }
   FsPath p = (active_cfg ? get_active_path() : get_work_path());
   return (path_exists(p) && path_is_directory(p));
 }
@@ -982,6 +1656,11 @@ void
 UnionfsCstore::get_all_child_node_names_impl(vector<string>& cnodes,
                                              bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    active_image.getChildNames(inode, cnodes);
+    return;
+  }
   FsPath p = (active_cfg ? get_active_path() : get_work_path());
   get_all_child_dir_names(p, cnodes);
 
@@ -1006,6 +1685,10 @@ UnionfsCstore::get_all_child_node_names_impl(vector<string>& cnodes,
 bool
 UnionfsCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    return active_image.getValues(inode, vvec);
+  }
   FsPath vpath = (active_cfg ? get_active_path() : get_work_path());
   vpath.push(C_VAL_NAME);
 
@@ -1013,7 +1696,14 @@ UnionfsCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
   if (!read_whole_file(vpath, ostr)) {
     return false;
   }
+  parse_value_str(ostr, vvec);
+  return true;
+}
 
+// split the content of a value file into the value vector
+void
+UnionfsCstore::parse_value_str(const string& ostr, vector<string>& vvec)
+{
   /* XXX original implementation used to remove a trailing '\n' after
    *     a read. it was only necessary because it was adding a '\n' when
    *     writing the file. don't remove anything now since we shouldn't
@@ -1034,7 +1724,6 @@ UnionfsCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
     // last char is a newline => another empty value
     vvec.push_back("");
   }
-  return true;
 }
 
 bool
@@ -1043,6 +1732,11 @@ UnionfsCstore::write_value_vec(const vector<string>& vvec, bool active_cfg)
   FsPath wp = (active_cfg ? get_active_path() : get_work_path());
   wp.push(C_VAL_NAME);
 
+  if (active_cfg) {
+    // active config is being modified outside of commit
+    invalidate_active_image();
+  }
+
   if (path_exists(wp) && !path_is_regular(wp)) {
     // not a file
     output_internal("failed to write node value (file) [%s]\n",
@@ -1164,6 +1858,10 @@ UnionfsCstore::unmark_display_default()
 bool
 UnionfsCstore::marked_display_default(bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    return active_image.isDefault(inode);
+  }
   FsPath marker = (active_cfg ? get_active_path() : get_work_path());
   marker.push(C_MARKER_DEF_VALUE);
   return path_exists(marker);
@@ -1172,6 +1870,10 @@ UnionfsCstore::marked_display_default(bool active_cfg)
 bool
 UnionfsCstore::marked_deactivated(bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    return active_image.isDeactivated(inode);
+  }
   FsPath marker = (active_cfg ? get_active_path() : get_work_path());
   marker.push(C_MARKER_DEACTIVATE);
   return path_exists(marker);
@@ -1344,49 +2046,109 @@ UnionfsCstore::set_comment(const string& comment)
 bool
 UnionfsCstore::discard_changes(unsigned long long& num_removed)
 {
-  // need to keep unsaved marker
-  bool unsaved = sessionUnsaved();
-  bool ret = true;
+  /* the count only tells whether there was anything to discard, so
+   * count the top-level entries in change root instead of walking it.
+   */
+  num_removed = 0;
+  vector<string> entries;
+  DIR *dp = opendir(change_root.path_cstr());
+  if (!dp) {
+    output_internal("discard failed [%s]\n", change_root.path_cstr());
+    return false;
+  }
+  struct dirent *de;
+  while ((de = readdir(dp))) {
+    string dname = de->d_name;
+    if (dname != "." && dname != ".." && dname != C_MARKER_UNSAVED) {
+      entries.push_back(dname);
+    }
+  }
+  closedir(dp);
+  num_removed = entries.size();
+  if (num_removed == 0) {
+    // nothing to discard
+    return true;
+  }
 
-  vector<b_fs::path> files;
-  vector<b_fs::path> directories;
-  try {
-    // iterate through all entries in change root
-    b_fs::directory_iterator di(change_root.path_cstr());
-    for (; di != b_fs::directory_iterator(); ++di) {
-      if (path_is_directory(di->path().string().c_str())) {
-        directories.push_back(di->path());
-      } else {
-        files.push_back(di->path());
+  /* move the top-level entries of change root aside (into one dir in the
+   * graveyard) so that the union stays mounted, and the old tree is
+   * removed in the background. an entry that cannot be moved is removed
+   * here. the unsaved marker is left in place.
+   */
+  FsPath g;
+  bool use_g = (get_graveyard_path(change_root, g)
+                && mkdir(g.path_cstr(), 0775) == 0);
+  bool ret = true;
+  for (size_t i = 0; i < entries.size(); i++) {
+    FsPath src = change_root;
+    src.push(entries[i]);
+    if (use_g) {
+      FsPath dst = g;
+      dst.push(entries[i]);
+      if (rename(src.path_cstr(), dst.path_cstr()) == 0) {
+        continue;
       }
     }
+    try {
+      b_fs::remove_all(src.path_cstr());
+    } catch (...) {
+      output_internal("discard failed [%s]\n", src.path_cstr());
+      ret = false;
+    }
+  }
+  if (use_g) {
+    reap_graveyard(change_root);
+  }
+  return ret;
+}
 
-    // remove and count
-    num_removed = 0;
-    for (size_t i = 0; i < files.size(); i++) {
-      b_fs::remove(files[i]);
-      num_removed++;
+/* syncfs() the filesystem(s) holding the active config (including the
+ * active image) and the session's change root. return false if any
+ * fails (caller falls back to sync()).
+ */
+bool
+UnionfsCstore::sync_committed_config()
+{
+  const FsPath *dirs[] = { &active_root, &change_root, &tmp_root };
+  vector<dev_t> synced;
+  bool ret = true;
+  for (size_t i = 0; i < (sizeof(dirs) / sizeof(dirs[0])); i++) {
+    int fd = open(dirs[i]->path_cstr(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
     }
-    for (size_t i = 0; i < directories.size(); i++) {
-      num_removed += b_fs::remove_all(directories[i]);
+    struct stat st;
+    if (fstat(fd, &st) == 0
+        && std::find(synced.begin(), synced.end(), st.st_dev)
+           == synced.end()) {
+      if (syncfs(fd) != 0) {
+        output_internal("syncfs failed [%s][%s]\n", dirs[i]->path_cstr(),
+                        strerror(errno));
+        ret = false;
+      }
+      synced.push_back(st.st_dev);
     }
-  } catch (...) {
-    output_internal("discard failed [%s]\n", change_root.path_cstr());
-    ret = false;
+    close(fd);
   }
+  return (ret && synced.size() > 0);
+}
 
-  if (unsaved) {
-    // restore unsaved marker
-    num_removed--;
-    markSessionUnsaved();
-  }
-  return ret;
+Cstore *
+UnionfsCstore::new_read_view()
+{
+  UnionfsCstore *view = new UnionfsCstore(false);
+  view->init_read_view(*this);
+  return view;
 }
 
 // get comment at the current work or active path
 bool
 UnionfsCstore::get_comment(string& comment, bool active_cfg)
 {
+  uint32_t inode;
+  if (active_cfg && get_active_image_node(inode)) {
+    return active_image.getComment(inode, comment);
+  }
   FsPath cfile = (active_cfg ? get_active_path() : get_work_path());
   cfile.push(C_COMMENT_FILE);
   return read_whole_file(cfile, comment);
@@ -1475,6 +2237,27 @@ UnionfsCstore::pop_path(FsPath& path, string& last)
   last = _unescape_path_name(last);
 }
 
+string
+UnionfsCstore::unescape_path_name(const string& path)
+{
+  return _unescape_path_name(path);
+}
+
+void
+UnionfsCstore::init_read_view(const UnionfsCstore& cs)
+{
+  work_root = cs.work_root;
+  active_root = cs.active_root;
+  change_root = cs.change_root;
+  tmp_root = cs.tmp_root;
+  tmpl_root = cs.tmpl_root;
+  mutable_cfg_path = cs.mutable_cfg_path;
+  tmpl_path = cs.tmpl_path;
+  orig_mutable_cfg_path = cs.orig_mutable_cfg_path;
+  orig_tmpl_path = cs.orig_tmpl_path;
+  init_commit_data();
+}
+
 bool
 UnionfsCstore::check_dir_entries(const FsPath& root, vector<string> *cnodes,
                                  bool filter_nodes, bool empty_check)
@@ -28,6 +28,7 @@
 
 #include <cli_cstore.h>
 #include <cstore/cstore.hpp>
+#include <cstore/cstore-image.hpp>
 #include <cstore/unionfs/fspath.hpp>
 
 // forward decl
@@ -60,13 +61,21 @@ public:
   bool commitConfig(commit::PrioNode& pnode);
   bool getCommitLock();
 
-private:
+  /* the backend of the config store, i.e., the name in the file
+   * "<active root>.backend" (empty if none, i.e., this backend). the
+   * backend is selected for the whole store (not per session) so that all
+   * sessions and all readers, including op mode, use the same one.
+   */
+  static string getStoreBackend();
+
+protected:
   // constants
   static const string C_ENV_TMPL_ROOT;
   static const string C_ENV_WORK_ROOT;
   static const string C_ENV_ACTIVE_ROOT;
   static const string C_ENV_CHANGE_ROOT;
   static const string C_ENV_TMP_ROOT;
+  static const string C_ENV_COMMIT_LOCK_TIMEOUT;
 
   static const string C_DEF_TMPL_ROOT;
   static const string C_DEF_CFG_ROOT;
@@ -86,6 +95,10 @@ private:
   static const string C_VAL_NAME;
   static const string C_DEF_NAME;
   static const string C_COMMIT_LOCK_FILE;
+  static const string C_COMMIT_QUEUE_SUFFIX;
+  static const string C_COMMIT_QUEUE_SEQ_FILE;
+  static const string C_ACTIVE_IMAGE_SUFFIX;
+  static const string C_BACKEND_SUFFIX;
 
   /* max size for a file.
    * currently this includes value file and comment file.
@@ -104,6 +117,8 @@ private:
   FsPath tmpl_path;         // whole template path
   FsPath orig_mutable_cfg_path;  // original mutable cfg path
   FsPath orig_tmpl_path;         // original template path
+  // set up a read view with the same roots and paths
+  void init_read_view(const UnionfsCstore& cs);
 
   // for commit processing
   FsPath tmp_active_root;
@@ -117,10 +132,54 @@ private:
     tmp_work_root.push("work");
     commit_marker_file.push(C_COMMITTED_MARKER_FILE);
   }
-  bool construct_commit_active(commit::PrioNode& node);
+  bool construct_commit_active(commit::PrioNode& node,
+                               const FsPath& work_src);
+  void publish_active_image();
+  void invalidate_active_image();
+
+  // image of the active config (see cstore-image.hpp)
+  ActiveImage active_image;
+  string get_active_image_file() {
+    return (string(active_root.path_cstr()) + C_ACTIVE_IMAGE_SUFFIX);
+  };
+  bool get_active_image_node(uint32_t& node);
+  void build_image_tree(const FsPath& dir, ActiveImageNode& inode);
   bool mark_dir_changed(const FsPath& d, const FsPath& root);
   bool sync_dir(const FsPath& src, const FsPath& dst, const FsPath& root);
 
+  /* session liveness registry.
+   * each live session has a file "<work base>/.sessions/<sid>" that
+   * records the start time of the session's shell (i.e., process <sid>),
+   * so the session is stale once that process is gone (even if the pid has
+   * been reused). a session whose ID is not a pid has a lease instead,
+   * which is renewed whenever the session is used, and it is stale if it
+   * has not been used for C_SESSION_LEASE seconds.
+   */
+  static const string C_SESSION_REGISTRY_DIR;
+  static const unsigned int C_SESSION_LEASE = 86400;
+  FsPath get_work_base();
+  string get_session_id();
+  bool register_session();
+  void unregister_session();
+  void renew_session_lease();
+  bool session_alive(const FsPath& reg_dir, const string& sid);
+  void remove_stale_session(const FsPath& work_base, const string& sid);
+
+  /* dirs to be removed are renamed into "<parent>/.graveyard" and removed
+   * by a background reaper.
+   */
+  static const string C_GRAVEYARD_DIR;
+  bool get_graveyard_path(const FsPath& d, FsPath& g);
+  bool move_to_graveyard(const FsPath& d);
+  void reap_graveyard(const FsPath& d);
+
+  // commit lock queue
+  bool get_commit_ticket(int& tfd, string& ticket);
+  void get_commit_queue(const string& qdir, vector<unsigned long>& seqs);
+  bool wait_commit_queue(const string& ticket, int lock_fd, long timeout,
+                         time_t deadline);
+  void report_commit_lock_holder(int lock_fd);
+
   ////// virtual functions defined in base class
   // begin path modifiers
   void push_tmpl_path(const char *new_comp) {
@@ -228,6 +287,8 @@ private:
   bool remove_comment();
   bool set_comment(const string& comment);
   bool discard_changes(unsigned long long& num_removed);
+  bool sync_committed_config();
+  Cstore *new_read_view();
 
   // observers for work path
   bool cfg_node_changed();
@@ -292,8 +353,11 @@ private:
                           bool filter_dot_entries = false);
   void get_committed_marker(bool is_delete, string& marker);
   bool find_line_in_file(const FsPath& file, const string& line);
-  bool do_mount(const FsPath& rwdir, const FsPath& rdir, const FsPath& mdir);
-  bool do_umount(const FsPath& mdir);
+  virtual bool do_mount(const FsPath& rwdir, const FsPath& rdir,
+                        const FsPath& mdir);
+  virtual bool do_umount(const FsPath& mdir);
+  static void parse_value_str(const string& ostr, vector<string>& vvec);
+  static string unescape_path_name(const string& path);
 
   // boost fs operations wrappers
   bool b_fs_get_file_status(const char *path, b_fs::file_status& fs) {
@@ -0,0 +1,987 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <cli_cstore.h>
+#include <cstore/unionfs/cstore-unionview.hpp>
+#include <commit/commit-algorithm.hpp>
+
+namespace cstore { // begin namespace cstore
+namespace unionfs { // begin namespace unionfs
+
+////// constants
+const string UnionviewCstore::C_BACKEND_NAME = "unionview";
+
+// same convention as the kernel unionfs (see also common/unionfs.h)
+const string UnionviewCstore::C_WHITEOUT_PREFIX = ".wh.";
+const string UnionviewCstore::C_OPAQUE_MARKER = ".wh.__dir_opaque";
+
+////// static
+static void
+_split_path(const FsPath& rel, vector<string>& comps)
+{
+  FsPath p(rel); // use a copy
+  vector<string> tmp;
+  while (p.has_parent_path()) {
+    string last;
+    p.pop(last);
+    tmp.push_back(last);
+  }
+  comps.assign(tmp.rbegin(), tmp.rend());
+}
+
+////// constructor/destructor
+// see UnionfsCstore for details on the two constructors
+UnionviewCstore::UnionviewCstore(bool use_edit_level)
+  : UnionfsCstore(use_edit_level)
+{
+}
+
+UnionviewCstore::UnionviewCstore(const string& sid, string& env)
+  : UnionfsCstore(sid, env)
+{
+}
+
+UnionviewCstore::~UnionviewCstore()
+{
+}
+
+////// public virtual functions declared in base class
+bool
+UnionviewCstore::markSessionUnsaved()
+{
+  FsPath marker = root_marker(C_MARKER_UNSAVED);
+  if (view_exists(marker)) {
+    // already marked. treat as success.
+    return true;
+  }
+  if (!view_write_file(marker, "")) {
+    output_internal("failed to mark unsaved [%s]\n",
+                    upper_path(marker).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+UnionviewCstore::unmarkSessionUnsaved()
+{
+  FsPath marker = root_marker(C_MARKER_UNSAVED);
+  if (!view_exists(marker)) {
+    // not marked. treat as success.
+    return true;
+  }
+  if (!view_remove(marker)) {
+    output_internal("failed to unmark unsaved [%s]\n",
+                    upper_path(marker).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+UnionviewCstore::sessionUnsaved()
+{
+  return view_exists(root_marker(C_MARKER_UNSAVED));
+}
+
+bool
+UnionviewCstore::sessionChanged()
+{
+  return view_exists(root_marker(C_MARKER_CHANGED));
+}
+
+/* same steps as UnionfsCstore::commitConfig() except that the working
+ * config is snapshotted from the view and the changes that did not make
+ * it into the new active config are synced back into the change root
+ * directly (instead of through the union mount).
+ */
+bool
+UnionviewCstore::commitConfig(commit::PrioNode& node)
+{
+  FsPath root;
+
+  // make a copy of current "work" config
+  try {
+    if (path_exists(tmp_work_root)) {
+      output_internal("rm[%s]\n", tmp_work_root.path_cstr());
+      if (b_fs::remove_all(tmp_work_root.path_cstr()) < 1) {
+        output_internal("rm tw failed\n");
+        return false;
+      }
+    }
+    output_internal("cp[view]->[%s]\n", tmp_work_root.path_cstr());
+    view_export_tree(root, tmp_work_root, true);
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("cp w->tw failed[%s]\n", e.what());
+    return false;
+  } catch (...) {
+    output_internal("cp w->tw failed[unknown exception]\n");
+    return false;
+  }
+
+  if (!construct_commit_active(node, tmp_work_root)) {
+    return false;
+  }
+
+  if (b_fs::remove_all(change_root.path_cstr()) < 1) {
+    output_internal("failed to remove [%s]\n", change_root.path_cstr());
+    return false;
+  }
+  invalidate_active_image();
+  if (!remove_dir_content(active_root.path_cstr())) {
+    output_internal("failed to remove [%s] content\n",
+                    active_root.path_cstr());
+    return false;
+  }
+  try {
+    b_fs::create_directories(change_root.path_cstr());
+    recursive_copy_dir(tmp_active_root, active_root, true);
+  } catch (const b_fs::filesystem_error& e) {
+    output_internal("cp ta->a failed[%s]\n", e.what());
+    return false;
+  } catch (...) {
+    output_internal("cp ta->a failed[unknown exception]\n");
+    return false;
+  }
+  publish_active_image();
+  // view is now the new active config => re-apply uncommitted changes
+  if (!view_sync(tmp_work_root, root)) {
+    return false;
+  }
+  if (b_fs::remove_all(tmp_work_root.path_cstr()) < 1
+      || b_fs::remove_all(tmp_active_root.path_cstr()) < 1) {
+    output_user("failed to remove temp directories\n");
+    return false;
+  }
+  // all done
+  return true;
+}
+
+
+////// virtual functions defined in base class
+Cstore *
+UnionviewCstore::new_read_view()
+{
+  UnionviewCstore *view = new UnionviewCstore(false);
+  view->init_read_view(*this);
+  return view;
+}
+
+bool
+UnionviewCstore::cfg_node_exists(bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::cfg_node_exists(true);
+  }
+  return view_is_directory(mutable_cfg_path);
+}
+
+bool
+UnionviewCstore::add_node()
+{
+  if (view_exists(mutable_cfg_path) || !view_mkdir(mutable_cfg_path)) {
+    output_internal("failed to add node [%s]\n",
+                    upper_path(mutable_cfg_path).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+UnionviewCstore::remove_node()
+{
+  if (!view_is_directory(mutable_cfg_path)) {
+    output_internal("remove non-existent node [%s]\n",
+                    upper_path(mutable_cfg_path).path_cstr());
+    return false;
+  }
+  if (!view_remove(mutable_cfg_path)) {
+    output_internal("failed to remove node [%s]\n",
+                    upper_path(mutable_cfg_path).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+void
+UnionviewCstore::get_all_child_node_names_impl(vector<string>& cnodes,
+                                               bool active_cfg)
+{
+  if (active_cfg) {
+    UnionfsCstore::get_all_child_node_names_impl(cnodes, true);
+    return;
+  }
+  vector<string> entries;
+  view_list(mutable_cfg_path, entries, true);
+  for (size_t i = 0; i < entries.size(); i++) {
+    cnodes.push_back(unescape_path_name(entries[i]));
+  }
+}
+
+bool
+UnionviewCstore::read_value_vec(vector<string>& vvec, bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::read_value_vec(vvec, true);
+  }
+  FsPath vpath(mutable_cfg_path);
+  vpath.push(C_VAL_NAME);
+  string ostr;
+  if (!view_read_file(vpath, ostr)) {
+    return false;
+  }
+  parse_value_str(ostr, vvec);
+  return true;
+}
+
+bool
+UnionviewCstore::write_value_vec(const vector<string>& vvec, bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::write_value_vec(vvec, true);
+  }
+  FsPath vpath(mutable_cfg_path);
+  vpath.push(C_VAL_NAME);
+  FsPath phys;
+  if (view_resolve(vpath, phys) && !path_is_regular(phys)) {
+    // not a file
+    output_internal("failed to write node value (file) [%s]\n",
+                    phys.path_cstr());
+    return false;
+  }
+
+  string ostr = "";
+  for (size_t i = 0; i < vvec.size(); i++) {
+    if (i > 0) {
+      // subsequent values require delimiter
+      ostr += "\n";
+    }
+    ostr += vvec[i];
+  }
+
+  if (!view_write_file(vpath, ostr)) {
+    output_internal("failed to write node value (write) [%s]\n",
+                    upper_path(vpath).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+bool
+UnionviewCstore::rename_child_node(const char *oname, const char *nname)
+{
+  FsPath opath(mutable_cfg_path);
+  push_path(opath, oname);
+  FsPath npath(mutable_cfg_path);
+  push_path(npath, nname);
+  if (!view_is_directory(opath) || view_exists(npath)) {
+    output_internal("cannot rename node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+    return false;
+  }
+  bool ret = true;
+  try {
+    if (!view_mkdir(npath)) {
+      ret = false;
+    } else {
+      view_export_tree(opath, upper_path(npath), false);
+      ret = view_remove(opath);
+    }
+  } catch (...) {
+    ret = false;
+  }
+  if (!ret) {
+    output_internal("failed to rename node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+  }
+  return ret;
+}
+
+bool
+UnionviewCstore::copy_child_node(const char *oname, const char *nname)
+{
+  FsPath opath(mutable_cfg_path);
+  push_path(opath, oname);
+  FsPath npath(mutable_cfg_path);
+  push_path(npath, nname);
+  if (!view_is_directory(opath) || view_exists(npath)) {
+    output_internal("cannot copy node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+    return false;
+  }
+  bool ret = true;
+  try {
+    if (!view_mkdir(npath)) {
+      ret = false;
+    } else {
+      view_export_tree(opath, upper_path(npath), false);
+    }
+  } catch (...) {
+    ret = false;
+  }
+  if (!ret) {
+    output_internal("failed to copy node [%s,%s,%s]\n",
+                    cfg_path_to_str().c_str(), oname, nname);
+  }
+  return ret;
+}
+
+bool
+UnionviewCstore::mark_display_default()
+{
+  return view_mark(C_MARKER_DEF_VALUE, "default");
+}
+
+bool
+UnionviewCstore::unmark_display_default()
+{
+  return view_unmark(C_MARKER_DEF_VALUE, "default");
+}
+
+bool
+UnionviewCstore::marked_display_default(bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::marked_display_default(true);
+  }
+  return view_marked(C_MARKER_DEF_VALUE);
+}
+
+bool
+UnionviewCstore::marked_deactivated(bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::marked_deactivated(true);
+  }
+  return view_marked(C_MARKER_DEACTIVATE);
+}
+
+bool
+UnionviewCstore::mark_deactivated()
+{
+  return view_mark(C_MARKER_DEACTIVATE, "deactivated");
+}
+
+bool
+UnionviewCstore::unmark_deactivated()
+{
+  return view_unmark(C_MARKER_DEACTIVATE, "deactivated");
+}
+
+bool
+UnionviewCstore::unmark_deactivated_descendants()
+{
+  bool ret = false;
+  do {
+    // sanity check
+    if (!view_is_directory(mutable_cfg_path)) {
+      break;
+    }
+    try {
+      // don't unmark the node itself
+      vector<FsPath> markers;
+      view_find_markers(mutable_cfg_path, C_MARKER_DEACTIVATE, false,
+                        markers);
+      size_t i = 0;
+      for (; i < markers.size(); i++) {
+        if (!view_remove(markers[i])) {
+          break;
+        }
+      }
+      if (i < markers.size()) {
+        break;
+      }
+    } catch (...) {
+      break;
+    }
+    ret = true;
+  } while (0);
+  if (!ret) {
+    output_internal("failed to unmark deactivated descendants [%s]\n",
+                    cfg_path_to_str().c_str());
+  }
+  return ret;
+}
+
+// mark current work path and all ancestors as "changed"
+bool
+UnionviewCstore::mark_changed_with_ancestors()
+{
+  FsPath opath = mutable_cfg_path; // use a copy
+  while (opath.has_parent_path() && !view_is_directory(opath)) {
+    // don't do anything if the node is not there
+    pop_path(opath);
+  }
+  return view_mark_changed(opath);
+}
+
+/* remove all "changed" markers under the current work path. this is used,
+ * e.g., at the end of "commit" to reset a subtree.
+ */
+bool
+UnionviewCstore::unmark_changed_with_descendants()
+{
+  try {
+    vector<FsPath> markers;
+    view_find_markers(mutable_cfg_path, C_MARKER_CHANGED, true, markers);
+    for (size_t i = 0; i < markers.size(); i++) {
+      if (!view_remove(markers[i])) {
+        throw 0;
+      }
+    }
+  } catch (...) {
+    output_internal("failed to unmark changed with descendants [%s]\n",
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+// remove the comment at the current work path
+bool
+UnionviewCstore::remove_comment()
+{
+  FsPath cfile(mutable_cfg_path);
+  cfile.push(C_COMMENT_FILE);
+  if (!view_exists(cfile)) {
+    return false;
+  }
+  if (!view_remove(cfile)) {
+    output_internal("failed to remove comment [%s]\n",
+                    upper_path(cfile).path_cstr());
+    return false;
+  }
+  return true;
+}
+
+// set comment at the current work path
+bool
+UnionviewCstore::set_comment(const string& comment)
+{
+  FsPath cfile(mutable_cfg_path);
+  cfile.push(C_COMMENT_FILE);
+  return view_write_file(cfile, comment);
+}
+
+// get comment at the current work or active path
+bool
+UnionviewCstore::get_comment(string& comment, bool active_cfg)
+{
+  if (active_cfg) {
+    return UnionfsCstore::get_comment(comment, true);
+  }
+  FsPath cfile(mutable_cfg_path);
+  cfile.push(C_COMMENT_FILE);
+  return view_read_file(cfile, comment);
+}
+
+// whether current work path is "changed"
+bool
+UnionviewCstore::cfg_node_changed()
+{
+  return view_marked(C_MARKER_CHANGED);
+}
+
+bool
+UnionviewCstore::do_mount(const FsPath& rwdir, const FsPath& rdir,
+                          const FsPath& mdir)
+{
+  // nothing to mount. the union is computed by this object.
+  return true;
+}
+
+bool
+UnionviewCstore::do_umount(const FsPath& mdir)
+{
+  return true;
+}
+
+
+////// private functions
+// whiteout file for the specified path (which must not be the root)
+FsPath
+UnionviewCstore::whiteout_path(const FsPath& rel)
+{
+  FsPath parent(rel);
+  string name;
+  parent.pop(name);
+  FsPath wh = upper_path(parent);
+  wh.push(C_WHITEOUT_PREFIX + name);
+  return wh;
+}
+
+/* whether the active (lower) entry at the specified path is visible, i.e.,
+ * neither the entry itself nor any of its ancestors has been whited out,
+ * and none of its ancestors is opaque in the change root.
+ */
+bool
+UnionviewCstore::lower_visible(const FsPath& rel)
+{
+  vector<string> comps;
+  _split_path(rel, comps);
+  FsPath up(change_root);
+  for (size_t i = 0; i < comps.size(); i++) {
+    FsPath marker(up);
+    marker.push(C_OPAQUE_MARKER);
+    if (path_exists(marker)) {
+      return false;
+    }
+    marker.pop();
+    marker.push(C_WHITEOUT_PREFIX + comps[i]);
+    if (path_exists(marker)) {
+      return false;
+    }
+    up.push(comps[i]);
+  }
+  return true;
+}
+
+/* find the physical entry backing the specified path in the view.
+ * return false if the path does not exist in the view.
+ */
+bool
+UnionviewCstore::view_resolve(const FsPath& rel, FsPath& phys)
+{
+  FsPath up = upper_path(rel);
+  if (path_exists(up)) {
+    phys = up;
+    return true;
+  }
+  FsPath lp = lower_path(rel);
+  if (path_exists(lp) && lower_visible(rel)) {
+    phys = lp;
+    return true;
+  }
+  return false;
+}
+
+/* list the (escaped) names of entries in the specified directory of the
+ * view. if filter_nodes, only return "node" entries, i.e., directories
+ * whose names don't start with ".". whiteouts/opaque markers are never
+ * returned.
+ */
+void
+UnionviewCstore::view_list(const FsPath& rel, vector<string>& entries,
+                           bool filter_nodes)
+{
+  FsPath up = upper_path(rel);
+  FsPath lp = lower_path(rel);
+  MapT<string, bool> seen;
+  vector<string> names;
+
+  list_dir(up, names);
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i].find(C_WHITEOUT_PREFIX) == 0) {
+      continue;
+    }
+    seen[names[i]] = true;
+    FsPath p(up);
+    p.push(names[i]);
+    if (filter_nodes
+        && (names[i][0] == '.' || !path_is_directory(p))) {
+      continue;
+    }
+    entries.push_back(names[i]);
+  }
+
+  FsPath opaque(up);
+  opaque.push(C_OPAQUE_MARKER);
+  if (!path_is_directory(lp) || path_exists(opaque) || !lower_visible(rel)) {
+    return;
+  }
+  names.clear();
+  list_dir(lp, names);
+  for (size_t i = 0; i < names.size(); i++) {
+    if (seen.find(names[i]) != seen.end()) {
+      // shadowed by change root
+      continue;
+    }
+    FsPath wh(up);
+    wh.push(C_WHITEOUT_PREFIX + names[i]);
+    if (path_exists(wh)) {
+      // deleted
+      continue;
+    }
+    FsPath p(lp);
+    p.push(names[i]);
+    if (filter_nodes
+        && (names[i][0] == '.' || !path_is_directory(p))) {
+      continue;
+    }
+    entries.push_back(names[i]);
+  }
+}
+
+bool
+UnionviewCstore::view_read_file(const FsPath& rel, string& data)
+{
+  FsPath phys;
+  if (!view_resolve(rel, phys)) {
+    return false;
+  }
+  return read_whole_file(phys, data);
+}
+
+// write a file in the view. the parent directory must exist in the view.
+bool
+UnionviewCstore::view_write_file(const FsPath& rel, const string& data)
+{
+  FsPath parent(rel);
+  parent.pop();
+  if (!view_copy_up_dir(parent)) {
+    return false;
+  }
+  FsPath wh = whiteout_path(rel);
+  try {
+    if (path_exists(wh)) {
+      b_fs::remove(wh.path_cstr());
+    }
+  } catch (...) {
+    return false;
+  }
+  return write_file(upper_path(rel), data);
+}
+
+/* make sure the specified directory of the view is present in the change
+ * root so that entries can be added to it. directories are created
+ * empty, so whatever is in the active root is still visible through them.
+ */
+bool
+UnionviewCstore::view_copy_up_dir(const FsPath& rel)
+{
+  vector<string> comps;
+  _split_path(rel, comps);
+  FsPath up(change_root);
+  try {
+    if (!path_is_directory(up)) {
+      b_fs::create_directories(up.path_cstr());
+    }
+    for (size_t i = 0; i < comps.size(); i++) {
+      up.push(comps[i]);
+      if (!path_is_directory(up)) {
+        b_fs::create_directory(up.path_cstr());
+      }
+    }
+  } catch (...) {
+    output_internal("failed to copy up [%s]\n", up.path_cstr());
+    return false;
+  }
+  return true;
+}
+
+/* create a new directory in the view. if a deleted directory is being
+ * re-created, the new one is made opaque so that the old content in the
+ * active root stays hidden.
+ */
+bool
+UnionviewCstore::view_mkdir(const FsPath& rel)
+{
+  FsPath parent(rel);
+  parent.pop();
+  if (!view_copy_up_dir(parent)) {
+    return false;
+  }
+  FsPath up = upper_path(rel);
+  FsPath wh = whiteout_path(rel);
+  try {
+    bool opaque = false;
+    if (path_exists(wh)) {
+      b_fs::remove(wh.path_cstr());
+      opaque = true;
+    }
+    if (!b_fs::create_directory(up.path_cstr())) {
+      return false;
+    }
+    if (opaque) {
+      FsPath marker(up);
+      marker.push(C_OPAQUE_MARKER);
+      if (!create_file(marker)) {
+        return false;
+      }
+    }
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+// remove the specified file or directory from the view
+bool
+UnionviewCstore::view_remove(const FsPath& rel)
+{
+  FsPath up = upper_path(rel);
+  FsPath lp = lower_path(rel);
+  bool in_lower = (path_exists(lp) && lower_visible(rel));
+  try {
+    if (path_exists(up)) {
+      b_fs::remove_all(up.path_cstr());
+    }
+  } catch (...) {
+    return false;
+  }
+  if (!in_lower) {
+    return true;
+  }
+  // still visible from active root => white it out
+  FsPath parent(rel);
+  parent.pop();
+  if (!view_copy_up_dir(parent)) {
+    return false;
+  }
+  return create_file(whiteout_path(rel));
+}
+
+/* copy the specified directory of the view to physical destination dst.
+ * will throw exception (from b_fs) if fail.
+ */
+void
+UnionviewCstore::view_export_tree(const FsPath& rel, const FsPath& dst,
+                                  bool filter_dot_entries)
+{
+  b_fs::create_directories(dst.path_cstr());
+
+  vector<string> entries;
+  view_list(rel, entries, false);
+  for (size_t i = 0; i < entries.size(); i++) {
+    FsPath s(rel);
+    FsPath d(dst);
+    s.push(entries[i]);
+    d.push(entries[i]);
+    if (view_is_directory(s)) {
+      view_export_tree(s, d, filter_dot_entries);
+      continue;
+    }
+    if (filter_dot_entries && entries[i][0] == '.'
+        && entries[i] != C_COMMENT_FILE) {
+      // filter dot files (with exceptions)
+      continue;
+    }
+    string data;
+    if (!view_read_file(s, data) || !write_file(d, data)) {
+      throw b_fs::filesystem_error("view export failed",
+                                   b_fs::path(d.path_cstr()),
+                                   b_s::error_code());
+    }
+  }
+}
+
+// collect all "marker" files under the specified directory of the view
+void
+UnionviewCstore::view_find_markers(const FsPath& rel, const string& marker,
+                                   bool include_self, vector<FsPath>& found)
+{
+  if (include_self) {
+    FsPath m(rel);
+    m.push(marker);
+    if (view_exists(m)) {
+      found.push_back(m);
+    }
+  }
+  vector<string> cnodes;
+  view_list(rel, cnodes, true);
+  for (size_t i = 0; i < cnodes.size(); i++) {
+    FsPath c(rel);
+    c.push(cnodes[i]);
+    view_find_markers(c, marker, true, found);
+  }
+}
+
+// mark the specified directory and all its ancestors as "changed"
+bool
+UnionviewCstore::view_mark_changed(const FsPath& rel)
+{
+  FsPath opath(rel); // use a copy
+  while (true) {
+    FsPath marker(opath);
+    marker.push(C_MARKER_CHANGED);
+    if (view_exists(marker)) {
+      // reached a node already marked => done
+      break;
+    }
+    if (!view_write_file(marker, "")) {
+      output_internal("failed to mark changed [%s]\n",
+                      upper_path(marker).path_cstr());
+      return false;
+    }
+    if (!opath.has_parent_path()) {
+      break;
+    }
+    opath.pop();
+  }
+  return true;
+}
+
+/* make the specified directory of the view identical to physical source
+ * directory src (see UnionfsCstore::sync_dir()).
+ */
+bool
+UnionviewCstore::view_sync(const FsPath& src, const FsPath& rel)
+{
+  if (!path_is_directory(src) || !view_is_directory(rel)) {
+    output_user("sync_dir with non-existing dir(s)[%s][%s]\n",
+                src.path_cstr(), upper_path(rel).path_cstr());
+    return false;
+  }
+  MapT<string, bool> smap;
+  MapT<string, bool> dmap;
+  vector<string> sentries;
+  vector<string> dentries;
+  list_dir(src, sentries);
+  view_list(rel, dentries, false);
+  for (size_t i = 0; i < sentries.size(); i++) {
+    smap[sentries[i]] = true;
+  }
+  for (size_t i = 0; i < dentries.size(); i++) {
+    dmap[dentries[i]] = true;
+    FsPath d(rel);
+    d.push(dentries[i]);
+    if (smap.find(dentries[i]) == smap.end()) {
+      // entry in view but not in src => delete
+      if (!view_mark_changed(rel) || !view_remove(d)) {
+        return false;
+      }
+      continue;
+    }
+    // entry in both src and view
+    FsPath s(src);
+    s.push(dentries[i]);
+    if (path_is_regular(s) && !view_is_directory(d)) {
+      // it's file => compare and replace if necessary
+      string ds, dd;
+      if (!read_whole_file(s, ds) || !view_read_file(d, dd)) {
+        output_user("failed to replace file [%s][%s]\n",
+                    s.path_cstr(), upper_path(d).path_cstr());
+        return false;
+      }
+      if (ds != dd) {
+        if (!view_write_file(d, ds)) {
+          output_user("failed to write file [%s]\n",
+                      upper_path(d).path_cstr());
+          return false;
+        }
+        if (!view_mark_changed(rel)) {
+          return false;
+        }
+      }
+    } else if (path_is_directory(s) && view_is_directory(d)) {
+      // it's dir => recurse
+      if (!view_sync(s, d)) {
+        return false;
+      }
+    } else {
+      // something is wrong
+      output_user("inconsistent config entry [%s][%s]\n",
+                  s.path_cstr(), upper_path(d).path_cstr());
+      return false;
+    }
+  }
+  for (size_t i = 0; i < sentries.size(); i++) {
+    if (dmap.find(sentries[i]) != dmap.end()) {
+      continue;
+    }
+    // entry in src but not in view => copy
+    FsPath s(src);
+    FsPath d(rel);
+    s.push(sentries[i]);
+    d.push(sentries[i]);
+    try {
+      if (path_is_regular(s)) {
+        string data;
+        if (!read_whole_file(s, data) || !view_write_file(d, data)) {
+          throw 0;
+        }
+      } else {
+        if (!view_mkdir(d)) {
+          throw 0;
+        }
+        recursive_copy_dir(s, upper_path(d), true);
+      }
+      if (!view_mark_changed(rel)) {
+        return false;
+      }
+    } catch (...) {
+      output_user("copy failed [%s][%s]\n", s.path_cstr(),
+                  upper_path(d).path_cstr());
+      return false;
+    }
+  }
+  return true;
+}
+
+// list the (escaped) names of all entries in physical directory d
+void
+UnionviewCstore::list_dir(const FsPath& d, vector<string>& entries)
+{
+  if (!path_is_directory(d)) {
+    return;
+  }
+  try {
+    b_fs::directory_iterator di(d.path_cstr());
+    for (; di != b_fs::directory_iterator(); ++di) {
+      entries.push_back(di->path().filename().string());
+    }
+  } catch (...) {
+    // skip the rest
+  }
+}
+
+bool
+UnionviewCstore::view_marked(const string& marker)
+{
+  FsPath m(mutable_cfg_path);
+  m.push(marker);
+  return view_exists(m);
+}
+
+bool
+UnionviewCstore::view_mark(const string& marker, const char *what)
+{
+  FsPath m(mutable_cfg_path);
+  m.push(marker);
+  if (view_exists(m)) {
+    // already marked. treat as success.
+    return true;
+  }
+  if (!view_write_file(m, "")) {
+    output_internal("failed to mark %s [%s]\n", what,
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool
+UnionviewCstore::view_unmark(const string& marker, const char *what)
+{
+  FsPath m(mutable_cfg_path);
+  m.push(marker);
+  if (!view_exists(m)) {
+    // not marked. treat as success.
+    return true;
+  }
+  if (!view_remove(m)) {
+    output_internal("failed to unmark %s [%s]\n", what,
+                    cfg_path_to_str().c_str());
+    return false;
+  }
+  return true;
+}
+
+} // end namespace unionfs
+} // end namespace cstore
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CSTORE_UNIONVIEW_H_
+#define _CSTORE_UNIONVIEW_H_
+#include <vector>
+#include <string>
+
+#include <cstore/unionfs/cstore-unionfs.hpp>
+
+namespace cstore { // begin namespace cstore
+namespace unionfs { // begin namespace unionfs
+
+/* "union view" backend.
+ *
+ * uses the same on-disk layout as UnionfsCstore (active root + "changes
+ * only" root) but never mounts anything. instead, the union of the two
+ * trees is computed in-process:
+ *   - an entry in the change root hides the same entry in the active root.
+ *   - a ".wh.<name>" file in a change root directory marks "<name>" as
+ *     deleted (whiteout).
+ *   - a ".wh.__dir_opaque" file in a change root directory hides all
+ *     entries of the same directory in the active root.
+ * this is the same convention used by the kernel unionfs, so a session
+ * created by this backend can still be inspected with the usual tools.
+ *
+ * the backend is only used if it is selected for the whole store (see
+ * UnionfsCstore::getStoreBackend()), so sessions of this backend never
+ * coexist with mounted sessions that see the same dirs differently.
+ *
+ * note: the work root is still created as the session anchor but it stays
+ *       empty, so consumers that read VYATTA_TEMP_CONFIG_DIR directly
+ *       (instead of going through the cstore API) will not see the
+ *       working config. a store must not be switched to this backend if
+ *       such consumers are in use.
+ */
+class UnionviewCstore : public UnionfsCstore {
+public:
+  UnionviewCstore(bool use_edit_level);
+  UnionviewCstore(const string& session_id, string& env);
+  virtual ~UnionviewCstore();
+
+  // name selecting this backend for the store (see getStoreBackend())
+  static const string C_BACKEND_NAME;
+
+  ////// public virtual functions declared in base class
+  bool markSessionUnsaved();
+  bool unmarkSessionUnsaved();
+  bool sessionUnsaved();
+  bool sessionChanged();
+  bool commitConfig(commit::PrioNode& pnode);
+
+private:
+  // constants
+  static const string C_WHITEOUT_PREFIX;
+  static const string C_OPAQUE_MARKER;
+
+  ////// virtual functions defined in base class
+  Cstore *new_read_view();
+
+  // these operate on current work path
+  bool add_node();
+  bool remove_node();
+  void get_all_child_node_names_impl(vector<string>& cnodes, bool active_cfg);
+  bool write_value_vec(const vector<string>& vvec, bool active_cfg);
+  bool rename_child_node(const char *oname, const char *nname);
+  bool copy_child_node(const char *oname, const char *nname);
+  bool mark_display_default();
+  bool unmark_display_default();
+  bool mark_deactivated();
+  bool unmark_deactivated();
+  bool unmark_deactivated_descendants();
+  bool mark_changed_with_ancestors();
+  bool unmark_changed_with_descendants();
+  bool remove_comment();
+  bool set_comment(const string& comment);
+
+  // observers for work path
+  bool cfg_node_changed();
+
+  // observers for work path or active path
+  bool cfg_node_exists(bool active_cfg);
+  bool read_value_vec(vector<string>& vvec, bool active_cfg);
+  bool marked_deactivated(bool active_cfg);
+  bool get_comment(string& comment, bool active_cfg);
+  bool marked_display_default(bool active_cfg);
+
+  // no union mount for this backend
+  bool do_mount(const FsPath& rwdir, const FsPath& rdir, const FsPath& mdir);
+  bool do_umount(const FsPath& mdir);
+
+  ////// private functions
+  /* the following operate on paths relative to the root of the union,
+   * i.e., the same form as mutable_cfg_path.
+   */
+  FsPath upper_path(const FsPath& rel) {
+    FsPath p(change_root);
+    p /= rel;
+    return p;
+  };
+  FsPath lower_path(const FsPath& rel) {
+    FsPath p(active_root);
+    p /= rel;
+    return p;
+  };
+  FsPath whiteout_path(const FsPath& rel);
+  bool lower_visible(const FsPath& rel);
+  bool view_resolve(const FsPath& rel, FsPath& phys);
+  bool view_exists(const FsPath& rel) {
+    FsPath p;
+    return view_resolve(rel, p);
+  };
+  bool view_is_directory(const FsPath& rel) {
+    FsPath p;
+    return (view_resolve(rel, p) && path_is_directory(p));
+  };
+  void view_list(const FsPath& rel, vector<string>& entries,
+                 bool filter_nodes);
+  bool view_read_file(const FsPath& rel, string& data);
+  bool view_write_file(const FsPath& rel, const string& data);
+  bool view_copy_up_dir(const FsPath& rel);
+  bool view_mkdir(const FsPath& rel);
+  bool view_remove(const FsPath& rel);
+  void view_export_tree(const FsPath& rel, const FsPath& dst,
+                        bool filter_dot_entries);
+  void view_find_markers(const FsPath& rel, const string& marker,
+                         bool include_self, vector<FsPath>& found);
+  bool view_mark_changed(const FsPath& rel);
+  bool view_sync(const FsPath& src, const FsPath& rel);
+  void list_dir(const FsPath& d, vector<string>& entries);
+
+  // marker files at current work path
+  bool view_marked(const string& marker);
+  bool view_mark(const string& marker, const char *what);
+  bool view_unmark(const string& marker, const char *what);
+  // marker files at union root
+  FsPath root_marker(const string& marker) {
+    FsPath p;
+    p.push(marker);
+    return p;
+  };
+};
+
+} // end namespace unionfs
+} // end namespace cstore
+
+#endif /* _CSTORE_UNIONVIEW_H_ */
@@ -16,6 +16,8 @@
 
 #ifndef _UTIL_H_
 #define _UTIL_H_
+#include <cstring>
+#include <string>
 #include <tr1/unordered_map>
 
 namespace cstore { // begin namespace cstore
@@ -30,6 +32,42 @@ struct Int2Type {
   };
 };
 
+/* reference to (part of) a string owned by someone else, e.g., a token in
+ * a config file buffer, so it is not necessarily NUL-terminated. a "null"
+ * view (no data) is different from an empty one.
+ */
+struct StrView {
+  StrView() : data(0), len(0) {};
+  StrView(const char *d, size_t l) : data(d), len(l) {};
+  StrView(const char *cstr) : data(cstr), len(cstr ? strlen(cstr) : 0) {};
+  StrView(const std::string& str) : data(str.data()), len(str.size()) {};
+
+  bool isNull() const { return (data == 0); };
+  bool operator==(const char *cstr) const {
+    return (strlen(cstr) == len
+            && (len == 0 || memcmp(data, cstr, len) == 0));
+  };
+  bool operator!=(const char *cstr) const { return !operator==(cstr); };
+  bool operator==(const StrView& rhs) const {
+    return (len == rhs.len && (len == 0 || memcmp(data, rhs.data, len) == 0));
+  };
+  std::string str() const { return std::string(data, len); };
+
+  const char *data;
+  size_t len;
+};
+
+// FNV-1a
+struct StrViewHash {
+  inline size_t operator()(const StrView& s) const {
+    size_t h = static_cast<size_t>(14695981039346656037ULL);
+    for (size_t i = 0; i < s.len; i++) {
+      h = (h ^ static_cast<unsigned char>(s.data[i])) * 1099511628211ULL;
+    }
+    return h;
+  };
+};
+
 } // end namespace cstore
 
 #endif /* _UTIL_H_ */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* check that a config image (see CfgImage) survives a save/load round
+ * trip, and that truncated or corrupt images and images written with
+ * different templates are rejected.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdint.h>
+
+#include <cstore/cstore.hpp>
+#include <cnode/cnode.hpp>
+#include <cnode/cnode-arena.hpp>
+#include <cnode/cnode-image.hpp>
+#include <cnode/cnode-algorithm.hpp>
+
+using namespace std;
+using namespace cstore;
+using namespace cnode;
+
+static const size_t CHECKSUM_LEN = 8;
+
+static string test_dir;
+static int failed = 0;
+
+static void
+check(bool cond, const char *what)
+{
+  printf("%s: %s\n", (cond ? "ok" : "FAIL"), what);
+  if (!cond) {
+    failed++;
+  }
+}
+
+// create the directory and all its parents (relative to test_dir)
+static void
+make_dir(const string& dir)
+{
+  string path = test_dir;
+  size_t start = 0;
+  while (start <= dir.size()) {
+    size_t end = dir.find('/', start);
+    if (end == string::npos) {
+      end = dir.size();
+    }
+    path += "/" + dir.substr(start, end - start);
+    mkdir(path.c_str(), 0755);
+    start = end + 1;
+  }
+}
+
+static void
+write_file(const string& dir, const char *file, const string& data)
+{
+  make_dir(dir);
+  string path = test_dir + "/" + dir + "/" + file;
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp) {
+    perror(path.c_str());
+    exit(1);
+  }
+  fputs(data.c_str(), fp);
+  fclose(fp);
+}
+
+static string
+read_file(const string& path)
+{
+  string data;
+  FILE *fp = fopen(path.c_str(), "r");
+  if (!fp) {
+    return data;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.append(buf, n);
+  }
+  fclose(fp);
+  return data;
+}
+
+static void
+write_image(const string& path, const string& img)
+{
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp || fwrite(img.data(), 1, img.size(), fp) != img.size()) {
+    perror(path.c_str());
+    exit(1);
+  }
+  fclose(fp);
+}
+
+// replace the checksum at the end of the image (FNV-1a of the rest)
+static void
+fix_checksum(string& img)
+{
+  size_t len = img.size() - CHECKSUM_LEN;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ static_cast<unsigned char>(img[i])) * 0x100000001b3ULL;
+  }
+  for (size_t i = 0; i < CHECKSUM_LEN; i++) {
+    img[len + i] = static_cast<char>((h >> (i * 8)) & 0xff);
+  }
+}
+
+static void
+setup()
+{
+  char tmpl[] = "/tmp/cnode-image.XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  test_dir = tmpl;
+
+  write_file("tmpl/interfaces", "node.def", "");
+  write_file("tmpl/interfaces/ethernet", "node.def", "tag:\ntype: txt\n");
+  write_file("tmpl/interfaces/ethernet/node.tag/address", "node.def",
+             "multi:\ntype: txt\n");
+  write_file("tmpl/interfaces/ethernet/node.tag/disable", "node.def", "");
+  write_file("tmpl/system", "node.def", "");
+  write_file("tmpl/system/host-name", "node.def", "type: txt\n");
+
+  write_file("active/interfaces/ethernet/eth0/address", "node.val",
+             "10.0.0.1/24\n10.1.0.1/24");
+  write_file("active/interfaces/ethernet/eth1/address", "node.val",
+             "10.0.1.1/24");
+  write_file("active/interfaces/ethernet/eth1/disable", "node.val", "");
+  write_file("active/system/host-name", "node.val", "vyos");
+
+  setenv("VYATTA_CONFIG_TEMPLATE", (test_dir + "/tmpl").c_str(), 1);
+  setenv("VYATTA_ACTIVE_CONFIGURATION_DIR", (test_dir + "/active").c_str(),
+         1);
+}
+
+static Cpath
+make_path(const char *comps)
+{
+  Cpath path;
+  string s(comps);
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(' ', start);
+    if (end == string::npos) {
+      end = s.size();
+    }
+    path.push(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return path;
+}
+
+// whether the image file loads (the tree is discarded)
+static bool
+loads(const string& file, Cstore *cs)
+{
+  CfgNode *root = CfgImage::load(file, cs);
+  delete root;
+  return (root != NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+  if (argc == 2) {
+    // only load the image (see below)
+    Cstore *cs = Cstore::createCstore(false);
+    bool ok = loads(argv[1], cs);
+    delete cs;
+    return (ok ? 0 : 1);
+  }
+
+  setup();
+  string file = test_dir + "/config.img";
+  string file2 = test_dir + "/config2.img";
+  string bad = test_dir + "/bad.img";
+
+  {
+    Cstore *cs = Cstore::createCstore(false);
+    CfgNodeArena arena;
+    CfgNodeArena::Scope ascope(arena);
+    Cpath root_path;
+    CfgNode root(*cs, root_path, true, true);
+    check(CfgImage::save(root, file), "save");
+    check(CfgImage::isImage(file), "saved file is an image");
+
+    CfgNode *lroot = CfgImage::load(file, cs);
+    check(lroot != NULL, "load");
+    if (lroot) {
+      string value;
+      vector<string> values;
+      check(getCfgNodeValue(lroot, make_path("system host-name"), value)
+            && value == "vyos", "loaded value");
+      check(getCfgNodeValues(lroot,
+                             make_path("interfaces ethernet eth0 address"),
+                             values)
+            && values.size() == 2 && values[1] == "10.1.0.1/24",
+            "loaded multi values");
+      CfgNode *n = findCfgNode(lroot,
+                               make_path("interfaces ethernet eth1 disable"));
+      check(n && n->getTmpl().get(), "loaded node has template");
+      check(CfgImage::save(*lroot, file2)
+            && read_file(file) == read_file(file2), "round trip");
+      delete lroot;
+    }
+    delete cs;
+  }
+
+  string img = read_file(file);
+  {
+    Cstore *cs = Cstore::createCstore(false);
+    bool ok = true;
+    for (size_t len = 0; ok && len < img.size(); len++) {
+      write_image(bad, img.substr(0, len));
+      ok = !loads(bad, cs);
+    }
+    check(ok, "truncated image rejected");
+
+    ok = true;
+    for (size_t i = 0; ok && i < img.size(); i++) {
+      string corrupt = img;
+      corrupt[i] ^= 0x10;
+      write_image(bad, corrupt);
+      ok = !loads(bad, cs);
+    }
+    check(ok, "corrupt image rejected");
+
+    /* with a valid checksum, a corrupt image may still happen to be valid,
+     * but reading it must not fail in other ways.
+     */
+    for (size_t i = 8; i < img.size() - CHECKSUM_LEN; i++) {
+      string corrupt = img;
+      corrupt[i] = static_cast<char>(0xff);
+      fix_checksum(corrupt);
+      write_image(bad, corrupt);
+      loads(bad, cs);
+      loads(bad, NULL);
+    }
+    check(true, "corrupt image with valid checksum");
+    delete cs;
+  }
+
+  /* change a template used by the config. parsed templates are cached in
+   * the process, so the image is loaded with the new one in a new process
+   * (this program with the image file as argument).
+   */
+  write_file("tmpl/system/host-name", "node.def", "type: u32\n");
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(argv[0], argv[0], file.c_str(), (char *) NULL);
+    _exit(2);
+  }
+  int status;
+  check(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == 1, "image with changed templates rejected");
+  check(loads(file, NULL), "image loaded without templates");
+
+  string cmd = "rm -rf " + test_dir;
+  if (system(cmd.c_str()) != 0) {
+    perror(cmd.c_str());
+  }
+  return (failed ? 1 : 0);
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* check that a lazy tree (see CfgNode::createLazy()) only materializes
+ * the nodes along the path of a lookup, i.e., the subtrees that are not
+ * descended into are never read.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstore/cstore.hpp>
+#include <cnode/cnode.hpp>
+#include <cnode/cnode-arena.hpp>
+#include <cnode/cnode-algorithm.hpp>
+
+using namespace std;
+using namespace cstore;
+using namespace cnode;
+
+static const size_t NUM_INTFS = 50;
+
+static string test_dir;
+static int failed = 0;
+
+static void
+check(bool cond, const char *what)
+{
+  printf("%s: %s\n", (cond ? "ok" : "FAIL"), what);
+  if (!cond) {
+    failed++;
+  }
+}
+
+// create the directory and all its parents (relative to test_dir)
+static void
+make_dir(const string& dir)
+{
+  string path = test_dir;
+  size_t start = 0;
+  while (start <= dir.size()) {
+    size_t end = dir.find('/', start);
+    if (end == string::npos) {
+      end = dir.size();
+    }
+    path += "/" + dir.substr(start, end - start);
+    mkdir(path.c_str(), 0755);
+    start = end + 1;
+  }
+}
+
+static void
+write_file(const string& dir, const char *file, const string& data)
+{
+  make_dir(dir);
+  string path = test_dir + "/" + dir + "/" + file;
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp) {
+    perror(path.c_str());
+    exit(1);
+  }
+  fputs(data.c_str(), fp);
+  fclose(fp);
+}
+
+static void
+setup()
+{
+  char tmpl[] = "/tmp/cnode-lazy.XXXXXX";
+  if (!mkdtemp(tmpl)) {
+    perror("mkdtemp");
+    exit(1);
+  }
+  test_dir = tmpl;
+
+  write_file("tmpl/interfaces", "node.def", "");
+  write_file("tmpl/interfaces/ethernet", "node.def", "tag:\ntype: txt\n");
+  write_file("tmpl/interfaces/ethernet/node.tag/address", "node.def",
+             "multi:\ntype: txt\n");
+  write_file("tmpl/system", "node.def", "");
+  write_file("tmpl/system/host-name", "node.def", "type: txt\n");
+
+  for (size_t i = 0; i < NUM_INTFS; i++) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "active/interfaces/ethernet/eth%zu/address",
+             i);
+    char vals[64];
+    snprintf(vals, sizeof(vals), "10.0.%zu.1/24\n10.1.%zu.1/24", i, i);
+    write_file(buf, "node.val", vals);
+  }
+  write_file("active/system/host-name", "node.val", "vyos");
+
+  setenv("VYATTA_CONFIG_TEMPLATE", (test_dir + "/tmpl").c_str(), 1);
+  setenv("VYATTA_ACTIVE_CONFIGURATION_DIR", (test_dir + "/active").c_str(),
+         1);
+}
+
+static Cpath
+make_path(const char *comps)
+{
+  Cpath path;
+  string s(comps);
+  size_t start = 0;
+  while (start < s.size()) {
+    size_t end = s.find(' ', start);
+    if (end == string::npos) {
+      end = s.size();
+    }
+    path.push(s.substr(start, end - start));
+    start = end + 1;
+  }
+  return path;
+}
+
+int
+main()
+{
+  setup();
+  Cstore *cs = Cstore::createCstore(false);
+
+  // root, interfaces, ethernet, 2 per interface, system, host-name
+  const size_t all_nodes = 5 + 2 * NUM_INTFS;
+  {
+    CfgNodeArena arena;
+    CfgNodeArena::Scope ascope(arena);
+    Cpath root_path;
+    CfgNode root(*cs, root_path, true, true);
+    check(arena.numLiveNodes() + 1 == all_nodes, "eager tree reads all");
+  }
+
+  {
+    CfgNodeArena arena;
+    CfgNodeArena::Scope ascope(arena);
+    CfgNode *root = CfgNode::createLazy(*cs, Cpath(), true);
+    string value;
+    check(getCfgNodeValue(root, make_path("system host-name"), value)
+          && value == "vyos", "lazy value lookup");
+    // root, interfaces, system, host-name: nothing under "interfaces"
+    check(arena.numLiveNodes() == 4, "lazy value lookup reads the path");
+    delete root;
+  }
+
+  {
+    CfgNodeArena arena;
+    CfgNodeArena::Scope ascope(arena);
+    CfgNode *root = CfgNode::createLazy(*cs, Cpath(), true);
+    vector<string> values;
+    check(getCfgNodeValues(root,
+                           make_path("interfaces ethernet eth7 address"),
+                           values)
+          && values.size() == 2 && values[0] == "10.0.7.1/24",
+          "lazy values lookup");
+    /* root, interfaces, system, ethernet, the tag values, and address of
+     * eth7 only: the other interfaces are never descended into.
+     */
+    check(arena.numLiveNodes() == 5 + NUM_INTFS,
+          "lazy values lookup reads the path");
+    check(!findCfgNode(root, make_path("interfaces ethernet eth99")),
+          "lazy lookup of missing node");
+    check(arena.numLiveNodes() == 5 + NUM_INTFS,
+          "lazy lookup of missing node reads nothing more");
+    delete root;
+  }
+
+  delete cs;
+  string cmd = "rm -rf " + test_dir;
+  if (system(cmd.c_str()) != 0) {
+    perror(cmd.c_str());
+  }
+  return (failed ? 1 : 0);
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2026 VyOS maintainers and contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* check that VersionKey orders names exactly like the apt library's
+ * debVersioningSystem::CmpVersion(), which was used before. the table is
+ * in ascending order as sorted by apt, and each entry is either greater
+ * than ('<') or equal to ('=') the one before it.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <cstore/cstore-sort.hpp>
+
+using namespace std;
+using namespace cstore;
+
+static const struct {
+  char rel;
+  const char *name;
+} order[] = {
+  { ' ', "~~" },
+  { '<', "~" },
+  { '<', "~a" },
+  { '<', "-" },
+  { '<', "0" },
+  { '<', "1~" },
+  { '<', "1-" },
+  { '<', "1" },
+  { '=', "01" },
+  { '=', "001" },
+  { '=', "0:1" },
+  { '<', "1-1-1" },
+  { '<', "1.0~~" },
+  { '<', "1.0~~a" },
+  { '<', "1.0~" },
+  { '<', "1.0~rc1" },
+  { '<', "1.0-" },
+  { '<', "1.0" },
+  { '=', "1.00" },
+  { '<', "1.0-1" },
+  { '<', "1.0+b1" },
+  { '<', "1.0--1" },
+  { '<', "1.0.0" },
+  { '<', "2" },
+  { '<', "9" },
+  { '<', "10" },
+  { '=', "010" },
+  { '<', "10.0.0.1" },
+  { '<', "10.0.0.1/8" },
+  { '<', "10.0.0.1/24" },
+  { '<', "10.0.0.2" },
+  { '<', "10.0.0.10" },
+  { '<', "99" },
+  { '<', "100" },
+  { '<', "192.168.1.1" },
+  { '<', "A" },
+  { '<', "Z" },
+  { '<', "a~" },
+  { '<', "a-" },
+  { '<', "a" },
+  { '<', "a-1" },
+  { '<', "a-b" },
+  { '<', "a1" },
+  { '<', "aa" },
+  { '<', "a+b" },
+  { '<', "a--" },
+  { '<', "a.b" },
+  { '<', "b" },
+  { '<', "bond0" },
+  { '<', "bond0.100" },
+  { '<', "br0" },
+  { '<', "eth0" },
+  { '<', "eth0.0" },
+  { '<', "eth1" },
+  { '=', "eth01" },
+  { '<', "eth1.2" },
+  { '<', "eth1.10" },
+  { '<', "eth1.100" },
+  { '<', "eth2" },
+  { '<', "eth10" },
+  { '<', "lo" },
+  { '<', "vtun10" },
+  { '<', "+" },
+  { '<', "--" },
+  { '<', "." },
+  { '<', "::" },
+  { '<', "::1" },
+  { '<', "1:" },
+  { '<', "1:0" },
+  { '<', "01:1" },
+  { '<', "1::" },
+  { '<', "2:0" },
+  { '<', "10:1" },
+  { '<', "2001:0db8::1" },
+  { '<', "2001:db8:0:1::1" },
+  { '<', "2001:db8::1" },
+  { '<', "2001:db8::2" },
+  { '<', "2001:db8::10" },
+  { '<', "a:b" },
+  { '<', "a::1" },
+  { '<', "fe80::1" },
+  { '<', "fe80::a" },
+};
+static const size_t num_names = sizeof(order) / sizeof(order[0]);
+
+static int
+sign(int r)
+{
+  return (r < 0 ? -1 : (r > 0 ? 1 : 0));
+}
+
+static int
+key_cmp(const char *a, const char *b)
+{
+  return sign(VersionKey::cmp(a, strlen(a), b, strlen(b)));
+}
+
+int
+main()
+{
+  int failed = 0;
+
+  // rank of each entry (equal entries have the same rank)
+  vector<size_t> rank(num_names, 0);
+  for (size_t i = 1; i < num_names; i++) {
+    rank[i] = rank[i - 1] + (order[i].rel == '<' ? 1 : 0);
+  }
+
+  // every pair compares as in the table (both ways)
+  for (size_t i = 0; i < num_names; i++) {
+    for (size_t j = 0; j < num_names; j++) {
+      int exp = (rank[i] < rank[j] ? -1 : (rank[i] > rank[j] ? 1 : 0));
+      int got = key_cmp(order[i].name, order[j].name);
+      if (got != exp) {
+        printf("FAIL: cmp(\"%s\", \"%s\") = %d, expected %d\n",
+               order[i].name, order[j].name, got, exp);
+        failed++;
+      }
+    }
+  }
+
+  // sorting the reversed table gives the same order (up to equal names)
+  vector<string> names;
+  for (size_t i = num_names; i > 0; i--) {
+    names.push_back(order[i - 1].name);
+  }
+  VersionKey::sort(names);
+  for (size_t i = 0; i < num_names; i++) {
+    size_t j = 0;
+    while (j < num_names && names[i] != order[j].name) {
+      ++j;
+    }
+    if (j == num_names || rank[j] != rank[i]) {
+      printf("FAIL: sorted[%zu] is \"%s\", expected \"%s\"\n", i,
+             names[i].c_str(), order[i].name);
+      failed++;
+    }
+  }
+
+  printf("%s: %zu names\n", (failed ? "FAIL" : "ok"), num_names);
+  return (failed ? 1 : 0);
+}